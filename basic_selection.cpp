@@ -1,15 +1,29 @@
 #include "framework.h"
 #include "intersection.h"
+#include "triangle_bvh.h"
+#include "dynamic_aabb_tree.h"
+#include "lasso_mask.h"
+#include "sweep_and_prune.h"
+#include "kd_tree.h"
+#include "slot_map.h"
+#include "selection_set.h"
+#include "pool_allocator.h"
+#include "spill_journal.h"
+#include "persistent_array.h"
+#include "transform_cache.h"
+#include "instance_buffer.h"
 
 #include "debug_draw.h"
 
+#include <unordered_map>
+
 using namespace prototyper;
 
 DebugDrawManager ddman;
 
 // TODO:
 // ---proper multi-selection handling (still separate transformation basis)
-// group/ungroup (common transformation basis), copy, paste, cut
+// ---group/ungroup (common transformation basis), copy, paste, cut
 // duplicate (chained events, do it packed?)
 // ---do we really need set_end? how to do it in a more robust way? --> yes. no I didn't find any. (we're not using it too often anyway)
 //
@@ -26,353 +40,1926 @@ DebugDrawManager ddman;
 // ---translate global: ctrl + t + drag mouse
 // ---rotate global: ctrl + r + drag mouse
 // ---copy object: ctrl + c
-// ---paste object: ctrl + v (should paste at the mouse cursor)
+// ---paste object: ctrl + v (pastes at the mouse cursor)
 // ---cut object: ctrl + x
-// ---add object: space (should add it at the mouse cursor)
+// ---add object: space (adds it at the mouse cursor)
 // ---delete object: del
 // duplicate object: ctrl + space (begins translating it too)
 // ---undo: ctrl + z
 // ---redo: ctrl + shift + z
 // ---select single object: left click
 // ---add object to selection: shift + left click
-// box-select: b + drag mouse (construct sub-frustum?)
+// ---box-select: b + drag mouse (sub-frustum of the rectangle)
+// ---lasso-select: l + drag mouse (projected bounds against the lasso)
 // ---select all: ctrl + a
 // ---deselect all: left click on non-object area
 // ---invert selection: ctrl + i
 // apply discrete amount of transformation: ctrl + shift + ...
 // ---toggle wireframe: f
-// group: ctrl + g
-// ungroup: ctrl + shift + g
+// ---group: ctrl + g
+// ---ungroup: ctrl + shift + g
 // ---toggle lock trasnformation to x / y / z planes: 1 / 2 / 3
+// ---toggle highlighting interpenetrating objects: o
+// ---toggle stopping translated objects at contact: p
+// ---toggle snapping to the vertices of other objects while translating: v
+// ---print the memory use of the undo history: h
+
+typedef slot_handle object_handle;
 
 class selection_object
 {
   public:
     mat4 rotation_mat;
-    vec3 translate_vec, scale_vec;
-    bool selected;
+    vec3 translate_vec, scale_vec; //relative to the group it is in, if it is in one
+    object_handle parent; //the group it is in, or null
+    bool is_group; //has no mesh, it only moves the objects in it
+    bool highlighted; //inside the lasso being drawn
+    int proxy; //leaf in object_tree
+    int overlap_proxy; //in object_overlaps
+    bool snap_moved; //its vertices in snap_tree are out of date, it is in snap_moved_objects instead
 
     selection_object() :
       rotation_mat( mat4::identity ),
       translate_vec( vec3(0) ),
       scale_vec( vec3( 1 ) ),
-      selected( false ) {}
+      is_group( false ),
+      highlighted( false ),
+      proxy( -1 ),
+      overlap_proxy( -1 ),
+      snap_moved( false ) {}
+};
+
+//the objects in the scene, packed for iteration
+//everything that outlives a frame (commands, the acceleration structures) refers to them by handle,
+//pointers to them are only valid until the next object is added or removed
+slot_map<selection_object> objects;
+vector<selection_object> selection_buffer; //the clipboard
+
+vector<int> selection_buffer_parents; //index of the group of each object in the clipboard, or -1
+
+//which objects are selected, only commands change it so that undo and redo keep it in sync
+//only the objects that aren't in a group are in it, selecting a group selects everything in it
+selection_set<object_handle> selection;
+
+//what the instanced draw of the objects needs of each of them, see selection.vs
+class object_instance
+{
+  public:
+    mat4 model; //all zero for slots that don't draw anything (empty slots, groups)
+    vec4 col;
+
+    object_instance() : model( 0 ), col( 0 )
+    {
+    }
+};
+
+//the instances of the objects by slot, the ones whose transformation or colour changed are uploaded before drawing
+instance_buffer<object_instance> object_instances;
+
+//the objects whose colour (and that of everything in them) may have changed since the last draw
+vector<object_handle> recoloured;
+
+void recolour( object_handle h )
+{
+  if( !h.is_null() )
+    recoloured.push_back( h );
+}
+
+void set_colour( object_handle h, const vec3& col )
+{
+  if( h.index < object_instances.size() )
+  {
+    const vec4& old = object_instances.get( h.index ).col;
+
+    if( old.x == col.x && old.y == col.y && old.z == col.z )
+      return;
+  }
+
+  object_instances.modify( h.index ).col = vec4( col, 1 );
+}
+
+//the slots whose object changed since the scene was last saved, only kept track of when undoing by snapshots
+bool track_changes = false;
+vector<unsigned> changed_slots;
+vector<bool> slot_changed;
+
+void mark_changed( object_handle h )
+{
+  if( !track_changes )
+    return;
+
+  if( h.index >= slot_changed.size() )
+    slot_changed.resize( h.index + 1, false );
+
+  if( !slot_changed[h.index] )
+  {
+    slot_changed[h.index] = true;
+    changed_slots.push_back( h.index );
+  }
+}
+
+void select_object( object_handle h )
+{
+  selection.select( h );
+  mark_changed( h );
+  recolour( h );
+}
+
+void deselect_object( object_handle h )
+{
+  selection.deselect( h );
+  mark_changed( h );
+  recolour( h );
+}
+
+//world space bounds of the objects in the scene, for picking and culling
+dynamic_aabb_tree<object_handle> object_tree;
+
+//the pairs of objects whose world space boxes overlap, for finding interpenetrating objects
+sweep_and_prune<object_handle> object_overlaps;
+
+//object space bounds of the mesh every object uses
+obb object_bounds( vec3( 0 ), vec3( 1 ) );
+aabb object_aabb( vec3( 0 ), vec3( 1 ) );
+
+//object space triangles of the mesh every object uses, for exact picking
+triangle_bvh object_bvh;
+
+//object space vertices of the mesh every object uses (without the duplicates of the triangle soup)
+vector<vec3> object_vertices;
+
+//world space vertices of the objects in the scene, for vertex snapping
+//it is rebuilt lazily: the objects that moved since are skipped in it, and tested one by one instead
+//the handles of removed objects simply don't resolve anymore
+kd_tree<object_handle> snap_tree;
+vector<object_handle> snap_moved_objects;
+bool snap_tree_valid = false;
+const int max_snap_moved_objects = 256;
+
+//counts the changes of the bounds of the objects (moving, adding, removing), for keeping results that depend on them
+unsigned scene_version = 0;
+
+//world matrices of the objects in the scene by slot, with the groups as the parents of the objects in them
+//refit() marks them dirty, and the dirty ones (and what is in them) are recomputed together by update_transforms()
+transform_cache object_transforms;
+
+//height of the reference grid, rays that miss every object land on it
+const float grid_height = -2;
+
+//relative to its group, of objects that aren't in the scene (eg. the clipboard)
+mat4 get_model_matrix( const selection_object* o )
+{
+  return create_translation( o->translate_vec ) * o->rotation_mat * create_scale( o->scale_vec );
+}
+
+//brings every object that moved (or whose group moved) up to date, and refits their bounds in the tree and the broad phase
+//call before using the matrices or the bounds of many objects
+void update_transforms()
+{
+  if( !object_transforms.has_dirty() )
+    return;
+
+  ++scene_version;
+
+  object_transforms.update( []( unsigned slot, vec3 & t, mat4 & r, vec3 & s )
+  {
+    const selection_object* o = objects.get( objects.get_slot_handle( slot ) );
+    t = o->translate_vec;
+    r = o->rotation_mat;
+    s = o->scale_vec;
+  }, []( unsigned slot )
+  {
+    object_handle h = objects.get_slot_handle( slot );
+    selection_object* o = objects.get( h );
+
+    if( o->is_group )
+      return;
+
+    //the object space box transformed by arvo's method, the vertices are never touched
+    aabb box = transform_aabb( object_aabb, object_transforms.get_model( slot ) );
+    object_tree.update( o->proxy, box );
+    object_overlaps.update( o->overlap_proxy, box );
+    object_instances.modify( slot ).model = object_transforms.get_model( slot );
+
+    if( !o->snap_moved )
+    {
+      o->snap_moved = true;
+      snap_moved_objects.push_back( h );
+    }
+  } );
+}
+
+const mat4& get_model_matrix( object_handle h )
+{
+  if( object_transforms.is_dirty( h.index ) )
+    update_transforms();
+
+  return object_transforms.get_model( h.index );
+}
+
+const mat4& get_inverse_model_matrix( object_handle h )
+{
+  if( object_transforms.is_dirty( h.index ) )
+    update_transforms();
+
+  return object_transforms.get_inverse( h.index );
+}
+
+obb get_world_obb( object_handle h )
+{
+  return obb( object_bounds, get_model_matrix( h ) );
+}
+
+//adds a copy of the object, under its old handle if it had one (eg. undoing a delete)
+object_handle add_to_scene( const selection_object& value, object_handle h = object_handle() )
+{
+  if( h.is_null() )
+    h = objects.insert( value );
+  else
+    objects.insert_at( h, value );
+
+  selection_object* o = objects.get( h );
+  object_transforms.add( h.index, o->parent.is_null() ? transform_cache::no_parent : o->parent.index );
+
+  if( o->parent.is_null() )
+    selection.add( h );
+
+  if( !o->is_group )
+  {
+    //the box is only right for objects that aren't in a group, the others are refitted with their group
+    //(which may not even be in the scene yet, eg. undoing a delete adds the group back after)
+    aabb box = transform_aabb( object_aabb, get_model_matrix( o ) );
+    o->proxy = object_tree.insert( box, h );
+    o->overlap_proxy = object_overlaps.insert( box, h );
+
+    //copies of objects come with the flag set
+    o->snap_moved = true;
+    snap_moved_objects.push_back( h );
+  }
+
+  mark_changed( h );
+  recolour( h );
+  return h;
+}
+
+//returns the object as it was, so that it can be added back (unselected)
+selection_object remove_from_scene( object_handle h )
+{
+  selection_object value = *objects.get( h );
+
+  if( value.parent.is_null() )
+    selection.remove( h );
+
+  if( !value.is_group )
+  {
+    object_tree.remove( value.proxy );
+    object_overlaps.remove( value.overlap_proxy );
+  }
+
+  object_transforms.remove( h.index );
+  object_instances.modify( h.index ) = object_instance();
+  ++scene_version;
+  objects.erase( h );
+  mark_changed( h );
+
+  value.proxy = -1;
+  value.overlap_proxy = -1;
+  return value;
+}
+
+//call whenever the transformation of an object changes
+//the matrices and the bounds (of it and of what is in it) are only updated when they are used next
+void refit( object_handle h )
+{
+  object_transforms.mark_dirty( h.index );
+  mark_changed( h );
+}
+
+//puts an object into a group, or takes it out of one if the group is null
+//only objects that aren't in a group can be selected, so it leaves or enters the selectable ones
+void set_parent( object_handle h, object_handle parent )
+{
+  selection_object* o = objects.get( h );
+
+  if( o->parent.is_null() && !parent.is_null() )
+    selection.remove( h );
+  else if( !o->parent.is_null() && parent.is_null() )
+    selection.add( h );
+
+  o->parent = parent;
+  object_transforms.set_parent( h.index, parent.is_null() ? transform_cache::no_parent : parent.index );
+  refit( h );
+  recolour( h );
+}
+
+//the outermost group the object is in, or the object itself if it isn't in one
+object_handle get_root( object_handle h )
+{
+  for( const selection_object* o = objects.get( h ); o && !o->parent.is_null(); o = objects.get( h ) )
+    h = o->parent;
+
+  return h;
+}
+
+//calls callback( handle ) for the object and everything in it, groups before the objects in them
+template< class cbk >
+void for_each_in_group( object_handle h, cbk callback )
+{
+  object_transforms.for_each_in_subtree( h.index, [&]( unsigned slot )
+  {
+    callback( objects.get_slot_handle( slot ) );
+  } );
+}
+
+//number of objects that the object really interpenetrates (not just their boxes), for a group the sum over the objects in it
+//objects that are selected too (or are in a selected group) are left out when ignore_selected is set, as they move together
+int get_contact_count( object_handle h, bool ignore_selected )
+{
+  update_transforms();
+
+  int num = 0;
+
+  for_each_in_group( h, [&]( object_handle m )
+  {
+    if( objects.get( m )->is_group )
+      return;
+
+    obb bounds = get_world_obb( m );
+
+    object_overlaps.for_each_overlap( objects.get( m )->overlap_proxy, [&]( object_handle other )
+    {
+      if( !( ignore_selected && selection.is_selected( get_root( other ) ) ) && is_intersecting( bounds, get_world_obb( other ) ) )
+        ++num;
+    } );
+  } );
+
+  return num;
+}
+
+void get_world_vertices( object_handle h, vector<vec3>& out )
+{
+  const mat4& model = get_model_matrix( h );
+
+  for( auto& v : object_vertices )
+    out.push_back( ( model * vec4( v, 1 ) ).xyz );
+}
+
+//rebuilds snap_tree if it is invalid, or too many objects moved since the last build
+//moving selected objects don't count, as they are never snapped to
+void update_snap_tree()
+{
+  if( snap_tree_valid )
+  {
+    int num_moved = 0;
+
+    for( auto& h : snap_moved_objects )
+    {
+      const selection_object* c = objects.get( h );
+      num_moved += c && !selection.is_selected( get_root( h ) );
+    }
+
+    if( num_moved <= max_snap_moved_objects )
+      return;
+  }
+
+  vector<vec3> points;
+  vector<object_handle> owners;
+  points.reserve( objects.size() * object_vertices.size() );
+  owners.reserve( objects.size() * object_vertices.size() );
+
+  update_transforms();
+
+  for( unsigned c = 0; c < objects.size(); ++c )
+  {
+    if( objects[c].is_group )
+      continue;
+
+    get_world_vertices( objects.get_handle( c ), points );
+    owners.resize( points.size(), objects.get_handle( c ) );
+    objects[c].snap_moved = false;
+  }
+
+  snap_tree.build( points, owners );
+  snap_moved_objects.clear();
+  snap_tree_valid = true;
+}
+
+//closest vertex of an unselected object to p within max_dist
+bool find_snap_vertex( const vec3& p, float max_dist, vec3& result )
+{
+  update_snap_tree();
+
+  int idx = snap_tree.nearest( p, max_dist, []( object_handle h )
+  {
+    const selection_object* o = objects.get( h );
+    return o && !selection.is_selected( get_root( h ) ) && !o->snap_moved;
+  } );
+
+  float best_dist = max_dist;
+  bool found = idx > -1;
+
+  if( found )
+  {
+    result = snap_tree.get_point( idx );
+    best_dist = length( result - p );
+  }
+
+  vector<vec3> verts;
+
+  for( auto& h : snap_moved_objects )
+  {
+    const selection_object* c = objects.get( h );
+
+    if( !c || selection.is_selected( get_root( h ) ) )
+      continue;
+
+    verts.clear();
+    get_world_vertices( h, verts );
+
+    for( auto& v : verts )
+    {
+      float dist = length( v - p );
+
+      if( dist < best_dist )
+      {
+        best_dist = dist;
+        result = v;
+        found = true;
+      }
+    }
+  }
+
+  return found;
+}
+
+class scene_hit
+{
+  public:
+    object_handle o; //null if the ray landed on the grid
+    unsigned triangle; //in the mesh of the object
+    float dist;
+    vec3 pos, normal; //world space, the normal faces against the ray
+};
+
+//closest hit of a world space ray on the objects in the scene, or on the reference grid if no object is hit
+//the tree hands out the objects front to back, and only those that can still be closer get the exact test
+bool scene_raycast( const ray& r, scene_hit& hit, float max_dist = FLT_MAX )
+{
+  hit.o = object_handle();
+  update_transforms();
+
+  object_tree.query( r, [&]( object_handle h, float max_dist ) -> float
+  {
+    //the tree only knows the axis aligned bounds, which balloon for rotated objects
+    obb bounds = get_world_obb( h );
+    mm::vec2 bounds_dist = intersect( r, bounds ); //INVALID if it's missed
+
+    if( bounds_dist.x == INVALID || std::min( bounds_dist.x, bounds_dist.y ) > max_dist )
+      return max_dist;
+
+    //the direction is not normalized in object space, so t stays the world space distance
+    const mat4& inv_model = get_inverse_model_matrix( h );
+    ray obj_space_ray( ( inv_model * vec4( r.origin, 1 ) ).xyz, ( inv_model * vec4( r.direction, 0 ) ).xyz );
+
+    triangle_hit th;
+
+    if( object_bvh.intersect( obj_space_ray, th, max_dist ) )
+    {
+      hit.o = h;
+      hit.triangle = th.triangle;
+      hit.dist = th.t;
+      hit.normal = normalize( ( transpose( inv_model ) * vec4( th.normal, 0 ) ).xyz );
+      return th.t;
+    }
+
+    return max_dist;
+  }, max_dist );
+
+  if( hit.o.is_null() )
+  {
+    if( r.direction.y == 0 )
+      return false;
+
+    float t = ( grid_height - r.origin.y ) / r.direction.y;
+
+    if( t < 0 || t > max_dist )
+      return false;
+
+    hit.triangle = ~0u;
+    hit.dist = t;
+    hit.normal = vec3( 0, r.direction.y < 0 ? 1 : -1, 0 );
+  }
+
+  hit.pos = r.origin + r.direction * hit.dist;
+  return true;
+}
+
+//moves the objects (that aren't in the scene yet) so that they rest on the surface that was hit, centered on the hit point
+//parents[c] is the index of the group of objs[c] in objs (or -1), the groups come before the objects in them
+void place_on_surface( vector<selection_object>& objs, const vector<int>& parents, const scene_hit& hit )
+{
+  auto get_parent = [&]( unsigned c )
+  {
+    return c < parents.size() ? parents[c] : -1;
+  };
+
+  vector<mat4> models( objs.size() );
+  vec3 center = vec3( 0 );
+  float lowest = FLT_MAX; //along the normal
+  int num = 0;
+
+  for( unsigned c = 0; c < objs.size(); ++c )
+  {
+    models[c] = get_model_matrix( &objs[c] );
+
+    if( get_parent( c ) > -1 )
+      models[c] = models[get_parent( c )] * models[c];
+
+    if( objs[c].is_group )
+      continue;
+
+    obb bounds( object_bounds, models[c] );
+    center += bounds.center;
+    lowest = std::min( lowest, dot( bounds.center, hit.normal ) - bounds.get_radius( hit.normal ) );
+    ++num;
+  }
+
+  if( num == 0 )
+    return;
+
+  center /= float( num );
+
+  vec3 offset = hit.pos - center + hit.normal * ( dot( center, hit.normal ) - lowest );
+
+  //the objects in groups move with them
+  for( unsigned c = 0; c < objs.size(); ++c )
+    if( get_parent( c ) < 0 )
+      objs[c].translate_vec += offset;
+}
+
+//the commands of the history, they are small and come and go by the thousand
+pool_allocator command_memory;
+
+class command
+{
+  public:
+    object_handle o; //null for commands that work on many objects
+    bool chained;
+    enum command_type { PACKED, ADD, REMOVE, SELECT, DESELECT, GROUP, UNGROUP, TRANSLATE, ROTATE, SCALE, NONE } type;
+
+    //what load_command() has to create, the type alone doesn't tell
+    enum command_class { PACKED_CLASS, ADD_CLASS, REMOVE_CLASS, SELECT_CLASS, DESELECT_CLASS, BULK_SELECT_CLASS, GROUP_CLASS, TRANSFORM_CLASS };
+
+    virtual void execute() = 0;
+    virtual void unexecute() = 0;
+    virtual void set_end( object_handle e, command_type t ) = 0;
+
+    //for spilling the history to disk: save() writes the class and the state, load() reads back the state
+    virtual void save( byte_writer& out ) const = 0;
+    virtual void load( byte_reader& in ) = 0;
+
+    //bytes of memory the command holds
+    virtual size_t get_size() const = 0;
+
+    //the commands that wait for set_end (the transformations), in this one or in the ones packed into it
+    virtual void get_open_commands( vector<command*>& out )
+    {
+      if( type == TRANSLATE || type == ROTATE || type == SCALE )
+        out.push_back( this );
+    }
+
+    void save_base( byte_writer& out, command_class cc ) const
+    {
+      out.put( char( cc ) );
+      out.put( o );
+      out.put( chained );
+      out.put( int( type ) );
+    }
+
+    void* operator new( size_t size )
+    {
+      return command_memory.allocate( size );
+    }
+
+    //the size is that of the derived class, as the destructor is virtual
+    void operator delete( void* p, size_t size )
+    {
+      command_memory.deallocate( p, size );
+    }
+
+    command( object_handle oo = object_handle(), command_type ct = NONE ) : o( oo ), chained( false ), type( ct )
+    {
+    }
+
+    virtual ~command()
+    {
+    }
+};
+
+template< class t >
+size_t get_vector_size( const vector<t>& v )
+{
+  return v.capacity() * sizeof( t );
+}
+
+//creates a command from what save() wrote
+command* load_command( byte_reader& in );
+
+//what the editor undoes and redoes through, either by commands or by snapshots of the scene
+class undo_stack
+{
+  public:
+    virtual void put( command* c ) = 0;
+    virtual void undo() = 0;
+    virtual void redo() = 0;
+    virtual void set_end( object_handle o, command::command_type ct ) = 0;
+    virtual void print_stats() = 0;
+
+    virtual ~undo_stack()
+    {
+    }
+};
+
+//the undo stack of commands
+//when the commands take more memory than the budget, the ones farthest from the current step are written to the journal
+//and freed, and undo or redo reads them back when it gets to them. so the commands in memory are always one
+//contiguous range around the current step, the ones before and after it are in the journal
+class history : public undo_stack
+{
+    class spill_record
+    {
+      public:
+        unsigned long long offset;
+        size_t size;
+    };
+
+    vector<command*> commandlist; //0 where the command is in the journal
+    vector<size_t> sizes; //of the commands in memory
+    vector<spill_record> records; //of the commands in the journal
+    int ptr; // -1 means empty
+
+    int resident_first, resident_last; //the commands in memory are [first, last)
+    size_t resident_bytes;
+    size_t spilled_bytes;
+    size_t budget;
+    spill_journal journal;
+    byte_writer spill_buffer;
+
+    //the commands of the last step that still wait for set_end, by type and by the object they are for
+    //so ending a drag doesn't have to look through the history and the packed commands
+    unordered_map<unsigned long long, command*> open_commands[command::NONE];
+    vector<command*> open_scratch;
+
+    static unsigned long long get_key( object_handle o )
+    {
+      return ( unsigned long long )o.index << 32 | o.generation;
+    }
+
+    //undo and redo leave the step the open commands belong to
+    void close_commands()
+    {
+      for( auto& m : open_commands )
+        m.clear();
+    }
+
+    //the commands around the current step stay in memory no matter what, set_end changes the last one
+    static const int min_resident = 16;
+
+    bool spill( int c )
+    {
+      assert( c == resident_first || c == resident_last - 1 );
+
+      spill_buffer.data.clear();
+      commandlist[c]->save( spill_buffer );
+
+      long long offset = journal.append( spill_buffer.data.data(), spill_buffer.data.size() );
+
+      if( offset < 0 )
+        return false;
+
+      records[c].offset = offset;
+      records[c].size = spill_buffer.data.size();
+      spilled_bytes += records[c].size;
+
+      resident_bytes -= sizes[c];
+      delete commandlist[c];
+      commandlist[c] = 0;
+
+      if( c == resident_first )
+        ++resident_first;
+      else
+        --resident_last;
+
+      return true;
+    }
+
+    void page_in( int c )
+    {
+      assert( c == resident_first - 1 || c == resident_last );
+
+      const char* data = journal.read( records[c].offset, records[c].size );
+      assert( data );
+
+      byte_reader in( data, records[c].size );
+      commandlist[c] = load_command( in );
+      sizes[c] = commandlist[c]->get_size();
+      resident_bytes += sizes[c];
+      spilled_bytes -= records[c].size;
+
+      if( c == resident_first - 1 )
+        --resident_first;
+      else
+        ++resident_last;
+
+      //nothing is left in the journal, start it over
+      if( resident_first == 0 && size_t( resident_last ) == commandlist.size() )
+        journal.clear();
+    }
+
+    //the command changed its size (eg. it made room for its state when it first ran)
+    void update_size( int c )
+    {
+      resident_bytes -= sizes[c];
+      sizes[c] = commandlist[c]->get_size();
+      resident_bytes += sizes[c];
+    }
+
+    void trim()
+    {
+      while( resident_bytes > budget && resident_last - resident_first > min_resident && journal.is_open() )
+      {
+        //the end of the range that undo or redo gets to last
+        int front = ptr - resident_first, back = resident_last - 1 - ptr;
+
+        if( !spill( front >= back ? resident_first : resident_last - 1 ) )
+          break;
+      }
+    }
+
+  public:
+
+    void undo()
+    {
+      if( commandlist.size() > 0 && ptr < commandlist.size() && ptr > -1 )
+      {
+        while( ptr < resident_first )
+          page_in( resident_first - 1 );
+
+        commandlist[ptr]->unexecute();
+        update_size( ptr );
+      }
+
+      if( ptr > -1 )
+        --ptr;
+
+      close_commands();
+
+      trim();
+    }
+
+    void redo()
+    {
+      if( ptr < ( int )commandlist.size() - 1 )
+        ++ptr;
+      else return; //nothing to redo
+
+      if( commandlist.size() > 0 && ptr < commandlist.size() && ptr > -1 )
+      {
+        while( ptr >= resident_last )
+          page_in( resident_last );
+
+        commandlist[ptr]->execute();
+        update_size( ptr );
+      }
+
+      close_commands();
+      trim();
+    }
+
+    void put( command* c )
+    {
+      for( int d = ptr + 1; d < commandlist.size(); ++d )
+      {
+        if( commandlist[d] )
+        {
+          resident_bytes -= sizes[d];
+          delete commandlist[d];
+        }
+        else
+        {
+          spilled_bytes -= records[d].size;
+        }
+      }
+
+      ++ptr;
+      commandlist.resize( ptr + 1 );
+      sizes.resize( ptr + 1 );
+      records.resize( ptr + 1 );
+      resident_last = std::min( resident_last, ptr );
+      resident_first = std::min( resident_first, resident_last );
+
+      commandlist[ptr] = c;
+      commandlist[ptr]->execute();
+      sizes[ptr] = c->get_size();
+
+      //the previous step can't be ended anymore
+      close_commands();
+      open_scratch.clear();
+      c->get_open_commands( open_scratch );
+
+      for( auto& oc : open_scratch )
+        open_commands[oc->type][get_key( oc->o )] = oc;
+      resident_bytes += sizes[ptr];
+      ++resident_last;
+
+      trim();
+    }
+
+    //the open command of the last step that is for this object (null for the ones that are for many objects)
+    void set_end( object_handle o, command::command_type ct )
+    {
+      auto it = open_commands[ct].find( get_key( o ) );
+
+      if( it == open_commands[ct].end() )
+        return;
+
+      it->second->set_end( o, ct );
+      open_commands[ct].erase( it );
+    }
+
+    //bytes the history may keep in memory, the rest goes to the journal (if there's one)
+    void set_budget( size_t bytes )
+    {
+      budget = bytes;
+      trim();
+    }
+
+    bool open_journal( const string& filename )
+    {
+      return journal.open( filename );
+    }
+
+    int get_resident_count() const
+    {
+      return resident_last - resident_first;
+    }
+
+    int get_spilled_count() const
+    {
+      return commandlist.size() - get_resident_count();
+    }
+
+    size_t get_resident_bytes() const
+    {
+      return resident_bytes;
+    }
+
+    size_t get_spilled_bytes() const
+    {
+      return spilled_bytes;
+    }
+
+    //the journal is append only, it only shrinks when everything was read back
+    unsigned long long get_journal_size() const
+    {
+      return journal.get_size();
+    }
+
+    void print_stats()
+    {
+      cout << "History: " << get_resident_count() << " steps in memory (" << get_resident_bytes() / 1024 << " KB), "
+           << get_spilled_count() << " in the journal (" << get_spilled_bytes() / 1024 << " KB, file: "
+           << get_journal_size() / 1024 << " KB)" << endl;
+    }
+
+    history() : ptr( -1 ), resident_first( 0 ), resident_last( 0 ), resident_bytes( 0 ), spilled_bytes( 0 ), budget( size_t( -1 ) ) {}
+
+    ~history()
+    {
+      for( int c = 0; c < commandlist.size(); ++c )
+        delete commandlist[c];
+    }
+};
+
+class packed_command : public command
+{
+    vector< command* > pack;
+  public:
+    void execute()
+    {
+    for( auto & c : pack )
+      {
+        c->execute();
+      }
+    }
+
+    void unexecute()
+    {
+    for( auto & c : pack )
+      {
+        c->unexecute();
+      }
+    }
+
+    void put( command* c )
+    {
+      pack.push_back( c );
+    }
+
+    void set_end( object_handle e, command_type t )
+    {
+    for( auto & c : pack )
+      {
+        if( c->type == t && c->o == e )
+        {
+          c->set_end( e, t );
+        }
+      }
+    }
+
+    void get_open_commands( vector<command*>& out )
+    {
+      for( auto& c : pack )
+        c->get_open_commands( out );
+    }
+
+    void save( byte_writer& out ) const
+    {
+      save_base( out, PACKED_CLASS );
+      out.put( unsigned( pack.size() ) );
+
+      for( auto& c : pack )
+        c->save( out );
+    }
+
+    void load( byte_reader& in )
+    {
+      pack.resize( in.get<unsigned>() );
+
+      for( auto& c : pack )
+        c = load_command( in );
+    }
+
+    size_t get_size() const
+    {
+      size_t size = sizeof( *this ) + get_vector_size( pack );
+
+      for( auto& c : pack )
+        size += c->get_size();
+
+      return size;
+    }
+
+    bool empty()
+    {
+      return pack.empty();
+    }
+
+    packed_command( object_handle oo = object_handle(), command_type ct = PACKED ) : command( oo, ct )
+    {
+    }
+
+    ~packed_command()
+    {
+    for( auto & c : pack )
+      {
+        delete c;
+      }
+    }
+};
+
+//adds any number of objects as one command
+//the objects are kept by value while they are out of the scene, and come back under the same handles
+//parents[c] is the index of the group of values[c] in values (or -1), the groups come before the objects in them
+class add_command : public command
+{
+  public:
+    vector<selection_object> values;
+    vector<int> parents;
+    vector<object_handle> handles;
+
+    void execute()
+    {
+      handles.resize( values.size() );
+
+      for( unsigned c = 0; c < values.size(); ++c )
+      {
+        if( c < parents.size() && parents[c] > -1 )
+          values[c].parent = handles[parents[c]];
+
+        handles[c] = add_to_scene( values[c], handles[c] );
+      }
+    }
+
+    void unexecute()
+    {
+      for( int c = handles.size() - 1; c > -1; --c )
+        values[c] = remove_from_scene( handles[c] );
+    }
+
+    void set_end( object_handle e, command_type t )
+    {
+    }
+
+    void save( byte_writer& out ) const
+    {
+      save_base( out, ADD_CLASS );
+      out.put_vector( values );
+      out.put_vector( parents );
+      out.put_vector( handles );
+    }
+
+    void load( byte_reader& in )
+    {
+      in.get_vector( values );
+      in.get_vector( parents );
+      in.get_vector( handles );
+    }
+
+    size_t get_size() const
+    {
+      return sizeof( *this ) + get_vector_size( values ) + get_vector_size( parents ) + get_vector_size( handles );
+    }
+
+    add_command( const vector<selection_object>& v, const vector<int>& p = vector<int>(), command_type ct = ADD ) : command( object_handle(), ct ), values( v ), parents( p )
+    {
+    }
+};
+
+//removes any number of objects as one command, eg. deleting the selection
+//the objects in a group have to come before the group, so that adding them back in reverse puts the group back first
+class remove_command : public command
+{
+  public:
+    vector<object_handle> handles;
+    vector<selection_object> values;
+    vector<bool> was_selected;
+
+    void execute()
+    {
+      values.resize( handles.size() );
+      was_selected.resize( handles.size() );
+
+      for( unsigned c = 0; c < handles.size(); ++c )
+      {
+        was_selected[c] = selection.is_selected( handles[c] );
+        values[c] = remove_from_scene( handles[c] );
+      }
+    }
+
+    void unexecute()
+    {
+      for( int c = handles.size() - 1; c > -1; --c )
+      {
+        add_to_scene( values[c], handles[c] );
+
+        if( was_selected[c] )
+          select_object( handles[c] );
+      }
+    }
+
+    void set_end( object_handle e, command_type t )
+    {
+    }
+
+    void save( byte_writer& out ) const
+    {
+      save_base( out, REMOVE_CLASS );
+      out.put_vector( handles );
+      out.put_vector( values );
+      out.put_vector( was_selected );
+    }
+
+    void load( byte_reader& in )
+    {
+      in.get_vector( handles );
+      in.get_vector( values );
+      in.get_vector( was_selected );
+    }
+
+    size_t get_size() const
+    {
+      return sizeof( *this ) + get_vector_size( handles ) + get_vector_size( values ) + was_selected.capacity() / 8;
+    }
+
+    remove_command( const vector<object_handle>& h, command_type ct = REMOVE ) : command( object_handle(), ct ), handles( h )
+    {
+    }
+};
+
+class select_command : public command
+{
+  public:
+    void execute()
+    {
+      select_object( o );
+    }
+
+    void unexecute()
+    {
+      deselect_object( o );
+    }
+
+    void set_end( object_handle e, command_type t )
+    {
+    }
+
+    void save( byte_writer& out ) const
+    {
+      save_base( out, SELECT_CLASS );
+    }
+
+    void load( byte_reader& in )
+    {
+    }
+
+    size_t get_size() const
+    {
+      return sizeof( *this );
+    }
+
+    select_command( object_handle oo, command_type ct = SELECT ) : command( oo, ct )
+    {
+    }
 };
 
-vector<selection_object*> objects;
-vector<selection_object*> selection_buffer;
-
-class command
+class deselect_command : public command
 {
   public:
-    selection_object* o;
-    bool chained;
-    enum command_type { PACKED, ADD, REMOVE, SELECT, DESELECT, GROUP, UNGROUP, TRANSLATE, ROTATE, SCALE, NONE } type;
+    void execute()
+    {
+      deselect_object( o );
+    }
 
-    virtual void execute() = 0;
-    virtual void unexecute() = 0;
-    virtual void set_end( selection_object* e, command_type t ) = 0;
+    void unexecute()
+    {
+      select_object( o );
+    }
+
+    void set_end( object_handle e, command_type t )
+    {
+    }
+
+    void save( byte_writer& out ) const
+    {
+      save_base( out, DESELECT_CLASS );
+    }
+
+    void load( byte_reader& in )
+    {
+    }
+
+    size_t get_size() const
+    {
+      return sizeof( *this );
+    }
 
-    command( selection_object* oo = 0, command_type ct = NONE ) : o( oo ), chained( false ), type( ct )
+    deselect_command( object_handle oo, command_type ct = DESELECT ) : command( oo, ct )
     {
     }
 };
 
-class history
+//selects and deselects any number of objects as one command, eg. box selection
+class bulk_select_command : public command
 {
-    vector<command*> commandlist;
-    int ptr; // -1 means empty
-
   public:
+    vector<object_handle> to_select, to_deselect;
 
-    void undo()
+    void execute()
     {
-      if( commandlist.size() > 0 && ptr < commandlist.size() && ptr > -1 )
-        commandlist[ptr]->unexecute();
+      for( auto& c : to_select )
+        select_object( c );
 
-      if( ptr > -1 )
-        --ptr;
+      for( auto& c : to_deselect )
+        deselect_object( c );
     }
 
-    void redo()
+    void unexecute()
     {
-      if( ptr < ( int )commandlist.size() - 1 )
-        ++ptr;
-      else return; //nothing to redo
+      for( auto& c : to_select )
+        deselect_object( c );
 
-      if( commandlist.size() > 0 && ptr < commandlist.size() && ptr > -1 )
-        commandlist[ptr]->execute();
+      for( auto& c : to_deselect )
+        select_object( c );
     }
 
-    void put( command* c )
+    void set_end( object_handle e, command_type t )
     {
-      if( ptr > -1 )
-        for( int d = ptr + 1; d < commandlist.size(); ++d )
-          delete commandlist[d];
+    }
 
-      ++ptr;
-      commandlist.resize( ptr + 1 );
-      commandlist[ptr] = c;
-      commandlist[ptr]->execute();
+    void save( byte_writer& out ) const
+    {
+      save_base( out, BULK_SELECT_CLASS );
+      out.put_vector( to_select );
+      out.put_vector( to_deselect );
     }
 
-    void set_end( selection_object* o, command::command_type ct )
+    void load( byte_reader& in )
     {
-      if( commandlist.size() > 0 )
-        for( int c = commandlist.size() - 1; c > -1; --c )
-          if( commandlist[c]->type == command::PACKED || ( commandlist[c]->o == o && commandlist[c]->type == ct ) )
-          {
-            commandlist[c]->set_end( o, ct );
-            break;
-          }
+      in.get_vector( to_select );
+      in.get_vector( to_deselect );
     }
 
-    history() : ptr( -1 ) {}
+    size_t get_size() const
+    {
+      return sizeof( *this ) + get_vector_size( to_select ) + get_vector_size( to_deselect );
+    }
 
-    ~history()
+    bulk_select_command( command_type ct = SELECT ) : command( object_handle(), ct )
     {
-      for( int c = 0; c < commandlist.size(); ++c )
-        delete commandlist[c];
     }
 };
 
-class packed_command : public command
+//where an object is relative to its group, or to the world if it isn't in one
+class local_transform
 {
-    vector< command* > pack;
   public:
-    void execute()
+    vec3 translate_vec, scale_vec;
+    mat4 rotation_mat;
+
+    void apply( selection_object* o ) const
     {
-    for( auto & c : pack )
+      o->translate_vec = translate_vec;
+      o->scale_vec = scale_vec;
+      o->rotation_mat = rotation_mat;
+    }
+
+    local_transform( const selection_object& o ) : translate_vec( o.translate_vec ), scale_vec( o.scale_vec ), rotation_mat( o.rotation_mat )
+    {
+    }
+
+    local_transform()
+    {
+    }
+};
+
+//puts objects into a new group (o), or with UNGROUP takes the objects out of the group (o) and removes it
+//either is the other run backwards. the objects stay where they are in the world, their transformations
+//switch between the grouped ones (relative to the group) and the ungrouped ones
+class group_command : public command
+{
+    void group()
+    {
+      o = add_to_scene( group_value, o );
+
+      for( unsigned c = 0; c < children.size(); ++c )
       {
-        c->execute();
+        set_parent( children[c], o );
+        grouped[c].apply( objects.get( children[c] ) );
       }
+
+      select_object( o );
     }
 
-    void unexecute()
+    void ungroup()
     {
-    for( auto & c : pack )
+      for( unsigned c = 0; c < children.size(); ++c )
       {
-        c->unexecute();
+        set_parent( children[c], object_handle() );
+        ungrouped[c].apply( objects.get( children[c] ) );
+        select_object( children[c] );
       }
+
+      group_value = remove_from_scene( o );
     }
 
-    void put( command* c )
+  public:
+    selection_object group_value; //while the group isn't in the scene
+    vector<object_handle> children;
+    vector<local_transform> grouped, ungrouped;
+
+    void execute()
     {
-      pack.push_back( c );
+      if( type == GROUP )
+        group();
+      else
+        ungroup();
     }
 
-    void set_end( selection_object* e, command_type t )
+    void unexecute()
     {
-    for( auto & c : pack )
-      {
-        if( c->type == t && c->o == e )
-        {
-          c->set_end( e, t );
-        }
-      }
+      if( type == GROUP )
+        ungroup();
+      else
+        group();
     }
 
-    bool empty()
+    void set_end( object_handle e, command_type t )
     {
-      return pack.empty();
     }
 
-    packed_command( selection_object* oo = 0, command_type ct = PACKED ) : command( oo, ct )
+    void save( byte_writer& out ) const
     {
+      save_base( out, GROUP_CLASS );
+      out.put( group_value );
+      out.put_vector( children );
+      out.put_vector( grouped );
+      out.put_vector( ungrouped );
     }
 
-    ~packed_command()
+    void load( byte_reader& in )
     {
-    for( auto & c : pack )
-      {
-        delete c;
-      }
+      group_value = in.get<selection_object>();
+      in.get_vector( children );
+      in.get_vector( grouped );
+      in.get_vector( ungrouped );
+    }
+
+    size_t get_size() const
+    {
+      return sizeof( *this ) + get_vector_size( children ) + get_vector_size( grouped ) + get_vector_size( ungrouped );
+    }
+
+    group_command( object_handle oo = object_handle(), command_type ct = GROUP ) : command( oo, ct )
+    {
+      group_value.is_group = true;
     }
 };
 
-class add_command : public command
+
+//moves, rotates or scales any number of objects as one command, eg. dragging the selection
+//the start and end states are stored as one array each, so undo and redo are a walk over them
+//set_end takes the end states from the objects when the drag is over
+template< class state, state selection_object::*member, command::command_type transform_type >
+class transform_command : public command
 {
   public:
+    vector<object_handle> handles;
+    vector<state> startstate, endstate;
+
     void execute()
     {
-      objects.push_back( o );
+      for( unsigned c = 0; c < handles.size(); ++c )
+      {
+        objects.get( handles[c] )->*member = endstate[c];
+        refit( handles[c] );
+      }
     }
 
     void unexecute()
     {
-      for( auto c = objects.begin(); c != objects.end(); ++c )
-        if( *c == o )
-        {
-          objects.erase( c );
-          break;
-        }
+      for( unsigned c = 0; c < handles.size(); ++c )
+      {
+        objects.get( handles[c] )->*member = startstate[c];
+        refit( handles[c] );
+      }
+    }
+
+    void set_end( object_handle e, command_type t )
+    {
+      for( unsigned c = 0; c < handles.size(); ++c )
+        endstate[c] = objects.get( handles[c] )->*member;
+    }
+
+    void save( byte_writer& out ) const
+    {
+      save_base( out, TRANSFORM_CLASS );
+      out.put_vector( handles );
+      out.put_vector( startstate );
+      out.put_vector( endstate );
     }
 
-    void set_end( selection_object* e, command_type t )
+    void load( byte_reader& in )
     {
+      in.get_vector( handles );
+      in.get_vector( startstate );
+      in.get_vector( endstate );
     }
 
-    ~add_command()
+    size_t get_size() const
     {
-      delete o;
+      return sizeof( *this ) + get_vector_size( handles ) + get_vector_size( startstate ) + get_vector_size( endstate );
     }
 
-    add_command( selection_object* oo, command_type ct = ADD ) : command( oo, ct )
+    //starts and ends where the object is now
+    void add( object_handle h )
+    {
+      handles.push_back( h );
+      startstate.push_back( objects.get( h )->*member );
+      endstate.push_back( startstate.back() );
+    }
+
+    transform_command() : command( object_handle(), transform_type )
     {
     }
 };
 
-class remove_command : public command
+typedef transform_command<vec3, &selection_object::translate_vec, command::TRANSLATE> translate_command;
+typedef transform_command<mat4, &selection_object::rotation_mat, command::ROTATE> rotate_command;
+typedef transform_command<vec3, &selection_object::scale_vec, command::SCALE> scale_command;
+
+command* load_command( byte_reader& in )
+{
+  command::command_class cc = command::command_class( in.get<char>() );
+  object_handle o = in.get<object_handle>();
+  bool chained = in.get<bool>();
+  command::command_type type = command::command_type( in.get<int>() );
+  command* res = 0;
+
+  switch( cc )
+  {
+    case command::PACKED_CLASS:
+      res = new packed_command();
+      break;
+    case command::ADD_CLASS:
+      res = new add_command( vector<selection_object>() );
+      break;
+    case command::REMOVE_CLASS:
+      res = new remove_command( vector<object_handle>() );
+      break;
+    case command::SELECT_CLASS:
+      res = new select_command( o );
+      break;
+    case command::DESELECT_CLASS:
+      res = new deselect_command( o );
+      break;
+    case command::BULK_SELECT_CLASS:
+      res = new bulk_select_command();
+      break;
+    case command::GROUP_CLASS:
+      res = new group_command( o, type );
+      break;
+    case command::TRANSFORM_CLASS:
+      if( type == command::TRANSLATE )
+        res = new translate_command();
+      else if( type == command::ROTATE )
+        res = new rotate_command();
+      else
+        res = new scale_command();
+
+      break;
+  }
+
+  assert( res );
+
+  res->o = o;
+  res->chained = chained;
+  res->type = type;
+  res->load( in );
+  return res;
+}
+
+//what a slot of objects holds in a saved version of the scene, the slot is empty if the handle is null
+class object_state
 {
   public:
-    void execute()
+    object_handle handle;
+    object_handle parent;
+    bool selected, is_group;
+    vec3 translate_vec, scale_vec;
+    mat4 rotation_mat;
+
+    bool operator==( const object_state& other ) const
+    {
+      if( handle != other.handle || parent != other.parent || selected != other.selected || is_group != other.is_group )
+        return false;
+
+      for( int c = 0; c < 3; ++c )
+        if( translate_vec[c] != other.translate_vec[c] || scale_vec[c] != other.scale_vec[c] )
+          return false;
+
+      for( int c = 0; c < 4; ++c )
+        for( int d = 0; d < 4; ++d )
+          if( rotation_mat[c][d] != other.rotation_mat[c][d] )
+            return false;
+
+      return true;
+    }
+
+    object_state() : selected( false ), is_group( false )
+    {
+    }
+};
+
+//undoes by saved versions of the scene instead of by commands
+//the state of every slot of objects is kept in a persistent array, and each step saves a new version of it
+//that shares the chunks that didn't change with the previous one. undo and redo switch to an other version,
+//and only look at the chunks that differ between the two, no matter how many objects the step touched
+//the commands are still used to make the changes, but they are thrown away after
+class snapshot_history : public undo_stack
+{
+    typedef persistent_array<object_state> scene_state;
+
+    vector<scene_state> versions;
+    int ptr;
+    scene_state current; //what the scene looked like when it was last saved
+
+    object_state get_state( unsigned slot ) const
+    {
+      object_state res;
+      res.handle = objects.get_slot_handle( slot );
+
+      if( res.handle.is_null() )
+        return res;
+
+      const selection_object* o = objects.get( res.handle );
+      res.parent = o->parent;
+      res.selected = selection.is_selected( res.handle );
+      res.is_group = o->is_group;
+      res.translate_vec = o->translate_vec;
+      res.scale_vec = o->scale_vec;
+      res.rotation_mat = o->rotation_mat;
+      return res;
+    }
+
+    //saves the slots that changed into a new version, if any of them really did
+    void save()
     {
-      for( auto c = objects.begin(); c != objects.end(); ++c )
-        if( *c == o )
+      scene_state next = current;
+      bool changed = false;
+
+      for( auto& c : changed_slots )
+      {
+        slot_changed[c] = false;
+        object_state state = get_state( c );
+
+        if( c >= next.size() )
         {
-          objects.erase( c );
-          break;
+          if( state.handle.is_null() )
+            continue;
+
+          next.resize( c + 1 );
         }
+
+        if( next[c] == state )
+          continue;
+
+        next.set( c, state );
+        changed = true;
+      }
+
+      changed_slots.clear();
+
+      if( !changed )
+        return;
+
+      current = next;
+      versions.resize( ptr + 1 );
+      versions.push_back( current );
+      ++ptr;
     }
 
-    void unexecute()
+    void apply( const object_state& from, const object_state& to )
     {
-      objects.push_back( o );
+      if( from.handle != to.handle )
+      {
+        if( !from.handle.is_null() )
+          remove_from_scene( from.handle );
+
+        if( !to.handle.is_null() )
+        {
+          selection_object value;
+          value.parent = to.parent;
+          value.is_group = to.is_group;
+          value.translate_vec = to.translate_vec;
+          value.scale_vec = to.scale_vec;
+          value.rotation_mat = to.rotation_mat;
+          add_to_scene( value, to.handle );
+        }
+      }
+      else
+      {
+        //the group may not be in the scene yet, it only has to be there when the matrices are updated
+        if( from.parent != to.parent )
+          set_parent( to.handle, to.parent );
+
+        selection_object* o = objects.get( to.handle );
+        o->translate_vec = to.translate_vec;
+        o->scale_vec = to.scale_vec;
+        o->rotation_mat = to.rotation_mat;
+        refit( to.handle );
+      }
+
+      //objects in groups aren't selected on their own
+      if( to.handle.is_null() || !to.parent.is_null() )
+        return;
+
+      if( to.selected )
+        selection.select( to.handle );
+      else
+        selection.deselect( to.handle );
+
+      recolour( to.handle );
     }
 
-    void set_end( selection_object* e, command_type t )
+    //makes the scene look like the version
+    void switch_to( const scene_state& target )
     {
+      track_changes = false;
+
+      scene_state::diff( current, target, [&]( unsigned c )
+      {
+        object_state from = c < current.size() ? current[c] : object_state();
+        object_state to = c < target.size() ? target[c] : object_state();
+
+        if( !( from == to ) )
+          apply( from, to );
+      } );
+
+      current = target;
+      track_changes = true;
     }
 
-    ~remove_command()
+  public:
+    void put( command* c )
     {
-      delete o;
+      c->execute();
+      delete c;
+      save();
     }
 
-    remove_command( selection_object* oo, command_type ct = REMOVE ) : command( oo, ct )
+    void undo()
     {
+      save();
+
+      if( ptr > 0 )
+      {
+        switch_to( versions[ptr - 1] );
+        --ptr;
+      }
     }
-};
 
-class select_command : public command
-{
-  public:
-    void execute()
+    void redo()
+    {
+      save();
+
+      if( size_t( ptr + 1 ) < versions.size() ) //ptr is at least -1
+      {
+        switch_to( versions[ptr + 1] );
+        ++ptr;
+      }
+    }
+
+    //the drag is over, the objects are where they will stay
+    void set_end( object_handle o, command::command_type ct )
     {
-      o->selected = true;
+      save();
     }
 
-    void unexecute()
+    void print_stats()
+    {
+      cout << "Snapshot history: " << versions.size() << " versions, " << scene_state::get_chunk_count() << " chunks in memory ("
+           << scene_state::get_chunk_count() * 64 * sizeof( object_state ) / 1024 << " KB)" << endl;
+    }
+
+    //starts from the scene as it is
+    snapshot_history() : ptr( -1 )
     {
-      o->selected = false;
+      track_changes = true;
+
+      for( unsigned c = 0; c < objects.size(); ++c )
+        mark_changed( objects.get_handle( c ) );
+
+      save();
+
+      if( versions.empty() )
+      {
+        versions.push_back( current );
+        ptr = 0;
+      }
+    }
+
+    ~snapshot_history()
+    {
+      track_changes = false;
     }
+};
+
+//scratch space of box and lasso selection, kept around so that big selections don't allocate
+aabb_soa select_bounds, select_projected_bounds;
+vector<unsigned char> box_select_last_plane;
+vector<unsigned> select_hits; //bit i is object i
+
+bool is_hit( const vector<unsigned>& hits, unsigned i )
+{
+  return hits[i >> 5] & ( 1u << ( i & 31 ) );
+}
+
+//the world space boxes of the objects, in the order of objects
+//exact: the boxes of the objects themselves, otherwise the fat boxes of the tree (padded, and only refit when they grow a lot),
+//those are only good for selections that test the survivors exactly afterwards
+void get_select_bounds( bool exact )
+{
+  update_transforms();
+  select_bounds.resize( objects.size() );
+
+  //groups get an empty box, they have nothing to hit
+  for( unsigned c = 0; c < objects.size(); ++c )
+  {
+    if( objects[c].is_group )
+      select_bounds.set( c, aabb() );
+    else if( exact )
+      select_bounds.set( c, transform_aabb( object_aabb, get_model_matrix( objects.get_handle( c ) ) ) );
+    else
+      select_bounds.set( c, object_tree.get_aabb( objects[c].proxy ) );
+  }
+}
+
+//a hit on an object in a group is a hit on its outermost group, only those are selected
+void hits_to_groups( vector<unsigned>& hits )
+{
+  for( unsigned c = 0; c < objects.size(); ++c )
+  {
+    if( !is_hit( hits, c ) || objects[c].parent.is_null() )
+      continue;
+
+    unsigned root = objects.get_dense( get_root( objects.get_handle( c ) ) );
+    hits[c >> 5] &= ~( 1u << ( c & 31 ) );
+    hits[root >> 5] |= 1u << ( root & 31 );
+  }
+}
+
+//selects the objects that are hit, and deselects the rest unless adding to the selection
+//returns 0 if the selection doesn't change
+command* get_select_command( const vector<unsigned>& hits, bool add_to_selection )
+{
+  bulk_select_command* bc = new bulk_select_command();
+
+  for( unsigned c = 0; c < objects.size(); ++c )
+  {
+    object_handle h = objects.get_handle( c );
+    bool hit = is_hit( hits, c );
+
+    if( hit && !selection.is_selected( h ) )
+      bc->to_select.push_back( h );
+    else if( !hit && selection.is_selected( h ) && !add_to_selection )
+      bc->to_deselect.push_back( h );
+  }
+
+  if( bc->to_select.empty() && bc->to_deselect.empty() )
+  {
+    delete bc;
+    return 0;
+  }
+
+  return bc;
+}
+
+//objects that intersect the frustum
+//the boxes of the tree go through the batch culling kernel, only the survivors get the exact obb test
+command* box_select( const frustum& f, bool add_to_selection )
+{
+  get_select_bounds( false );
+  cull_aabb_batch( batch_frustum( f ), select_bounds, box_select_last_plane, select_hits );
+
+  for( unsigned c = 0; c < objects.size(); ++c )
+    if( is_hit( select_hits, c ) && ( objects[c].is_group || !is_intersecting( f, get_world_obb( objects.get_handle( c ) ) ) ) )
+      select_hits[c >> 5] &= ~( 1u << ( c & 31 ) );
+
+  hits_to_groups( select_hits );
+  return get_select_command( select_hits, add_to_selection );
+}
+
+//objects whose projected bounds overlap the lasso, into select_hits
+//cheap enough to redo every frame while the lasso is drawn
+//there is no exact test after this, so it projects the exact boxes of the objects
+void get_lasso_hits( const mat4& vp, const lasso_mask& lasso )
+{
+  get_select_bounds( true );
+  project_aabb_batch( vp, select_bounds, select_projected_bounds );
+
+  select_hits.assign( ( objects.size() + 31 ) / 32, 0 );
+
+  for( unsigned c = 0; c < objects.size(); ++c )
+  {
+    //only the ones between the near and far planes
+    if( objects[c].is_group || select_projected_bounds.max_z[c] < -1 || select_projected_bounds.min_z[c] > 1 )
+      continue;
 
-    void set_end( selection_object* e, command_type t )
-    {
-    }
+    mm::vec2 rect_min( select_projected_bounds.min_x[c], select_projected_bounds.min_y[c] );
+    mm::vec2 rect_max( select_projected_bounds.max_x[c], select_projected_bounds.max_y[c] );
 
-    select_command( selection_object* oo, command_type ct = SELECT ) : command( oo, ct )
-    {
-    }
-};
+    if( lasso.is_overlapping( rect_min, rect_max ) )
+      select_hits[c >> 5] |= 1u << ( c & 31 );
+  }
 
-class deselect_command : public command
+  hits_to_groups( select_hits );
+}
+
+//the selected objects and everything in them, the objects in a group before the group (see remove_command)
+vector<object_handle> get_selection_with_groups()
 {
-  public:
-    void execute()
-    {
-      o->selected = false;
-    }
+  vector<object_handle> res, subtree;
 
-    void unexecute()
-    {
-      o->selected = true;
-    }
+  for( auto& h : selection )
+  {
+    subtree.clear();
 
-    void set_end( selection_object* e, command_type t )
+    for_each_in_group( h, [&]( object_handle g )
     {
-    }
+      subtree.push_back( g );
+    } );
 
-    deselect_command( selection_object* oo, command_type ct = DESELECT ) : command( oo, ct )
-    {
-    }
-};
+    res.insert( res.end(), subtree.rbegin(), subtree.rend() );
+  }
 
-//group, ungroup
+  return res;
+}
 
-class translate_command : public command
+//copies the selected objects and everything in them into the clipboard, the groups before the objects in them
+void copy_selection()
 {
-  public:
-    vec3 startstate, endstate;
+  selection_buffer.clear();
+  selection_buffer_parents.clear();
 
-    void execute()
-    {
-      o->translate_vec = endstate;
-    }
-
-    void unexecute()
-    {
-      o->translate_vec = startstate;
-    }
+  unordered_map<unsigned, int> copied; //slot -> index in the clipboard
 
-    void set_end( selection_object* e, command_type t )
+  for( auto& h : selection )
+  {
+    for_each_in_group( h, [&]( object_handle g )
     {
-      endstate = e->translate_vec;
-    }
+      const selection_object* o = objects.get( g );
 
-    translate_command( selection_object* oo, const vec3& s, const vec3& e, command_type ct = TRANSLATE ) : command( oo, ct ), startstate( s ), endstate( e )
-    {
-    }
-};
+      copied[g.index] = selection_buffer.size();
+      selection_buffer_parents.push_back( o->parent.is_null() ? -1 : copied[o->parent.index] );
+      selection_buffer.push_back( *o );
+    } );
+  }
+}
 
-class rotate_command : public command
+//groups the selection under a new group at its center, 0 if nothing is selected
+//the objects are selected, so they aren't in a group, and their transformations are in world space
+command* group_selection()
 {
-  public:
-    mat4 startstate, endstate;
+  if( selection.empty() )
+    return 0;
 
-    void execute()
-    {
-      o->rotation_mat = endstate;
-    }
+  group_command* gc = new group_command();
+  vec3 center = vec3( 0 );
 
-    void unexecute()
-    {
-      o->rotation_mat = startstate;
-    }
+  for( auto& h : selection )
+    center += objects.get( h )->translate_vec;
 
-    void set_end( selection_object* e, command_type t )
-    {
-      endstate = e->rotation_mat;
-    }
+  gc->group_value.translate_vec = center / float( selection.size() );
 
-    rotate_command( selection_object* oo, const mat4& s, const mat4& e, command_type ct = ROTATE ) : command( oo, ct ), startstate( s ), endstate( e )
-    {
-    }
-};
+  for( auto& h : selection )
+  {
+    local_transform t( *objects.get( h ) );
+
+    gc->children.push_back( h );
+    gc->ungrouped.push_back( t );
+
+    t.translate_vec -= gc->group_value.translate_vec;
+    gc->grouped.push_back( t );
+  }
+
+  return gc;
+}
 
-class scale_command : public command
+//takes the objects out of the (selected) group and removes it, they stay where they are in the world
+//the group isn't in an other group, and the editor only scales uniformly, so their world transformation is translate * rotate * scale again
+command* ungroup( object_handle g )
 {
-  public:
-    vec3 startstate, endstate;
+  const selection_object* group = objects.get( g );
+  const mat4& model = get_model_matrix( g );
+  group_command* gc = new group_command( g, command::UNGROUP );
 
-    void execute()
-    {
-      o->scale_vec = endstate;
-    }
+  object_transforms.for_each_child( g.index, [&]( unsigned slot )
+  {
+    object_handle h = objects.get_slot_handle( slot );
+    const selection_object* c = objects.get( h );
+    local_transform world( *c );
 
-    void unexecute()
-    {
-      o->scale_vec = startstate;
-    }
+    world.translate_vec = ( model * vec4( c->translate_vec, 1 ) ).xyz;
+    world.rotation_mat = group->rotation_mat * c->rotation_mat;
+    world.scale_vec = group->scale_vec * c->scale_vec;
 
-    void set_end( selection_object* e, command_type t )
-    {
-      endstate = e->scale_vec;
-    }
+    gc->children.push_back( h );
+    gc->grouped.push_back( local_transform( *c ) );
+    gc->ungrouped.push_back( world );
+  } );
+
+  return gc;
+}
+
+//recomputes the colours of the recoloured objects and of everything in them
+template< class cbk >
+void update_colours( cbk get_colour )
+{
+  for( auto& r : recoloured )
+  {
+    if( !objects.get( r ) )
+      continue;
 
-    scale_command( selection_object* oo, const vec3& s, const vec3& e, command_type ct = SCALE ) : command( oo, ct ), startstate( s ), endstate( e )
+    for_each_in_group( r, [&]( object_handle h )
     {
-    }
+      if( !objects.get( h )->is_group )
+        set_colour( h, get_colour( h ) );
+    } );
+  }
+
+  recoloured.clear();
+}
+
+//the controls of the editor, mapped to keys in main
+class editor_action
+{
+  public:
+    enum type { TRANSLATE, ROTATE, SCALE, WIREFRAME, BOX_SELECT, LASSO_SELECT, ADD_OBJECT, DELETE_OBJECT,
+                UNDO, REDO, COPY, CUT, PASTE, VERTEX_SNAP, SELECT_ALL, INVERT_SELECTION, GROUP, UNGROUP,
+                PRINT_STATS, SHOW_OVERLAPS, STOP_AT_CONTACT, LOCK_TO_X, LOCK_TO_Y, LOCK_TO_Z,
+                MOVE_FORWARD, MOVE_BACKWARD, MOVE_LEFT, MOVE_RIGHT, MOVE_UP, MOVE_DOWN
+              };
 };
 
 int main( int argc, char** argv )
@@ -396,6 +1983,9 @@ int main( int argc, char** argv )
   uvec2 screen( 0 );
   bool fullscreen = false;
   bool silent = false;
+  size_t history_budget = 0; //MB
+  bool snapshot_undo = false;
+  string history_journal = "history.journal";
   string title = "Basic selection prototype";
 
   /*
@@ -409,6 +1999,19 @@ int main( int argc, char** argv )
   ss.str( args["--screeny"] );
   ss >> screen.y;
   ss.clear();
+  ss.str( args["--history_budget"] );
+  ss >> history_budget;
+  ss.clear();
+
+  if( history_budget == 0 )
+  {
+    history_budget = 256;
+  }
+
+  if( args.count( "--history_journal" ) )
+  {
+    history_journal = args["--history_journal"];
+  }
 
   if( screen.x == 0 )
   {
@@ -435,6 +2038,9 @@ int main( int argc, char** argv )
          "       --screenx num //set screen width (default:1280)" << endl <<
          "       --screeny num //set screen height (default:720)" << endl <<
          "       --fullscreen  //set fullscreen, windowed by default" << endl <<
+         "       --history_budget num   //megabytes of undo history kept in memory (default:256)" << endl <<
+         "       --history_journal file //where older undo history goes (default:history.journal)" << endl <<
+         "       --snapshot_undo        //undo by saved versions of the scene instead of by commands" << endl <<
          "       --help        //display this information" << endl;
     return 0;
   }
@@ -447,6 +2053,13 @@ int main( int argc, char** argv )
   }
   catch( ... ) {}
 
+  try
+  {
+    args.at( "--snapshot_undo" );
+    snapshot_undo = true;
+  }
+  catch( ... ) {}
+
   /*
      * Initialize the OpenGL context
      */
@@ -487,6 +2100,23 @@ int main( int argc, char** argv )
 
   GLuint box = frm.create_box();
 
+  //every object is an instance of the box, the per instance attributes come from object_instances
+  object_instances.create();
+  glBindVertexArray( box );
+  glBindBuffer( GL_ARRAY_BUFFER, object_instances.get_buffer() );
+
+  for( int c = 0; c < 4; ++c )
+  {
+    glEnableVertexAttribArray( 3 + c );
+    glVertexAttribPointer( 3 + c, 4, GL_FLOAT, false, sizeof( object_instance ), ( void* )( c * sizeof( vec4 ) ) );
+    glVertexAttribDivisor( 3 + c, 1 );
+  }
+
+  glEnableVertexAttribArray( 7 );
+  glVertexAttribPointer( 7, 4, GL_FLOAT, false, sizeof( object_instance ), ( void* )sizeof( mat4 ) );
+  glVertexAttribDivisor( 7, 1 );
+  glBindVertexArray( 0 );
+
   vector<vec3> vertices;
   vertices.push_back( vec3( -1, -1, 1 ) );
   vertices.push_back( vec3( 1, -1, 1 ) );
@@ -541,6 +2171,22 @@ int main( int argc, char** argv )
   vertices.push_back( vec3( 1, -1, -1 ) );
   vertices.push_back( vec3( -1, -1, 1 ) );
 
+  object_bvh.build( vertices );
+
+  for( auto& v : vertices )
+  {
+    auto same = [&]( const vec3& w )
+    {
+      return v.x == w.x && v.y == w.y && v.z == w.z;
+    };
+
+    if( std::find_if( object_vertices.begin(), object_vertices.end(), same ) == object_vertices.end() )
+      object_vertices.push_back( v );
+  }
+
+  object_bounds = fit_obb( vertices );
+  object_aabb = fit_aabb( vertices );
+
   /*
      * Set up the shaders
      */
@@ -549,21 +2195,89 @@ int main( int argc, char** argv )
   frm.load_shader( sel_shader, GL_VERTEX_SHADER, "../shaders/selection/selection.vs" );
   frm.load_shader( sel_shader, GL_FRAGMENT_SHADER, "../shaders/selection/selection.ps" );
 
-  GLint sel_mvp_mat_loc = glGetUniformLocation( sel_shader, "mvp" );
-  GLint sel_col_loc = glGetUniformLocation( sel_shader, "col" );
+  GLint sel_vp_mat_loc = glGetUniformLocation( sel_shader, "vp" );
 
   /*
      * Handle events
      */
 
+  input_state& keymap = frm.get_input();
+  unsigned ctrl = input_state::CTRL, shift = input_state::SHIFT;
+
+  //checked = 0: works with any modifier down (eg. ctrl + t translates globally)
+  keymap.map_action( editor_action::TRANSLATE, sf::Keyboard::T, 0, 0 );
+  keymap.map_action( editor_action::ROTATE, sf::Keyboard::R, 0, 0 );
+  keymap.map_action( editor_action::SCALE, sf::Keyboard::Y, 0, 0 );
+  keymap.map_action( editor_action::WIREFRAME, sf::Keyboard::F, 0, 0 );
+  keymap.map_action( editor_action::BOX_SELECT, sf::Keyboard::B, 0, 0 );
+  keymap.map_action( editor_action::LASSO_SELECT, sf::Keyboard::L, 0, 0 );
+  keymap.map_action( editor_action::ADD_OBJECT, sf::Keyboard::Space, 0, 0 );
+  keymap.map_action( editor_action::DELETE_OBJECT, sf::Keyboard::Delete, 0, 0 );
+  keymap.map_action( editor_action::UNDO, sf::Keyboard::Z, ctrl, ctrl | shift );
+  keymap.map_action( editor_action::REDO, sf::Keyboard::Z, ctrl | shift, ctrl | shift );
+  keymap.map_action( editor_action::COPY, sf::Keyboard::C, ctrl, ctrl );
+  keymap.map_action( editor_action::CUT, sf::Keyboard::X, ctrl, ctrl );
+  keymap.map_action( editor_action::PASTE, sf::Keyboard::V, ctrl, ctrl );
+  keymap.map_action( editor_action::VERTEX_SNAP, sf::Keyboard::V, 0, ctrl );
+  keymap.map_action( editor_action::SELECT_ALL, sf::Keyboard::A, ctrl, ctrl );
+  keymap.map_action( editor_action::INVERT_SELECTION, sf::Keyboard::I, ctrl, ctrl );
+  keymap.map_action( editor_action::GROUP, sf::Keyboard::G, ctrl, ctrl | shift );
+  keymap.map_action( editor_action::UNGROUP, sf::Keyboard::G, ctrl | shift, ctrl | shift );
+  keymap.map_action( editor_action::PRINT_STATS, sf::Keyboard::H, 0, 0 );
+  keymap.map_action( editor_action::SHOW_OVERLAPS, sf::Keyboard::O, 0, 0 );
+  keymap.map_action( editor_action::STOP_AT_CONTACT, sf::Keyboard::P, 0, 0 );
+  keymap.map_action( editor_action::LOCK_TO_X, sf::Keyboard::Num1, 0, 0 );
+  keymap.map_action( editor_action::LOCK_TO_Y, sf::Keyboard::Num2, 0, 0 );
+  keymap.map_action( editor_action::LOCK_TO_Z, sf::Keyboard::Num3, 0, 0 );
+  keymap.map_action( editor_action::MOVE_FORWARD, sf::Keyboard::W, 0, 0 );
+  keymap.map_action( editor_action::MOVE_BACKWARD, sf::Keyboard::S, 0, 0 );
+  keymap.map_action( editor_action::MOVE_LEFT, sf::Keyboard::A, 0, 0 );
+  keymap.map_action( editor_action::MOVE_RIGHT, sf::Keyboard::D, 0, 0 );
+  keymap.map_action( editor_action::MOVE_UP, sf::Keyboard::Q, 0, 0 );
+  keymap.map_action( editor_action::MOVE_DOWN, sf::Keyboard::E, 0, 0 );
+
   vec2 mouse_pos = vec2(0);
+  object_handle hovered; //the object (or the outermost group of the object) under the cursor
+  object_handle last_hovered; //of the last frame
+
+  //what hovered was picked with, it is only picked again when one of them changed
+  bool pick_valid = false;
+  vec2 pick_mouse_pos = vec2( 0 );
+  mat4 pick_view = mat4::identity;
+  unsigned pick_scene_version = 0;
   bool translate_begin = false, rotate_begin = false, scale_begin = false;
   bool translate_end = false, rotate_end = false, scale_end = false;
   bool translate_action = false, rotate_action = false, scale_action = false;
+  bool box_select_begin = false, box_select_end = false, box_select_action = false;
+  vec2 box_select_start = vec2( 0 );
+  bool lasso_begin = false, lasso_end = false, lasso_action = false;
+  vector<vec2> lasso_points;
+  lasso_mask lasso;
   bool warped = false, clicked = false;
   bool wireframe = false;
   bool lock_to_x = false, lock_to_y = false, lock_to_z = false;
-  history his;
+  bool show_overlaps = false, stop_at_contact = false;
+  bool vertex_snap = false;
+  object_handle snap_grab; //the vertex of this object that is snapped while translating
+  int snap_grab_vertex = 0;
+  vec3 snap_offset = vec3( 0 ); //applied on top of the mouse movement
+  const float snap_radius = 0.03f; //in window heights
+  history command_history;
+  unique_ptr<snapshot_history> snapshots;
+
+  if( snapshot_undo )
+  {
+    snapshots.reset( new snapshot_history() );
+  }
+  else
+  {
+    command_history.set_budget( history_budget * 1024 * 1024 );
+
+    if( !command_history.open_journal( history_journal ) )
+      cerr << "Couldn't open the history journal " << history_journal << ", the undo history is kept in memory" << endl;
+  }
+
+  undo_stack& his = snapshots ? static_cast<undo_stack&>( *snapshots ) : static_cast<undo_stack&>( command_history );
 
   cam.move_forward( -5 );
 
@@ -573,305 +2287,342 @@ int main( int argc, char** argv )
 
   packed_command* pc = 0;
 
+  //world space ray through the mouse cursor
+  auto get_cursor_ray = [&]() -> ray
+  {
+    vec2 mouse_pos_ndc = mouse_pos * 2 - 1;
+    mat4 inv_vp = inverse( the_frame.projection_matrix * cam.get_matrix() );
+
+    vec3 ray_start = unproject( vec3( mouse_pos_ndc, 0 ), inv_vp );
+    vec3 ray_end = unproject( vec3( mouse_pos_ndc, 1 ), inv_vp );
+    return ray( ray_start, normalize( ray_end - ray_start ) );
+  };
+
   auto event_handler = [&]( const sf::Event & ev )
   {
     switch( ev.type )
     {
-      case sf::Event::KeyPressed:
+      case sf::Event::MouseMoved:
         {
-          if( ev.key.code == sf::Keyboard::T && !translate_action )
-          {
-            translate_begin = true;
-          }
-
-          if( ev.key.code == sf::Keyboard::R && !rotate_action )
-          {
-            rotate_begin = true;
-          }
-
-          if( ev.key.code == sf::Keyboard::Y && !scale_action )
-          {
-            scale_begin = true;
-          }
+          mouse_pos.x = ev.mouseMove.x / ( float )screen.x;
+          mouse_pos.y = 1 - ev.mouseMove.y / ( float )screen.y;
 
-          if( ev.key.code == sf::Keyboard::F )
+          if( ( lasso_begin || lasso_action ) && length( mouse_pos - lasso_points.back() ) > 0.005f )
           {
-            wireframe = !wireframe;
+            lasso_points.push_back( mouse_pos );
           }
 
-          if( ev.key.code == sf::Keyboard::Space )
+          //handle fps like movement
+          if( cam_rotate )
           {
-            //his.put( new add_command( new object() ) );
-            pc->put( new add_command( new selection_object() ) );
-          }
+            vec2 mpos( ev.mouseMove.x / float( screen.x ), ev.mouseMove.y / float( screen.y ) );
 
-          if( ev.key.code == sf::Keyboard::Delete )
-          {
-            for( auto c = objects.begin(); c != objects.end(); ++c )
+            if( cam_warped )
             {
-              if( ( *c )->selected )
-              {
-                //his.put( new remove_command( *c ) );
-                pc->put( new remove_command( *c ) );
-              }
+              cam_ignore = false;
             }
-          }
-
-          if( ev.key.code == sf::Keyboard::Z )
-          {
-            if( sf::Keyboard::isKeyPressed( sf::Keyboard::LControl ) || sf::Keyboard::isKeyPressed( sf::Keyboard::RControl ) )
+            else
             {
-              if( sf::Keyboard::isKeyPressed( sf::Keyboard::LShift ) || sf::Keyboard::isKeyPressed( sf::Keyboard::RShift ) )
-                his.redo();
-              else
-                his.undo();
+              frm.set_mouse_pos( ivec2( screen.x / 2.0f, screen.y / 2.0f ) );
+              cam_warped = true;
+              cam_ignore = true;
             }
-          }
 
-          if( ev.key.code == sf::Keyboard::C )
-          {
-            if( sf::Keyboard::isKeyPressed( sf::Keyboard::LControl ) || sf::Keyboard::isKeyPressed( sf::Keyboard::RControl ) )
+            if( !cam_ignore && all( notEqual( mpos, vec2( 0.5 ) ) ) )
             {
-            for( auto & c : selection_buffer )
-              {
-                delete c;
-              }
-
-              selection_buffer.clear();
-
-            for( auto & c : objects )
-              {
-                if( c->selected )
-                {
-                  selection_buffer.push_back( new selection_object( *c ) );
-                }
-              }
+              cam.rotate( mm::radians( -180.0f * ( mpos.x - 0.5f ) ), mm::vec3( 0.0f, 1.0f, 0.0f ) );
+              cam.rotate_x( mm::radians( -180.0f * ( mpos.y - 0.5f ) ) );
+              frm.set_mouse_pos( ivec2( screen.x / 2.0f, screen.y / 2.0f ) );
+              cam_warped = true;
             }
           }
 
-          if( ev.key.code == sf::Keyboard::X )
-          {
-            if( sf::Keyboard::isKeyPressed( sf::Keyboard::LControl ) || sf::Keyboard::isKeyPressed( sf::Keyboard::RControl ) )
-            {
-            for( auto & c : selection_buffer )
-              {
-                delete c;
-              }
-
-              selection_buffer.clear();
-
-              for( auto c = objects.begin(); c != objects.end(); ++c )
-              {
-                if( ( *c )->selected )
-                {
-                  //his.put( new remove_command( *c ) );
-                  pc->put( new remove_command( *c ) );
-
-                  selection_buffer.push_back( new selection_object( **c ) );
-                }
-              }
-            }
-          }
+          break;
+        }
+      default:
+        break;
+    }
+  };
 
-          if( ev.key.code == sf::Keyboard::V )
-          {
-            if( sf::Keyboard::isKeyPressed( sf::Keyboard::LControl ) || sf::Keyboard::isKeyPressed( sf::Keyboard::RControl ) )
-            {
-            for( auto & c : selection_buffer )
-              {
-              selection_object* o = new selection_object( *c );
-                //his.put( new add_command( o ) );
-                pc->put( new add_command( o ) );
-                o->selected = false;
-              }
-            }
-          }
+  /*
+     * Render
+     */
 
-          if( ev.key.code == sf::Keyboard::A )
-          {
-            if( sf::Keyboard::isKeyPressed( sf::Keyboard::LControl ) || sf::Keyboard::isKeyPressed( sf::Keyboard::RControl ) )
-            {
-            for( auto & c : objects )
-              {
-                if( !c->selected )
-                {
-                  //his.put( new select_command( c ) );
-                  pc->put( new select_command( c ) );
-                }
-              }
-            }
-          }
+  sf::Clock timer;
+  timer.restart();
 
-          if( ev.key.code == sf::Keyboard::I )
-          {
-            if( sf::Keyboard::isKeyPressed( sf::Keyboard::LControl ) || sf::Keyboard::isKeyPressed( sf::Keyboard::RControl ) )
-            {
-            for( auto & c : objects )
-              {
-                if( !c->selected )
-                {
-                  //his.put( new select_command( c ) );
-                  pc->put( new select_command( c ) );
-                }
-                else
-                {
-                  //his.put( new deselect_command( c ) );
-                  pc->put( new deselect_command( c ) );
-                }
-              }
-            }
-          }
+  frm.display( [&]
+  {
+    if( !pc )
+      pc = new packed_command();
 
-          if( ev.key.code == sf::Keyboard::Num1 )
-          {
-            lock_to_x = !lock_to_x;
-            lock_to_y = false;
-            lock_to_z = false;
-          }
+    packed_command* pcc = pc;
 
-          if( ev.key.code == sf::Keyboard::Num2 )
-          {
-            lock_to_y = !lock_to_y;
-            lock_to_x = false;
-            lock_to_z = false;
-          }
+    frm.handle_events( event_handler );
 
-          if( ev.key.code == sf::Keyboard::Num3 )
-          {
-            lock_to_z = !lock_to_z;
-            lock_to_y = false;
-            lock_to_x = false;
-          }
+    //the keys and buttons are read from the state the events of this frame left behind
+    const input_state& input = frm.get_input();
+
+    if( input.was_action_pressed( editor_action::TRANSLATE ) && !translate_action )
+    {
+      translate_begin = true;
+    }
+
+    if( input.was_action_pressed( editor_action::ROTATE ) && !rotate_action )
+    {
+      rotate_begin = true;
+    }
+
+    if( input.was_action_pressed( editor_action::SCALE ) && !scale_action )
+    {
+      scale_begin = true;
+    }
+
+    if( input.was_action_pressed( editor_action::WIREFRAME ) )
+    {
+      wireframe = !wireframe;
+    }
+
+    if( input.was_action_pressed( editor_action::BOX_SELECT ) && !box_select_action && !box_select_begin )
+    {
+      box_select_begin = true;
+      box_select_start = mouse_pos;
+    }
+
+    if( input.was_action_pressed( editor_action::LASSO_SELECT ) && !lasso_action && !lasso_begin )
+    {
+      lasso_begin = true;
+      lasso_points.clear();
+      lasso_points.push_back( mouse_pos );
+    }
+
+    if( input.was_action_pressed( editor_action::ADD_OBJECT ) )
+    {
+      vector<selection_object> added( 1 );
+      scene_hit hit;
+
+      if( scene_raycast( get_cursor_ray(), hit ) )
+        place_on_surface( added, vector<int>(), hit );
+
+      //his.put( new add_command( new object() ) );
+      pc->put( new add_command( added ) );
+    }
+
+    if( input.was_action_pressed( editor_action::DELETE_OBJECT ) )
+    {
+      //the commands only run when the frame is put into the history, so the selection doesn't change under the loop
+      if( !selection.empty() )
+      {
+        //his.put( new remove_command( *c ) );
+        pc->put( new remove_command( get_selection_with_groups() ) );
+      }
+    }
+
+    if( input.was_action_pressed( editor_action::UNDO ) )
+    {
+      his.undo();
+    }
+
+    if( input.was_action_pressed( editor_action::REDO ) )
+    {
+      his.redo();
+    }
+
+    if( input.was_action_pressed( editor_action::COPY ) )
+    {
+      copy_selection();
+    }
+
+    if( input.was_action_pressed( editor_action::CUT ) )
+    {
+      copy_selection();
+
+      if( !selection.empty() )
+      {
+        //his.put( new remove_command( *c ) );
+        pc->put( new remove_command( get_selection_with_groups() ) );
+      }
+    }
+
+    if( input.was_action_pressed( editor_action::VERTEX_SNAP ) )
+    {
+      vertex_snap = !vertex_snap;
+    }
+
+    if( input.was_action_pressed( editor_action::PASTE ) )
+    {
+      vector<selection_object> pasted( selection_buffer );
+      scene_hit hit;
+
+      if( scene_raycast( get_cursor_ray(), hit ) )
+        place_on_surface( pasted, selection_buffer_parents, hit );
+
+      if( !pasted.empty() )
+      {
+        //his.put( new add_command( pasted ) );
+        pc->put( new add_command( pasted, selection_buffer_parents ) );
+      }
+    }
+
+    if( input.was_action_pressed( editor_action::SELECT_ALL ) )
+    {
+      bulk_select_command* bc = new bulk_select_command();
+
+      selection.for_each_unselected( [&]( object_handle h )
+      {
+        bc->to_select.push_back( h );
+      } );
+
+      if( bc->to_select.empty() && bc->to_deselect.empty() )
+        delete bc;
+      else
+        pc->put( bc );
+    }
+
+    if( input.was_action_pressed( editor_action::INVERT_SELECTION ) )
+    {
+      bulk_select_command* bc = new bulk_select_command();
+
+      selection.for_each_unselected( [&]( object_handle h )
+      {
+        bc->to_select.push_back( h );
+      } );
+
+      bc->to_deselect.assign( selection.begin(), selection.end() );
+
+      if( bc->to_select.empty() && bc->to_deselect.empty() )
+        delete bc;
+      else
+        pc->put( bc );
+    }
+
+    if( input.was_action_pressed( editor_action::GROUP ) )
+    {
+      command* gc = group_selection();
+
+      if( gc )
+        pc->put( gc );
+    }
 
-          break;
-        }
-      case sf::Event::KeyReleased:
-        {
-          if( ev.key.code == sf::Keyboard::T )
-          {
-            translate_end = true;
-          }
+    if( input.was_action_pressed( editor_action::UNGROUP ) )
+    {
+      for( auto& h : selection )
+        if( objects.get( h )->is_group )
+          pc->put( ungroup( h ) );
+    }
 
-          if( ev.key.code == sf::Keyboard::R )
-          {
-            rotate_end = true;
-          }
+    if( input.was_action_pressed( editor_action::PRINT_STATS ) )
+    {
+      his.print_stats();
+    }
 
-          if( ev.key.code == sf::Keyboard::Y )
-          {
-            scale_end = true;
-          }
+    if( input.was_action_pressed( editor_action::SHOW_OVERLAPS ) )
+    {
+      show_overlaps = !show_overlaps;
 
-          break;
-        }
-      case sf::Event::MouseMoved:
-        {
-          mouse_pos.x = ev.mouseMove.x / ( float )screen.x;
-          mouse_pos.y = 1 - ev.mouseMove.y / ( float )screen.y;
+      for( unsigned c = 0; c < objects.size(); ++c )
+        if( objects[c].parent.is_null() )
+          recolour( objects.get_handle( c ) );
+    }
 
-          //handle fps like movement
-          if( cam_rotate )
-          {
-            vec2 mpos( ev.mouseMove.x / float( screen.x ), ev.mouseMove.y / float( screen.y ) );
+    if( input.was_action_pressed( editor_action::STOP_AT_CONTACT ) )
+    {
+      stop_at_contact = !stop_at_contact;
+    }
 
-            if( cam_warped )
-            {
-              cam_ignore = false;
-            }
-            else
-            {
-              frm.set_mouse_pos( ivec2( screen.x / 2.0f, screen.y / 2.0f ) );
-              cam_warped = true;
-              cam_ignore = true;
-            }
+    if( input.was_action_pressed( editor_action::LOCK_TO_X ) )
+    {
+      lock_to_x = !lock_to_x;
+      lock_to_y = false;
+      lock_to_z = false;
+    }
 
-            if( !cam_ignore && all( notEqual( mpos, vec2( 0.5 ) ) ) )
-            {
-              cam.rotate( mm::radians( -180.0f * ( mpos.x - 0.5f ) ), mm::vec3( 0.0f, 1.0f, 0.0f ) );
-              cam.rotate_x( mm::radians( -180.0f * ( mpos.y - 0.5f ) ) );
-              frm.set_mouse_pos( ivec2( screen.x / 2.0f, screen.y / 2.0f ) );
-              cam_warped = true;
-            }
-          }
+    if( input.was_action_pressed( editor_action::LOCK_TO_Y ) )
+    {
+      lock_to_y = !lock_to_y;
+      lock_to_x = false;
+      lock_to_z = false;
+    }
 
-          break;
-        }
-      case sf::Event::MouseButtonPressed:
-        {
-          if( ev.mouseButton.button == sf::Mouse::Left )
-          {
-            clicked = true;
-          }
+    if( input.was_action_pressed( editor_action::LOCK_TO_Z ) )
+    {
+      lock_to_z = !lock_to_z;
+      lock_to_y = false;
+      lock_to_x = false;
+    }
 
-          if( ev.mouseButton.button == sf::Mouse::Right )
-          {
-            cam_rotate = true;
-            cam_ignore = true;
-            cam_warped = false;
-          }
+    if( input.was_action_released( editor_action::TRANSLATE ) )
+    {
+      translate_end = true;
+    }
 
-          break;
-        }
-      case sf::Event::MouseButtonReleased:
-        {
-          if( ev.mouseButton.button == sf::Mouse::Right )
-          {
-            cam_rotate = false;
-          }
+    if( input.was_action_released( editor_action::ROTATE ) )
+    {
+      rotate_end = true;
+    }
 
-          break;
-        }
-      default:
-        break;
+    if( input.was_action_released( editor_action::SCALE ) )
+    {
+      scale_end = true;
     }
-  };
 
-  /*
-     * Render
-     */
+    if( input.was_action_released( editor_action::BOX_SELECT ) )
+    {
+      box_select_end = true;
+    }
 
-  sf::Clock timer;
-  timer.restart();
+    if( input.was_action_released( editor_action::LASSO_SELECT ) )
+    {
+      lasso_end = true;
+    }
 
-  frm.display( [&]
-  {
-    if( !pc )
-      pc = new packed_command();
+    if( input.was_button_pressed( sf::Mouse::Left ) )
+    {
+      clicked = true;
+    }
 
-    packed_command* pcc = pc;
+    if( input.was_button_pressed( sf::Mouse::Right ) )
+    {
+      cam_rotate = true;
+      cam_ignore = true;
+      cam_warped = false;
+    }
 
-    frm.handle_events( event_handler );
+    if( input.was_button_released( sf::Mouse::Right ) )
+    {
+      cam_rotate = false;
+    }
 
     float seconds = timer.getElapsedTime().asMilliseconds() / 1000.0f;
 
     if( seconds > 0.016f ) // 16 ms
     {
-      if( sf::Keyboard::isKeyPressed( sf::Keyboard::A ) )
+      if( input.is_action_down( editor_action::MOVE_LEFT ) )
       {
         movement_speed.x -= move_amount;
       }
 
-      if( sf::Keyboard::isKeyPressed( sf::Keyboard::D ) )
+      if( input.is_action_down( editor_action::MOVE_RIGHT ) )
       {
         movement_speed.x += move_amount;
       }
 
-      if( sf::Keyboard::isKeyPressed( sf::Keyboard::W ) )
+      if( input.is_action_down( editor_action::MOVE_FORWARD ) )
       {
         movement_speed.z += move_amount;
       }
 
-      if( sf::Keyboard::isKeyPressed( sf::Keyboard::S ) )
+      if( input.is_action_down( editor_action::MOVE_BACKWARD ) )
       {
         movement_speed.z -= move_amount;
       }
 
-      if( sf::Keyboard::isKeyPressed( sf::Keyboard::Q ) )
+      if( input.is_action_down( editor_action::MOVE_UP ) )
       {
         movement_speed.y += move_amount;
       }
 
-      if( sf::Keyboard::isKeyPressed( sf::Keyboard::E ) )
+      if( input.is_action_down( editor_action::MOVE_DOWN ) )
       {
         movement_speed.y -= move_amount;
       }
@@ -893,217 +2644,339 @@ int main( int argc, char** argv )
 
     if( clicked )
     {
-      if( !( sf::Keyboard::isKeyPressed( sf::Keyboard::LShift ) || sf::Keyboard::isKeyPressed( sf::Keyboard::RShift ) ) )
+      if( !input.is_shift_down() )
       {
-      for( auto & d : objects )
+        if( !selection.empty() )
         {
-          if( d->selected )
-          {
-            //his.put( new deselect_command( d ) );
-            pc->put( new deselect_command( d ) );
-          }
+          bulk_select_command* bc = new bulk_select_command( command::DESELECT );
+          bc->to_deselect.assign( selection.begin(), selection.end() );
+
+          //his.put( bc );
+          pc->put( bc );
         }
       }
     }
 
-  for( auto& c : objects )
-    {
-    mat4 trans = create_translation( c->translate_vec ) * c->rotation_mat * create_scale( c->scale_vec );
-
-    mat4 model = trans;
     mat4 projection = the_frame.projection_matrix;
-    mat4 mv = view * model;
-    mat4 mvp = projection * mv;
+    mat4 vp = projection * view;
 
-      mat4 inv_mvp = inverse( mvp );
-      vec4 viewport = vec4( 0, 0, screen.x, screen.y );
+    //one world space ray against the bounds tree, only the objects whose bounds it hits are tested in object space
+    //it is only cast on a click, or when the cursor, the camera or the scene moved, so an idle frame doesn't pick at all
+    //the cursor is warped to the center while transforming or looking around, so only clicks are picked then
+    update_transforms();
 
-      vec3 ori, dir;
-      vec2 mouse_pos_ndc = mouse_pos * 2 - 1;
+    bool transforming = translate_action || rotate_action || scale_action || cam_rotate;
 
-      vec3 ray_start = unproject( vec3(mouse_pos_ndc, 0), inv_mvp );
-      vec3 ray_end = unproject( vec3(mouse_pos_ndc, 1), inv_mvp );
-      ori = ray_start;
-      dir = normalize(ray_end - ray_start);
+    if( transforming )
+    {
+      hovered = object_handle();
+      pick_valid = false;
+    }
 
-      vec3 col( 1, 0, 0 );
+    bool view_moved = false;
 
-      ray obj_space_ray(ori, dir);
-        
-      aabb obj_space_aabb;
-      for( auto& d : vertices )
-        obj_space_aabb.expand( d );
+    for( int c = 0; c < 4; ++c )
+      for( int d = 0; d < 4; ++d )
+        view_moved = view_moved || view[c][d] != pick_view[c][d];
 
-      aabb model_space_aabb;
-      for( auto& d : vertices )
-        model_space_aabb.expand( (model * vec4( d, 1 )).xyz );
+    if( clicked || ( !transforming && ( !pick_valid || view_moved || pick_scene_version != scene_version ||
+                                        mouse_pos.x != pick_mouse_pos.x || mouse_pos.y != pick_mouse_pos.y ) ) )
+    {
+      ray world_ray = get_cursor_ray();
+      scene_hit hit;
 
-      ddman.CreateAABoxMinMax( model_space_aabb.min, model_space_aabb.max, 0 );
+      hovered = scene_raycast( world_ray, hit ) ? get_root( hit.o ) : object_handle();
 
       if( clicked )
+        ddman.CreateLineSegment( world_ray.origin, world_ray.direction * 10000, -1 );
+
+      //a click while transforming doesn't leave a pick behind, the cursor is about to be warped
+      pick_valid = !transforming;
+      pick_mouse_pos = mouse_pos;
+      pick_view = view;
+      pick_scene_version = scene_version;
+    }
+
+    if( clicked && !hovered.is_null() )
+    {
+      //his.put( new select_command( hovered ) );
+      pc->put( new select_command( hovered ) );
+    }
+
+    if( box_select_action )
+    {
+      vec2 rect_min = min( box_select_start, mouse_pos );
+      vec2 rect_max = max( box_select_start, mouse_pos );
+
+      if( rect_max.x > rect_min.x && rect_max.y > rect_min.y )
       {
-        ddman.CreateLineSegment( obj_space_ray.origin, obj_space_ray.direction * 10000, -1 );
+        frustum box_frustum;
+        box_frustum.set_up( cam, the_frame, rect_min, rect_max );
 
-        int result = 0;
-        /**
-        for( int d = 0; d < 12; ++d )
+        if( box_select_end )
         {
-          triangle t(vertices[d* 3 + 0], vertices[d* 3 + 1], vertices[d* 3 + 2]);
-          if( r.intersects( &t ) )
-          {
-            result = 1;
-            break;
-          }
-        }
-        /**/
-        
-        /**/
-        result = obj_space_aabb.is_intersecting( &obj_space_ray );
-        /**/
+          bool add_to_selection = input.is_shift_down();
+          command* bc = box_select( box_frustum, add_to_selection );
 
-        if( result )
+          if( bc )
+            pc->put( bc );
+        }
+        else
         {
-          //his.put( new select_command( c ) );
-          pc->put( new select_command( c ) );
-          clicked = false;
+          //draw the rectangle just behind the near plane
+          vec3 corners[4];
+          int near_points[4] = { frustum::NTL, frustum::NTR, frustum::NBR, frustum::NBL };
+
+          for( int d = 0; d < 4; ++d )
+            corners[d] = mix( box_frustum.points[near_points[d]], box_frustum.points[near_points[d] + 4], 0.001f );
+
+          for( int d = 0; d < 4; ++d )
+            ddman.CreateLineSegment( corners[d], corners[( d + 1 ) % 4], 0 );
         }
       }
+    }
+
+    if( lasso_action )
+    {
+      lasso.build( lasso_points );
+      get_lasso_hits( vp, lasso );
 
-      if( c->selected )
+      if( lasso_end )
       {
-        col = vec3( 0, 1, 0 );
+        bool add_to_selection = input.is_shift_down();
+        command* lc = get_select_command( select_hits, add_to_selection );
 
-        if( translate_begin && !translate_action )
-        {
-          //his.put( new translate_command( c, c->translate_vec, c->translate_vec ) );
-          pc->put( new translate_command( c, c->translate_vec, c->translate_vec ) );
-        }
+        if( lc )
+          pc->put( lc );
+
+        for( unsigned d = 0; d < objects.size(); ++d )
+          if( objects[d].highlighted )
+          {
+            objects[d].highlighted = false;
+            recolour( objects.get_handle( d ) );
+          }
+      }
+      else
+      {
+        for( unsigned d = 0; d < objects.size(); ++d )
+          if( objects[d].highlighted != is_hit( select_hits, d ) )
+          {
+            objects[d].highlighted = !objects[d].highlighted;
+            recolour( objects.get_handle( d ) );
+          }
+
+        //draw the lasso, closed back to the first point
+        mat4 inv_vp = inverse( vp );
 
-        if( rotate_begin && !rotate_action )
+        for( unsigned d = 0; d < lasso_points.size(); ++d )
         {
-          //his.put( new rotate_command( c, c->rotation_mat, c->rotation_mat ) );
-          pc->put( new rotate_command( c, c->rotation_mat, c->rotation_mat ) );
+          vec2 a = lasso_points[d] * 2 - 1, b = lasso_points[( d + 1 ) % lasso_points.size()] * 2 - 1;
+          ddman.CreateLineSegment( unproject( vec3( a, 0 ), inv_vp ), unproject( vec3( b, 0 ), inv_vp ), 0 );
         }
+      }
+    }
+
+    //one command for the whole selection, its end states are filled in when the drag is over
+    if( !selection.empty() )
+    {
+      if( translate_begin && !translate_action )
+      {
+        translate_command* tc = new translate_command();
+
+        for( auto& h : selection )
+          tc->add( h );
+
+        //his.put( tc );
+        pc->put( tc );
+      }
+
+      if( rotate_begin && !rotate_action )
+      {
+        rotate_command* rc = new rotate_command();
+
+        for( auto& h : selection )
+          rc->add( h );
+
+        //his.put( rc );
+        pc->put( rc );
+      }
+
+      if( scale_begin && !scale_action )
+      {
+        scale_command* sc = new scale_command();
+
+        for( auto& h : selection )
+          sc->add( h );
+
+        //his.put( sc );
+        pc->put( sc );
+      }
+    }
+
+    if( translate_end )
+    {
+      translate_action = false;
+    }
+
+    if( rotate_end )
+    {
+      rotate_action = false;
+    }
+
+    if( scale_end )
+    {
+      scale_action = false;
+    }
+
+    //the mouse movement of the frame turned into a change that is the same for every selected object,
+    //so the selection is moved in one pass that only does what is different per object
+    if( ( translate_action || rotate_action || scale_action ) && warped )
+    {
+      vec2 delta = mouse_pos - 0.5;
+      bool global = input.is_ctrl_down();
+      vec3 right_vec = normalize( cross( cam.view_dir, cam.up_vector ) );
+      vec3 up_vec = normalize( cam.up_vector );
+      float tan_half_fov = tan( cam_fov * 0.5f );
+
+      //translation, in units of the height of the view at the object's distance
+      vec3 move( 0 );
+      vec3 move_x = global ? vec3( 1, 0, 0 ) * delta.x * 2 : right_vec * delta.x * 2;
+      vec3 move_y = global ? vec3( 0, 0, 1 ) * -delta.y * 2 * aspect : up_vec * delta.y * 2 * aspect;
+
+      if( lock_to_x )
+        move = move_x;
+      else if( global ? lock_to_z : lock_to_y )
+        move = move_y;
+      else
+        move = move_x + move_y;
+
+      mat4 rotate_x = create_rotation( radians( -delta.y * 40 ), global ? vec3( 1, 0, 0 ) : right_vec );
+      mat4 rotate_y = create_rotation( radians( delta.x * 40 ), global ? vec3( 0, 1, 0 ) : up_vec );
+      mat4 rotation = lock_to_x ? rotate_x : ( lock_to_y ? rotate_y : rotate_y * rotate_x );
+
+      vec3 scale_step = length( delta ) * vec3( delta.y > 0 ? 1 : -1 );
+
+      //a group moves everything in it, but only the group's transformation changes
+      for( auto& h : selection )
+      {
+        selection_object* c = objects.get( h );
+        bool check_contacts = stop_at_contact && translate_action;
+        vec3 old_translate_vec = c->translate_vec;
+        int old_contacts = check_contacts ? get_contact_count( h, true ) : 0;
 
-        if( scale_begin && !scale_action )
+        if( translate_action )
         {
-          //his.put( new scale_command( c, c->scale_vec, c->scale_vec ) );
-          pc->put( new scale_command( c, c->scale_vec, c->scale_vec ) );
+          c->translate_vec -= snap_offset;
+          c->translate_vec += move * ( length( c->translate_vec - cam.pos ) * tan_half_fov );
         }
-
-        if( translate_end )
+        else if( rotate_action )
         {
-          translate_action = false;
+          c->rotation_mat = rotation * c->rotation_mat;
         }
-
-        if( rotate_end )
+        else
         {
-          rotate_action = false;
+          c->scale_vec = max( c->scale_vec + scale_step, vec3( 0.01 ) );
         }
 
-        if( scale_end )
+        refit( h );
+
+        //don't let the move push the object into others (it may still move out of the ones it is already in)
+        if( check_contacts && get_contact_count( h, true ) > old_contacts )
         {
-          scale_action = false;
+          c->translate_vec = old_translate_vec;
+          refit( h );
         }
+      }
+    }
 
-        if( translate_action && warped )
-        {
-          vec2 delta = mouse_pos - 0.5;
-          float top = length( c->translate_vec - cam.pos ) * tan( cam_fov * 0.5f );
-          float right = top * aspect;
+    //moves the selection so that the grabbed vertex lands on the closest vertex of another object
+    if( translate_action && warped )
+    {
+      snap_offset = vec3( 0 );
 
-          if( sf::Keyboard::isKeyPressed( sf::Keyboard::LControl ) || sf::Keyboard::isKeyPressed( sf::Keyboard::RControl ) )
-          {
-            if( lock_to_x )
-            {
-              c->translate_vec += delta.x * vec3( 1, 0, 0 ) * 2 * top;
-            }
-            else if( lock_to_z )
-            {
-              c->translate_vec += -delta.y * vec3( 0, 0, 1 ) * 2 * right;
-            }
-            else
-            {
-              c->translate_vec += delta.x * vec3( 1, 0, 0 ) * 2 * top;
-              c->translate_vec += -delta.y * vec3( 0, 0, 1 ) * 2 * right;
-            }
-          }
-          else
-          {
-            vec3 right_vec = normalize( cross( cam.view_dir, cam.up_vector ) );
-            vec3 up_vec = normalize( cam.up_vector );
+      if( vertex_snap && objects.get( snap_grab ) )
+      {
+        vec3 grab_pos = ( get_model_matrix( snap_grab ) * vec4( object_vertices[snap_grab_vertex], 1 ) ).xyz;
 
-            if( lock_to_x )
-            {
-              c->translate_vec += delta.x * right_vec * 2 * top;
-            }
-            else if( lock_to_y )
-            {
-              c->translate_vec += delta.y * up_vec * 2 * right;
-            }
-            else
-            {
-              c->translate_vec += delta.x * right_vec * 2 * top;
-              c->translate_vec += delta.y * up_vec * 2 * right;
-            }
-          }
-        }
-        else if( rotate_action && warped )
+        //the snap radius on the screen is this big around the grabbed vertex
+        float depth = std::max( dot( grab_pos - cam.pos, normalize( cam.view_dir ) ), 0.0f );
+        float max_dist = snap_radius * 2 * depth * tan( cam_fov * 0.5f );
+        vec3 target;
+
+        if( find_snap_vertex( grab_pos, max_dist, target ) )
         {
-          vec2 delta = mouse_pos - 0.5;
+          snap_offset = target - grab_pos;
 
-          if( sf::Keyboard::isKeyPressed( sf::Keyboard::LControl ) || sf::Keyboard::isKeyPressed( sf::Keyboard::RControl ) )
+          for( auto& h : selection )
           {
-            if( lock_to_x )
-            {
-              c->rotation_mat = create_rotation( radians( -delta.y * 40 ), vec3( 1, 0, 0 ) ) * c->rotation_mat;
-            }
-            else if( lock_to_y )
-            {
-              c->rotation_mat = create_rotation( radians( delta.x * 40 ), vec3( 0, 1, 0 ) ) * c->rotation_mat;
-            }
-            else
-            {
-              c->rotation_mat = create_rotation( radians( -delta.y * 40 ), vec3( 1, 0, 0 ) ) * c->rotation_mat;
-              c->rotation_mat = create_rotation( radians( delta.x * 40 ), vec3( 0, 1, 0 ) ) * c->rotation_mat;
-            }
-          }
-          else
-          {
-            vec3 right_vec = normalize( cross( cam.view_dir, cam.up_vector ) );
-            vec3 up_vec = normalize( cam.up_vector );
-
-            if( lock_to_x )
-            {
-              c->rotation_mat = create_rotation( radians( -delta.y * 40 ), right_vec ) * c->rotation_mat;
-            }
-            else if( lock_to_y )
-            {
-              c->rotation_mat = create_rotation( radians( delta.x * 40 ), up_vec ) * c->rotation_mat;
-            }
-            else
-            {
-              c->rotation_mat = create_rotation( radians( -delta.y * 40 ), right_vec ) * c->rotation_mat;
-              c->rotation_mat = create_rotation( radians( delta.x * 40 ), up_vec ) * c->rotation_mat;
-            }
+            objects.get( h )->translate_vec += snap_offset;
+            refit( h );
           }
         }
-        else if( scale_action && warped )
-        {
-          vec2 delta = mouse_pos - 0.5;
-          vec3 dir = vec3( delta.y > 0 ? 1 : -1 );
-          c->scale_vec += length( delta ) * dir;
-          c->scale_vec = max( c->scale_vec, vec3( 0.01 ) );
-        }
       }
+    }
 
-      glUniformMatrix4fv( sel_mvp_mat_loc, 1, false, &mvp[0].x );
-      glUniform3fv( sel_col_loc, 1, &col.x );
+    //the bounds of what the camera sees are drawn as lines, the objects themselves are all drawn at once
+    frustum view_frustum;
+    view_frustum.set_up( vp );
 
-      glBindVertexArray( box );
-      glDrawElements( GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0 );
+    //the objects that moved this frame, the rest is drawn with the matrices they already had
+    update_transforms();
+
+    if( hovered != last_hovered )
+    {
+      recolour( last_hovered );
+      recolour( hovered );
+      last_hovered = hovered;
     }
 
+    //the objects in a group look like the group
+    auto get_colour = [&]( object_handle h ) -> vec3
+    {
+      object_handle root = get_root( h );
+
+      if( selection.is_selected( root ) )
+        return vec3( 0, 1, 0 );
+
+      if( root == hovered || objects.get( root )->highlighted )
+        return vec3( 1, 1, 0 );
+
+      if( show_overlaps && get_contact_count( h, false ) > 0 )
+        return vec3( 1, 0, 1 );
+
+      return vec3( 1, 0, 0 );
+    };
+
+    update_colours( get_colour );
+
+    object_tree.query( view_frustum, [&]( object_handle h )
+    {
+      obb bounds = get_world_obb( h );
+
+      if( !is_intersecting( view_frustum, bounds ) )
+        return;
+
+      //overlaps come and go with any movement, so they are looked at every frame, for what is in view
+      if( show_overlaps )
+        set_colour( h, get_colour( h ) );
+
+      vec3 corners[8];
+      bounds.get_points( corners );
+
+      //the 12 edges connect the corners that differ in one bit
+      for( int d = 0; d < 8; ++d )
+        for( int bit = 1; bit < 8; bit <<= 1 )
+          if( !( d & bit ) )
+            ddman.CreateLineSegment( corners[d], corners[d | bit], 0 );
+    } );
+
+    //every object in one draw, the slots without one have an all zero matrix and collapse to nothing
+    object_instances.upload();
+
+    glUniformMatrix4fv( sel_vp_mat_loc, 1, false, &vp[0].x );
+    glBindVertexArray( box );
+    glDrawElementsInstanced( GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0, object_instances.size() );
+
     if( translate_action || rotate_action || scale_action )
     {
       frm.set_mouse_pos( ivec2( screen.x / 2, screen.y / 2 ) );
@@ -1124,6 +2997,40 @@ int main( int argc, char** argv )
     {
       translate_action = true;
       translate_begin = false;
+
+      //grab the vertex of the selection closest to the cursor on the screen
+      float best_dist = FLT_MAX;
+      snap_grab = object_handle();
+      snap_offset = vec3( 0 );
+
+      for( auto& s : selection )
+      {
+        for_each_in_group( s, [&]( object_handle h )
+        {
+          if( objects.get( h )->is_group )
+            return;
+
+          mat4 mvp = vp * get_model_matrix( h );
+
+          for( unsigned d = 0; d < object_vertices.size(); ++d )
+          {
+            vec4 clip = mvp * vec4( object_vertices[d], 1 );
+
+            if( clip.w <= 0 )
+              continue;
+
+            vec2 screen_pos = clip.xy / clip.w * 0.5f + 0.5f;
+            float dist = length( ( screen_pos - mouse_pos ) * vec2( aspect, 1 ) );
+
+            if( dist < best_dist )
+            {
+              best_dist = dist;
+              snap_grab = h;
+              snap_grab_vertex = d;
+            }
+          }
+        } );
+      }
     }
 
     if( rotate_begin )
@@ -1138,25 +3045,44 @@ int main( int argc, char** argv )
       scale_begin = false;
     }
 
+    if( box_select_begin )
+    {
+      box_select_action = true;
+      box_select_begin = false;
+    }
+
+    if( box_select_end )
+    {
+      box_select_action = false;
+      box_select_end = false;
+    }
+
+    if( lasso_begin )
+    {
+      lasso_action = true;
+      lasso_begin = false;
+    }
+
+    if( lasso_end )
+    {
+      lasso_action = false;
+      lasso_end = false;
+    }
+
+    //the transform commands work on many objects, so they aren't tied to one
     if( translate_end )
     {
-    for( auto & c : objects )
-        if( c->selected )
-          his.set_end( c, command::TRANSLATE );
+      his.set_end( object_handle(), command::TRANSLATE );
     }
 
     if( rotate_end )
     {
-    for( auto & c : objects )
-        if( c->selected )
-          his.set_end( c, command::ROTATE );
+      his.set_end( object_handle(), command::ROTATE );
     }
 
     if( scale_end )
     {
-    for( auto & c : objects )
-        if( c->selected )
-          his.set_end( c, command::SCALE );
+      his.set_end( object_handle(), command::SCALE );
     }
 
     translate_end = false;
@@ -1181,16 +3107,16 @@ int main( int argc, char** argv )
     for( int x = -size; x < size + 1; x++ )
     {
       glBegin( GL_LINE_LOOP );
-      glVertex3f( x, -2, -size );
-      glVertex3f( x, -2, size );
+      glVertex3f( x, grid_height, -size );
+      glVertex3f( x, grid_height, size );
       glEnd();
     };
 
     for( int y = -size; y < size + 1; y++ )
     {
       glBegin( GL_LINE_LOOP );
-      glVertex3f( -size, -2, y );
-      glVertex3f( size, -2, y );
+      glVertex3f( -size, grid_height, y );
+      glVertex3f( size, grid_height, y );
       glEnd();
     };
 
@@ -0,0 +1,103 @@
+#ifndef benchmark_shapes_h
+#define benchmark_shapes_h
+
+#include "intersection.h"
+#include <vector>
+#include <random>
+#include <chrono>
+
+//seeded random shapes and timing for the benchmarks
+//every shape lands around the origin, so that a fair share of the pairs intersect
+
+typedef std::mt19937 rng_type;
+
+inline float get_random( rng_type& rng, float min, float max )
+{
+  return std::uniform_real_distribution<float>( min, max )( rng );
+}
+
+inline mm::vec3 get_random_vec3( rng_type& rng, float min, float max )
+{
+  return mm::vec3( get_random( rng, min, max ), get_random( rng, min, max ), get_random( rng, min, max ) );
+}
+
+inline void randomize( rng_type& rng, ray& r )
+{
+  r = ray( get_random_vec3( rng, -10, 10 ), mm::normalize( get_random_vec3( rng, -1, 1 ) ) );
+}
+
+inline void randomize( rng_type& rng, triangle& t )
+{
+  mm::vec3 p = get_random_vec3( rng, -10, 10 );
+  t = triangle( p + get_random_vec3( rng, -2, 2 ), p + get_random_vec3( rng, -2, 2 ), p + get_random_vec3( rng, -2, 2 ) );
+}
+
+inline void randomize( rng_type& rng, sphere& s )
+{
+  s = sphere( get_random_vec3( rng, -10, 10 ), get_random( rng, 0.1f, 3 ) );
+}
+
+inline void randomize( rng_type& rng, plane& p )
+{
+  p = plane( mm::normalize( get_random_vec3( rng, -1, 1 ) ), get_random_vec3( rng, -10, 10 ) );
+}
+
+inline void randomize( rng_type& rng, aabb& a )
+{
+  a = aabb( get_random_vec3( rng, -10, 10 ), get_random_vec3( rng, 0.1f, 3 ) );
+}
+
+inline void randomize( rng_type& rng, obb& o )
+{
+  mm::mat4 m = mm::create_translation( get_random_vec3( rng, -10, 10 ) ) *
+               mm::create_rotation( get_random( rng, 0, 2 * mm::pi ), mm::normalize( get_random_vec3( rng, -1, 1 ) ) );
+
+  o = obb( aabb( mm::vec3( 0 ), get_random_vec3( rng, 0.1f, 3 ) ), m );
+}
+
+inline void randomize( rng_type& rng, cone& c )
+{
+  c = cone( get_random_vec3( rng, -10, 10 ), mm::normalize( get_random_vec3( rng, -1, 1 ) ),
+            mm::radians( get_random( rng, 5, 60 ) ), get_random( rng, 1, 15 ) );
+}
+
+inline void randomize( rng_type& rng, frustum& f )
+{
+  mm::camera<float> cam;
+  cam.pos = get_random_vec3( rng, -10, 10 );
+  cam.rotate( get_random( rng, 0, 2 * mm::pi ), mm::vec3( 0, 1, 0 ) );
+
+  mm::frame<float> fr;
+  fr.set_perspective( mm::radians( get_random( rng, 30, 90 ) ), 16 / 9.0f, 1, 50 );
+
+  f.set_up( fr.projection_matrix * cam.get_matrix() );
+}
+
+template<class t>
+void fill( rng_type& rng, std::vector<t>& v, size_t num )
+{
+  v.resize( num );
+
+  for( size_t c = 0; c < num; ++c )
+    randomize( rng, v[c] );
+}
+
+template<class t>
+void fill( rng_type& rng, std::vector<t>& v, std::vector<shape*>& p, size_t num )
+{
+  v.resize( num );
+  p.resize( num );
+
+  for( size_t c = 0; c < num; ++c )
+  {
+    randomize( rng, v[c] );
+    p[c] = &v[c];
+  }
+}
+
+inline double get_ns_per_query( const std::chrono::high_resolution_clock::time_point& start, size_t num )
+{
+  return std::chrono::duration<double, std::nano>( std::chrono::high_resolution_clock::now() - start ).count() / num;
+}
+
+#endif
@@ -0,0 +1,91 @@
+#include "intersection.h"
+#include "benchmark_shapes.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+// Compares the runtime dispatcher ( a->is_intersecting( b ) )
+// with the static dispatch ( is_intersecting( a, b ) ) on every registered shape pair.
+//
+// Usage: dispatch_benchmark [queries per pair]
+
+using namespace std;
+
+template<class a, class b, class ret, class rt, class st>
+void run_pair( const string& query, const string& name, size_t num, const rt& runtime_query, const st& static_query )
+{
+  rng_type rng( 1337 );
+
+  vector<a> lhs;
+  vector<b> rhs;
+  vector<shape*> lhs_ptr, rhs_ptr;
+
+  fill( rng, lhs, lhs_ptr, 4096 );
+  fill( rng, rhs, rhs_ptr, 4096 );
+
+  size_t mask = lhs.size() - 1;
+  float checksum_runtime = 0, checksum_static = 0;
+
+  auto start = chrono::high_resolution_clock::now();
+
+  for( size_t c = 0; c < num; ++c )
+  {
+    ret r = runtime_query( lhs_ptr[c & mask], rhs_ptr[( c * 7 ) & mask] );
+    checksum_runtime += mm::vec2( r ).x;
+  }
+
+  double runtime_ns = get_ns_per_query( start, num );
+
+  start = chrono::high_resolution_clock::now();
+
+  for( size_t c = 0; c < num; ++c )
+  {
+    ret r = static_query( lhs[c & mask], rhs[( c * 7 ) & mask] );
+    checksum_static += mm::vec2( r ).x;
+  }
+
+  double static_ns = get_ns_per_query( start, num );
+
+  cout << left << setw( 18 ) << query << setw( 20 ) << name
+       << right << fixed << setprecision( 2 )
+       << setw( 12 ) << runtime_ns << setw( 12 ) << static_ns
+       << setw( 10 ) << runtime_ns / static_ns << "x"
+       << ( checksum_runtime == checksum_static ? "" : "  MISMATCH" ) << endl;
+}
+
+int main( int argc, char** argv )
+{
+  shape::set_up_intersection();
+
+  size_t num = 1 << 22;
+
+  if( argc > 1 )
+    num = stoul( argv[1] );
+
+  cout << left << setw( 18 ) << "query" << setw( 20 ) << "pair"
+       << right << setw( 12 ) << "runtime ns" << setw( 12 ) << "static ns" << setw( 11 ) << "speedup" << endl;
+
+  //counted, so a run that stopped early is easy to tell from a complete one
+  unsigned pairs = 0;
+
+#define BENCH_PAIR( query, ret, a, b ) \
+  run_pair<a, b, ret>( #query, #a "-" #b, num, \
+    []( shape* x, shape* y ) { return x->query( y ); }, \
+    []( const a& x, const b& y ) { return query( x, y ); } ); \
+  ++pairs;
+
+#define BENCH_IS_ON_RIGHT_SIDE( a, b, s ) BENCH_PAIR( is_on_right_side, bool, a, b )
+#define BENCH_IS_INTERSECTING( a, b, s ) BENCH_PAIR( is_intersecting, bool, a, b )
+#define BENCH_IS_INSIDE( a, b, s ) BENCH_PAIR( is_inside, bool, a, b )
+#define BENCH_INTERSECT( a, b, s ) BENCH_PAIR( intersect, mm::vec2, a, b )
+
+  SHAPE_IS_ON_RIGHT_SIDE_PAIRS( BENCH_IS_ON_RIGHT_SIDE )
+  SHAPE_IS_INTERSECTING_PAIRS( BENCH_IS_INTERSECTING )
+  SHAPE_IS_INSIDE_PAIRS( BENCH_IS_INSIDE )
+  SHAPE_INTERSECT_PAIRS( BENCH_INTERSECT )
+
+  cout << pairs << " pairs" << endl;
+
+  return 0;
+}
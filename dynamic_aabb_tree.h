@@ -0,0 +1,550 @@
+#ifndef dynamic_aabb_tree_h
+#define dynamic_aabb_tree_h
+
+#include "intersection.h"
+#include <vector>
+#include <algorithm>
+
+//incrementally updated bounding volume hierarchy for moving objects
+//leaves store enlarged (fat) boxes, so small movements don't touch the tree at all
+//inserting chooses the sibling by the surface area heuristic, and the tree is kept balanced by rotations
+//usage: proxy = insert( box, data ), update( proxy, box ) whenever the object moves, remove( proxy )
+template< class t >
+class dynamic_aabb_tree
+{
+public:
+  static const int null_node = -1;
+
+private:
+  class MM_16_BYTE_ALIGNED node
+  {
+  public:
+    aabb box;
+    t data;
+    int parent; //next free node when the node is on the free list
+    int left, right;
+    int height; //0 for leaves, -1 for free nodes
+
+    bool is_leaf() const
+    {
+      return left == null_node;
+    }
+  };
+
+  std::vector<node> nodes;
+  int root;
+  int free_list;
+  int leaf_count;
+
+  static const int max_stack_size = 256;
+
+  static float get_area( const aabb& a )
+  {
+    mm::vec3 e = a.max - a.min;
+    return e.x * e.y + e.y * e.z + e.z * e.x;
+  }
+
+  static aabb get_union( const aabb& a, const aabb& b )
+  {
+    aabb res;
+    res.min = mm::min( a.min, b.min );
+    res.max = mm::max( a.max, b.max );
+    return res;
+  }
+
+  static bool contains( const aabb& a, const aabb& b )
+  {
+    return a.min.x <= b.min.x && a.min.y <= b.min.y && a.min.z <= b.min.z &&
+           a.max.x >= b.max.x && a.max.y >= b.max.y && a.max.z >= b.max.z;
+  }
+
+  static bool overlaps( const aabb& a, const aabb& b )
+  {
+    return a.min.x <= b.max.x && a.min.y <= b.max.y && a.min.z <= b.max.z &&
+           a.max.x >= b.min.x && a.max.y >= b.min.y && a.max.z >= b.min.z;
+  }
+
+  static bool intersect_box( const aabb& a, const mm::vec3& origin, const mm::vec3& inv_dir, float max_dist, float& entry )
+  {
+    mm::vec3 t1 = ( a.min - origin ) * inv_dir;
+    mm::vec3 t2 = ( a.max - origin ) * inv_dir;
+    mm::vec3 tmin = mm::min( t1, t2 );
+    mm::vec3 tmax = mm::max( t1, t2 );
+
+    entry = std::max( std::max( tmin.x, tmin.y ), std::max( tmin.z, 0.0f ) );
+    float exit = std::min( std::min( tmax.x, tmax.y ), std::min( tmax.z, max_dist ) );
+
+    return entry <= exit;
+  }
+
+  int allocate_node()
+  {
+    if( free_list == null_node )
+    {
+      node n;
+      n.parent = null_node;
+      n.height = -1;
+      nodes.push_back( n );
+      free_list = nodes.size() - 1;
+    }
+
+    int idx = free_list;
+    free_list = nodes[idx].parent;
+
+    nodes[idx].parent = null_node;
+    nodes[idx].left = null_node;
+    nodes[idx].right = null_node;
+    nodes[idx].height = 0;
+    nodes[idx].data = t();
+
+    return idx;
+  }
+
+  void free_node( int idx )
+  {
+    nodes[idx].parent = free_list;
+    nodes[idx].height = -1;
+    nodes[idx].data = t();
+    free_list = idx;
+  }
+
+  void insert_leaf( int leaf )
+  {
+    if( root == null_node )
+    {
+      root = leaf;
+      nodes[root].parent = null_node;
+      return;
+    }
+
+    //walk down to the best sibling: at each level compare the cost of pairing with this node
+    //against the cheapest possible cost of descending into either child
+    aabb leaf_box = nodes[leaf].box;
+    int idx = root;
+
+    while( !nodes[idx].is_leaf() )
+    {
+      int left = nodes[idx].left;
+      int right = nodes[idx].right;
+
+      float area = get_area( nodes[idx].box );
+      float combined_area = get_area( get_union( nodes[idx].box, leaf_box ) );
+
+      //cost of creating a new parent for this node and the new leaf
+      float cost = 2 * combined_area;
+
+      //minimum cost of pushing the leaf further down the tree
+      float inheritance_cost = 2 * ( combined_area - area );
+
+      auto get_descend_cost = [&]( int child )
+      {
+        float new_area = get_area( get_union( nodes[child].box, leaf_box ) );
+
+        if( nodes[child].is_leaf() )
+          return new_area + inheritance_cost;
+        else
+          return new_area - get_area( nodes[child].box ) + inheritance_cost;
+      };
+
+      float left_cost = get_descend_cost( left );
+      float right_cost = get_descend_cost( right );
+
+      if( cost < left_cost && cost < right_cost )
+        break;
+
+      idx = left_cost < right_cost ? left : right;
+    }
+
+    int sibling = idx;
+
+    //create a new parent
+    int old_parent = nodes[sibling].parent;
+    int new_parent = allocate_node();
+    nodes[new_parent].parent = old_parent;
+    nodes[new_parent].box = get_union( leaf_box, nodes[sibling].box );
+    nodes[new_parent].height = nodes[sibling].height + 1;
+    nodes[new_parent].left = sibling;
+    nodes[new_parent].right = leaf;
+    nodes[sibling].parent = new_parent;
+    nodes[leaf].parent = new_parent;
+
+    if( old_parent != null_node )
+    {
+      if( nodes[old_parent].left == sibling )
+        nodes[old_parent].left = new_parent;
+      else
+        nodes[old_parent].right = new_parent;
+    }
+    else
+    {
+      root = new_parent;
+    }
+
+    refit_ancestors( nodes[leaf].parent );
+  }
+
+  void remove_leaf( int leaf )
+  {
+    if( leaf == root )
+    {
+      root = null_node;
+      return;
+    }
+
+    int parent = nodes[leaf].parent;
+    int grand_parent = nodes[parent].parent;
+    int sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+
+    //the sibling takes the place of the parent
+    if( grand_parent != null_node )
+    {
+      if( nodes[grand_parent].left == parent )
+        nodes[grand_parent].left = sibling;
+      else
+        nodes[grand_parent].right = sibling;
+
+      nodes[sibling].parent = grand_parent;
+      free_node( parent );
+
+      refit_ancestors( grand_parent );
+    }
+    else
+    {
+      root = sibling;
+      nodes[sibling].parent = null_node;
+      free_node( parent );
+    }
+  }
+
+  //fixes up boxes and heights from idx to the root, rebalancing on the way
+  void refit_ancestors( int idx )
+  {
+    while( idx != null_node )
+    {
+      idx = balance( idx );
+
+      int left = nodes[idx].left;
+      int right = nodes[idx].right;
+
+      nodes[idx].height = 1 + std::max( nodes[left].height, nodes[right].height );
+      nodes[idx].box = get_union( nodes[left].box, nodes[right].box );
+
+      idx = nodes[idx].parent;
+    }
+  }
+
+  //rotates the taller grandchild up if the subtree at a is unbalanced, returns the new subtree root
+  int balance( int a )
+  {
+    if( nodes[a].is_leaf() || nodes[a].height < 2 )
+      return a;
+
+    int b = nodes[a].left;
+    int c = nodes[a].right;
+
+    int diff = nodes[c].height - nodes[b].height;
+
+    if( diff > 1 )
+      return rotate( a, c, b, true );
+
+    if( diff < -1 )
+      return rotate( a, b, c, false );
+
+    return a;
+  }
+
+  //promotes the child "up" (of a) over a, "other" is the remaining child of a
+  //up_is_right tells which slot of a "up" was in
+  int rotate( int a, int up, int other, bool up_is_right )
+  {
+    int f = nodes[up].left;
+    int g = nodes[up].right;
+
+    //swap a and up
+    nodes[up].left = a;
+    nodes[up].parent = nodes[a].parent;
+    nodes[a].parent = up;
+
+    if( nodes[up].parent != null_node )
+    {
+      if( nodes[nodes[up].parent].left == a )
+        nodes[nodes[up].parent].left = up;
+      else
+        nodes[nodes[up].parent].right = up;
+    }
+    else
+    {
+      root = up;
+    }
+
+    //the taller grandchild stays under up, the shorter one moves under a
+    int keep = nodes[f].height > nodes[g].height ? f : g;
+    int move = keep == f ? g : f;
+
+    nodes[up].right = keep;
+
+    if( up_is_right )
+      nodes[a].right = move;
+    else
+      nodes[a].left = move;
+
+    nodes[move].parent = a;
+
+    nodes[a].box = get_union( nodes[other].box, nodes[move].box );
+    nodes[a].height = 1 + std::max( nodes[other].height, nodes[move].height );
+
+    nodes[up].box = get_union( nodes[a].box, nodes[keep].box );
+    nodes[up].height = 1 + std::max( nodes[a].height, nodes[keep].height );
+
+    return up;
+  }
+
+public:
+  float margin; //how much the stored boxes are enlarged by
+
+  dynamic_aabb_tree( float m = 0.1f ) : root( null_node ), free_list( null_node ), leaf_count( 0 ), margin( m )
+  {
+  }
+
+  bool empty() const
+  {
+    return root == null_node;
+  }
+
+  int size() const
+  {
+    return leaf_count;
+  }
+
+  int get_height() const
+  {
+    return root == null_node ? 0 : nodes[root].height;
+  }
+
+  void clear()
+  {
+    nodes.clear();
+    root = null_node;
+    free_list = null_node;
+    leaf_count = 0;
+  }
+
+  int insert( const aabb& box, const t& data )
+  {
+    int leaf = allocate_node();
+    nodes[leaf].box.min = box.min - mm::vec3( margin );
+    nodes[leaf].box.max = box.max + mm::vec3( margin );
+    nodes[leaf].data = data;
+
+    insert_leaf( leaf );
+    ++leaf_count;
+
+    return leaf;
+  }
+
+  void remove( int proxy )
+  {
+    assert( proxy >= 0 && proxy < int( nodes.size() ) && nodes[proxy].is_leaf() );
+
+    remove_leaf( proxy );
+    free_node( proxy );
+    --leaf_count;
+  }
+
+  //returns true if the tree had to be changed
+  bool update( int proxy, const aabb& box )
+  {
+    assert( proxy >= 0 && proxy < int( nodes.size() ) && nodes[proxy].is_leaf() );
+
+    aabb fat;
+    fat.min = box.min - mm::vec3( margin );
+    fat.max = box.max + mm::vec3( margin );
+
+    //still inside, and not so much smaller that the fat box would keep producing false positives
+    if( contains( nodes[proxy].box, box ) && get_area( nodes[proxy].box ) <= 4 * get_area( fat ) )
+      return false;
+
+    remove_leaf( proxy );
+    nodes[proxy].box = fat;
+    insert_leaf( proxy );
+
+    return true;
+  }
+
+  const aabb& get_aabb( int proxy ) const
+  {
+    return nodes[proxy].box;
+  }
+
+  const t& get_data( int proxy ) const
+  {
+    return nodes[proxy].data;
+  }
+
+  //calls callback( data ) for each leaf overlapping the box
+  //the callback returns false to stop the query
+  template< class cbk >
+  void query( const aabb& box, cbk callback ) const
+  {
+    if( root == null_node )
+      return;
+
+    int stack[max_stack_size];
+    int stack_size = 0;
+    stack[stack_size++] = root;
+
+    while( stack_size > 0 )
+    {
+      const node& n = nodes[stack[--stack_size]];
+
+      if( !overlaps( n.box, box ) )
+        continue;
+
+      if( n.is_leaf() )
+      {
+        if( !callback( n.data ) )
+          return;
+      }
+      else
+      {
+        assert( stack_size + 2 <= max_stack_size );
+        stack[stack_size++] = n.left;
+        stack[stack_size++] = n.right;
+      }
+    }
+  }
+
+  //calls callback( data, max_dist ) for each leaf whose box is hit by the ray within max_dist
+  //the callback returns the new max_dist: the exact hit distance to only look for closer hits,
+  //max_dist to go on unchanged, or 0 to stop the query
+  //nodes are visited front to back by their entry distance, so closest hit queries
+  //shrink max_dist early and skip everything behind the first hit
+  template< class cbk >
+  void query( const ray& r, cbk callback, float max_dist = FLT_MAX ) const
+  {
+    if( root == null_node )
+      return;
+
+    mm::vec3 inv_dir = get_safe_inv_dir( r.direction );
+
+    int stack[max_stack_size];
+    float entries[max_stack_size];
+    int stack_size = 0;
+    float entry;
+
+    if( !intersect_box( nodes[root].box, r.origin, inv_dir, max_dist, entry ) )
+      return;
+
+    stack[stack_size] = root;
+    entries[stack_size++] = entry;
+
+    while( stack_size > 0 )
+    {
+      --stack_size;
+
+      //max_dist may have shrunk since the node was pushed
+      if( entries[stack_size] > max_dist )
+        continue;
+
+      const node& n = nodes[stack[stack_size]];
+
+      if( n.is_leaf() )
+      {
+        max_dist = callback( n.data, max_dist );
+
+        if( max_dist <= 0 )
+          return;
+      }
+      else
+      {
+        int closer = n.left, farther = n.right;
+        float closer_entry, farther_entry;
+        bool closer_hit = intersect_box( nodes[closer].box, r.origin, inv_dir, max_dist, closer_entry );
+        bool farther_hit = intersect_box( nodes[farther].box, r.origin, inv_dir, max_dist, farther_entry );
+
+        //the nearer child goes on the top of the stack
+        if( farther_entry < closer_entry )
+        {
+          std::swap( closer, farther );
+          std::swap( closer_hit, farther_hit );
+          std::swap( closer_entry, farther_entry );
+        }
+
+        assert( stack_size + 2 <= max_stack_size );
+
+        if( farther_hit )
+        {
+          stack[stack_size] = farther;
+          entries[stack_size++] = farther_entry;
+        }
+
+        if( closer_hit )
+        {
+          stack[stack_size] = closer;
+          entries[stack_size++] = closer_entry;
+        }
+      }
+    }
+  }
+
+  //calls callback( data ) for each leaf that is inside or intersects the frustum
+  //subtrees that are completely inside are reported without further plane tests
+  template< class cbk >
+  void query( const frustum& f, cbk callback ) const
+  {
+    if( root == null_node )
+      return;
+
+    //each entry carries the mask of planes the subtree still straddles
+    int stack[max_stack_size];
+    unsigned masks[max_stack_size];
+    int stack_size = 0;
+    stack[stack_size] = root;
+    masks[stack_size++] = ( 1 << 6 ) - 1;
+
+    while( stack_size > 0 )
+    {
+      --stack_size;
+      int idx = stack[stack_size];
+      unsigned mask = masks[stack_size];
+      const node& n = nodes[idx];
+
+      bool outside = false;
+
+      for( int c = 0; c < 6; ++c )
+      {
+        if( !( mask & ( 1 << c ) ) )
+          continue;
+
+        mm::vec3 normal = f.planes[c].get_normal();
+
+        if( f.planes[c].distance( n.box.get_pos_vertex( normal ) ) < 0 )
+        {
+          outside = true;
+          break;
+        }
+
+        if( f.planes[c].distance( n.box.get_neg_vertex( normal ) ) >= 0 )
+          mask &= ~( 1 << c );
+      }
+
+      if( outside )
+        continue;
+
+      if( n.is_leaf() )
+      {
+        callback( n.data );
+      }
+      else
+      {
+        assert( stack_size + 2 <= max_stack_size );
+        stack[stack_size] = n.left;
+        masks[stack_size++] = mask;
+        stack[stack_size] = n.right;
+        masks[stack_size++] = mask;
+      }
+    }
+  }
+};
+
+#endif
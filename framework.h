@@ -52,13 +52,199 @@ using namespace std;
 #define STRINGIFY(s) #s
 
 #include "intersection.h"
+#include "triangle_bvh.h"
 
 namespace prototyper
 {
+  //the keyboard and the mouse as the events of the frame left them, and the keys that the actions of the application are mapped to
+  //it is kept up to date from the events, so reading it costs nothing, while asking the window system
+  //(eg. sf::Keyboard::isKeyPressed) may be a round trip to the X server every time
+  class input_state
+  {
+    public:
+      enum modifier { CTRL = 1, SHIFT = 2, ALT = 4 };
+
+    private:
+      class binding
+      {
+        public:
+          sf::Keyboard::Key key;
+          unsigned modifiers;
+          unsigned checked; //these modifiers have to be down exactly as in modifiers, the others don't matter
+      };
+
+      bool keys[sf::Keyboard::KeyCount];
+      bool pressed_keys[sf::Keyboard::KeyCount], released_keys[sf::Keyboard::KeyCount]; //in this frame
+      bool buttons[sf::Mouse::ButtonCount];
+      bool pressed_buttons[sf::Mouse::ButtonCount], released_buttons[sf::Mouse::ButtonCount];
+      ivec2 mouse_pos;
+      vector<binding> bindings; //by action
+
+      static bool get( const bool* states, int i, int count )
+      {
+        return i >= 0 && i < count && states[i];
+      }
+
+      bool is_matching( unsigned action ) const
+      {
+        if( action >= bindings.size() )
+          return false;
+
+        const binding& b = bindings[action];
+        return ( get_modifiers() & b.checked ) == ( b.modifiers & b.checked );
+      }
+
+    public:
+      unsigned get_modifiers() const
+      {
+        unsigned res = 0;
+
+        if( keys[sf::Keyboard::LControl] || keys[sf::Keyboard::RControl] )
+          res |= CTRL;
+
+        if( keys[sf::Keyboard::LShift] || keys[sf::Keyboard::RShift] )
+          res |= SHIFT;
+
+        if( keys[sf::Keyboard::LAlt] || keys[sf::Keyboard::RAlt] )
+          res |= ALT;
+
+        return res;
+      }
+
+      bool is_ctrl_down() const
+      {
+        return get_modifiers() & CTRL;
+      }
+
+      bool is_shift_down() const
+      {
+        return get_modifiers() & SHIFT;
+      }
+
+      bool is_key_down( sf::Keyboard::Key k ) const
+      {
+        return get( keys, k, sf::Keyboard::KeyCount );
+      }
+
+      bool was_key_pressed( sf::Keyboard::Key k ) const
+      {
+        return get( pressed_keys, k, sf::Keyboard::KeyCount );
+      }
+
+      bool was_key_released( sf::Keyboard::Key k ) const
+      {
+        return get( released_keys, k, sf::Keyboard::KeyCount );
+      }
+
+      bool is_button_down( sf::Mouse::Button b ) const
+      {
+        return get( buttons, b, sf::Mouse::ButtonCount );
+      }
+
+      bool was_button_pressed( sf::Mouse::Button b ) const
+      {
+        return get( pressed_buttons, b, sf::Mouse::ButtonCount );
+      }
+
+      bool was_button_released( sf::Mouse::Button b ) const
+      {
+        return get( released_buttons, b, sf::Mouse::ButtonCount );
+      }
+
+      //in pixels, from the top left corner of the window
+      ivec2 get_mouse_pos() const
+      {
+        return mouse_pos;
+      }
+
+      //actions are small numbers (eg. an enum of the application), each is mapped to a key and the modifiers it needs
+      //by default the modifiers have to be exactly the given ones, checked = 0 lets the key work with any of them
+      void map_action( unsigned action, sf::Keyboard::Key key, unsigned modifiers = 0, unsigned checked = CTRL | SHIFT | ALT )
+      {
+        if( action >= bindings.size() )
+          bindings.resize( action + 1, binding{ sf::Keyboard::Unknown, 0, 0 } );
+
+        bindings[action] = binding{ key, modifiers, checked };
+      }
+
+      bool is_action_down( unsigned action ) const
+      {
+        return is_matching( action ) && is_key_down( bindings[action].key );
+      }
+
+      bool was_action_pressed( unsigned action ) const
+      {
+        return is_matching( action ) && was_key_pressed( bindings[action].key );
+      }
+
+      bool was_action_released( unsigned action ) const
+      {
+        return is_matching( action ) && was_key_released( bindings[action].key );
+      }
+
+      //forgets what was pressed and released in the last frame
+      void begin_frame()
+      {
+        std::fill( pressed_keys, pressed_keys + sf::Keyboard::KeyCount, false );
+        std::fill( released_keys, released_keys + sf::Keyboard::KeyCount, false );
+        std::fill( pressed_buttons, pressed_buttons + sf::Mouse::ButtonCount, false );
+        std::fill( released_buttons, released_buttons + sf::Mouse::ButtonCount, false );
+      }
+
+      void handle( const sf::Event& ev )
+      {
+        switch( ev.type )
+        {
+          case sf::Event::KeyPressed:
+            if( ev.key.code >= 0 && ev.key.code < sf::Keyboard::KeyCount )
+            {
+              keys[ev.key.code] = true;
+              pressed_keys[ev.key.code] = true;
+            }
+
+            break;
+          case sf::Event::KeyReleased:
+            if( ev.key.code >= 0 && ev.key.code < sf::Keyboard::KeyCount )
+            {
+              keys[ev.key.code] = false;
+              released_keys[ev.key.code] = true;
+            }
+
+            break;
+          case sf::Event::MouseButtonPressed:
+            buttons[ev.mouseButton.button] = true;
+            pressed_buttons[ev.mouseButton.button] = true;
+            break;
+          case sf::Event::MouseButtonReleased:
+            buttons[ev.mouseButton.button] = false;
+            released_buttons[ev.mouseButton.button] = true;
+            break;
+          case sf::Event::MouseMoved:
+            mouse_pos = ivec2( ev.mouseMove.x, ev.mouseMove.y );
+            break;
+          case sf::Event::LostFocus:
+            //the keys that are let go while the window isn't focused send no events
+            std::fill( keys, keys + sf::Keyboard::KeyCount, false );
+            std::fill( buttons, buttons + sf::Mouse::ButtonCount, false );
+            break;
+          default:
+            break;
+        }
+      }
+
+      input_state() : mouse_pos( 0 )
+      {
+        std::fill( keys, keys + sf::Keyboard::KeyCount, false );
+        std::fill( buttons, buttons + sf::Mouse::ButtonCount, false );
+        begin_frame();
+      }
+  };
+
   class framework
   {
     sf::Window the_window;
     sf::Event the_event;
+    input_state input;
 
 #ifdef USE_CL
     cl_device_id device;
@@ -273,6 +459,17 @@ namespace prototyper
       sf::Mouse::setPosition( sf::Vector2i( xy.x, xy.y ), the_window );
     }
 
+    //as of the last handle_events()
+    const input_state& get_input() const
+    {
+      return input;
+    }
+
+    input_state& get_input()
+    {
+      return input;
+    }
+
     float get_random_num( float min, float max )
     {
       return min + ( max - min ) * (float)rand() / (float)RAND_MAX; //min...max
@@ -454,11 +651,32 @@ namespace prototyper
       the_window.setVerticalSyncEnabled( vsync );
     }
 
+    //updates the input state once per frame, and hands the events to f in order
+    //a run of mouse moves is handed on as its last one, only where the cursor ended up matters
     template< class t >
     void handle_events( const t& f )
     {
+      input.begin_frame();
+
+      sf::Event last_move;
+      bool moved = false;
+
       while( the_window.pollEvent( the_event ) )
       {
+        if( the_event.type == sf::Event::MouseMoved )
+        {
+          last_move = the_event;
+          moved = true;
+          continue;
+        }
+
+        if( moved )
+        {
+          input.handle( last_move );
+          f( last_move );
+          moved = false;
+        }
+
         if( the_event.type == sf::Event::Closed ||
           (
           the_event.type == sf::Event::KeyPressed &&
@@ -469,8 +687,15 @@ namespace prototyper
           run = false;
         }
 
+        input.handle( the_event );
         f( the_event );
       }
+
+      if( moved )
+      {
+        input.handle( last_move );
+        f( last_move );
+      }
     }
 
     template< class t >
@@ -1345,7 +1570,7 @@ namespace prototyper
     vec3 diffuse_color, specular_color;
     float attenuation_coeff, radius;
     attenuation_type att_type;
-    shape* bv;
+    bounding_volume bv;
   };
 
   class MM_16_BYTE_ALIGNED spot_light : public light
@@ -1353,6 +1578,18 @@ namespace prototyper
   public:
     float spot_exponent, spot_cutoff;
     mm::mat4 shadow_mat;
+
+    frustum shadow_frustum; //what the shadow map sees
+    cone bounds; //the lit volume
+
+    //call after the position, direction, cutoff or radius changed
+    void set_up_bounds()
+    {
+      the_frame.set_perspective( spot_cutoff, 1, 1, radius );
+      shadow_frustum.set_up( cam, the_frame );
+      bounds = cone( cam.pos, normalize( cam.view_dir ), spot_cutoff * 0.5f, radius );
+      bv = sphere( cam.pos, radius );
+    }
   };
 
   class MM_16_BYTE_ALIGNED point_light : public light
@@ -1420,8 +1657,10 @@ namespace prototyper
     GLuint vao;
     GLuint vbos[8];
 
-    shape* trans_bv;
-    shape* local_bv;
+    bounding_volume trans_bv; //world space, follows transformation
+    bounding_volume local_bv; //object space, the tighter of the box and the sphere around the vertices
+
+    triangle_bvh bvh; //object space, for exact ray picking
 
     animation_node* root_node;
 
@@ -1696,8 +1935,7 @@ namespace prototyper
           s.spot_lights.back().att_type = LINEAR;
           s.spot_lights.back().spot_exponent = 20;
 
-          s.spot_lights.back().bv = new sphere( s.spot_lights.back().cam.pos, s.spot_lights.back().radius );
-          s.f.set_perspective( s.spot_lights.back().spot_cutoff, 1, 1, s.spot_lights.back().radius );
+          s.spot_lights.back().set_up_bounds();
         }
 
         //TODO point lights
@@ -1860,7 +2098,7 @@ namespace prototyper
         grab_texture( aiTextureType_SPECULAR, s.materials[cc].specular_file, s.materials[cc].specular_tex, dummy, true );
 
         //write out face indices
-        s.meshes[cc].indices.resize( the_scene->mMeshes[c]->mNumFaces * 3 );
+        s.meshes[cc].indices.reserve( the_scene->mMeshes[c]->mNumFaces * 3 );
         for( unsigned int d = 0; d < the_scene->mMeshes[c]->mNumFaces; ++d )
         {
           const aiFace* faces = &the_scene->mMeshes[c]->mFaces[d];
@@ -1873,6 +2111,10 @@ namespace prototyper
         s.meshes[cc].vertices.resize( the_scene->mMeshes[c]->mNumVertices * 3 );
         memcpy( &s.meshes[cc].vertices[0], &the_scene->mMeshes[c]->mVertices[0], the_scene->mMeshes[c]->mNumVertices * sizeof(float)* 3 );
 
+        s.meshes[cc].build_bvh();
+        s.meshes[cc].set_transformation( mat4::identity );
+        s.meshes[cc].set_up_bounds();
+
         //write out normals
         if( the_scene->mMeshes[c]->mNormals )
         {
@@ -2280,6 +2522,67 @@ namespace prototyper
       //delete [] buffer;
 
       f.close();
+
+      build_bvh();
+      set_transformation( mat4::identity );
+      set_up_bounds();
+    }
+
+    void build_bvh()
+    {
+      if( !indices.empty() && !vertices.empty() )
+        bvh.build( &vertices[0], &indices[0], indices.size() / 3 );
+    }
+
+    //fits the object space bounds to the vertices, once at load time
+    void set_up_bounds()
+    {
+      if( vertices.empty() )
+      {
+        local_bv = bounding_volume();
+        trans_bv = bounding_volume();
+        return;
+      }
+
+      aabb box = fit_aabb( vertices );
+      sphere s = fit_sphere( vertices );
+
+      vec3 e = box.get_extents();
+      float r = s.get_radius();
+
+      if( 8 * e.x * e.y * e.z <= 4.0f / 3.0f * pi * r * r * r )
+        local_bv = bounding_volume( box );
+      else
+        local_bv = bounding_volume( s );
+
+      refit_bounds();
+    }
+
+    //world space bounds from the object space ones, without touching the vertices
+    void refit_bounds()
+    {
+      switch( local_bv.get_type() )
+      {
+        case bounding_volume::AABB:
+          trans_bv = bounding_volume( transform_aabb( local_bv.get_aabb(), transformation ) );
+          break;
+        case bounding_volume::SPHERE:
+          trans_bv = bounding_volume( transform_sphere( local_bv.get_sphere(), transformation ) );
+          break;
+        case bounding_volume::OBB:
+          trans_bv = bounding_volume( obb( local_bv.get_obb(), transformation ) );
+          break;
+        default:
+          trans_bv = bounding_volume();
+          break;
+      }
+    }
+
+    void set_transformation( const mat4& m )
+    {
+      transformation = m;
+      inv_transformation = inverse( m );
+      refit_bounds();
     }
 
     void upload()
@@ -2355,6 +2658,73 @@ namespace prototyper
       glDrawElements( GL_TRIANGLES, rendersize, GL_UNSIGNED_INT, 0 );
     }
   };
+
+  //spot lights that can light anything in the view frustum
+  //the cone test is cheap and rejects most, the frustum-frustum test is exact
+  inline void get_visible_spot_lights( const scene& s, const frustum& view, vector<int>& out )
+  {
+    out.clear();
+
+    for( unsigned c = 0; c < s.spot_lights.size(); ++c )
+    {
+      const spot_light& l = s.spot_lights[c];
+
+      if( is_intersecting( view, l.bounds ) && is_intersecting( view, l.shadow_frustum ) )
+        out.push_back( c );
+    }
+  }
+
+  //meshes that have to be rendered into the shadow map of the light:
+  //they have to be lit, and their shadow has to be able to reach into the view frustum
+  //the shadow is bounded by a cone from the light through the bounding sphere of the mesh
+  inline void get_shadow_casters( const spot_light& l, const frustum& view, const vector<mesh>& meshes, vector<int>& out )
+  {
+    out.clear();
+
+    for( unsigned c = 0; c < meshes.size(); ++c )
+    {
+      const bounding_volume& bv = meshes[c].trans_bv;
+
+      if( bv.empty() )
+      {
+        out.push_back( c ); //unknown bounds, always cast
+        continue;
+      }
+
+      if( !is_intersecting( l.bounds, bv ) )
+        continue;
+
+      sphere s;
+
+      switch( bv.get_type() )
+      {
+        case bounding_volume::SPHERE:
+          s = bv.get_sphere();
+          break;
+        case bounding_volume::AABB:
+          s = sphere( bv.get_aabb().get_pos(), length( bv.get_aabb().get_extents() ) );
+          break;
+        default:
+          s = sphere( bv.get_obb().center, length( bv.get_obb().extents ) );
+          break;
+      }
+
+      vec3 to_caster = s.get_center() - l.cam.pos;
+      float dist = length( to_caster );
+
+      //the light is inside the caster, everything is in its shadow
+      if( dist <= s.get_radius() )
+      {
+        out.push_back( c );
+        continue;
+      }
+
+      cone shadow( l.cam.pos, to_caster / dist, std::asin( s.get_radius() / dist ), l.radius );
+
+      if( is_intersecting( view, shadow ) )
+        out.push_back( c );
+    }
+  }
 }
 
 #endif
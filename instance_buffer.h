@@ -0,0 +1,107 @@
+#ifndef instance_buffer_h
+#define instance_buffer_h
+
+#include <GL/glew.h>
+#include <vector>
+#include <algorithm>
+
+//the per instance attributes of an instanced draw (eg. the model matrix and the colour of every object), by instance
+//a copy is kept in memory, changing an instance only marks it, and upload() sends the runs of marked instances to the buffer
+//so a frame where nothing changed uploads nothing, and one where a few objects moved uploads only those
+template< class t >
+class instance_buffer
+{
+  static const unsigned max_gap = 16; //marked runs closer than this are uploaded together
+
+  std::vector<t> data;
+  std::vector<unsigned> dirty_bits; //bit i is set if instance i changed since the last upload
+  std::vector<unsigned> dirty; //the marked instances
+  GLuint vbo;
+  size_t capacity; //instances the buffer has room for
+
+  bool is_dirty( unsigned i ) const
+  {
+    return dirty_bits[i >> 5] & ( 1u << ( i & 31 ) );
+  }
+
+public:
+  unsigned size() const
+  {
+    return data.size();
+  }
+
+  GLuint get_buffer() const
+  {
+    return vbo;
+  }
+
+  const t& get( unsigned i ) const
+  {
+    return data[i];
+  }
+
+  //the instance to change, new instances are default constructed
+  t& modify( unsigned i )
+  {
+    if( i >= data.size() )
+    {
+      data.resize( i + 1 );
+      dirty_bits.resize( ( i + 32 ) / 32, 0 );
+    }
+
+    if( !is_dirty( i ) )
+    {
+      dirty_bits[i >> 5] |= 1u << ( i & 31 );
+      dirty.push_back( i );
+    }
+
+    return data[i];
+  }
+
+  //the buffer has to be bound to the vertex array before the attributes can be pointed into it
+  void create()
+  {
+    glGenBuffers( 1, &vbo );
+  }
+
+  void upload()
+  {
+    if( dirty.empty() )
+      return;
+
+    glBindBuffer( GL_ARRAY_BUFFER, vbo );
+
+    if( data.size() > capacity )
+    {
+      //grows by doubling, so adding objects one by one doesn't reallocate every time
+      capacity = std::max( data.size(), capacity * 2 );
+      glBufferData( GL_ARRAY_BUFFER, capacity * sizeof( t ), 0, GL_DYNAMIC_DRAW );
+      glBufferSubData( GL_ARRAY_BUFFER, 0, data.size() * sizeof( t ), &data[0] );
+    }
+    else
+    {
+      std::sort( dirty.begin(), dirty.end() );
+
+      for( unsigned c = 0; c < dirty.size(); )
+      {
+        unsigned first = dirty[c], last = dirty[c];
+
+        for( ++c; c < dirty.size() && dirty[c] - last <= max_gap; ++c )
+          last = dirty[c];
+
+        glBufferSubData( GL_ARRAY_BUFFER, first * sizeof( t ), ( last - first + 1 ) * sizeof( t ), &data[first] );
+      }
+    }
+
+    for( auto& i : dirty )
+      dirty_bits[i >> 5] &= ~( 1u << ( i & 31 ) );
+
+    dirty.clear();
+  }
+
+  instance_buffer() : vbo( 0 ), capacity( 0 )
+  {
+  }
+};
+
+#endif
@@ -3,6 +3,9 @@
 
 #include "mymath/mymath.h"
 #include <vector>
+#include <mutex>
+#include <atomic>
+#include <new>
 
 #ifndef FLT_MAX
 #define FLT_MAX 3.402823466e+38
@@ -48,7 +51,7 @@ public:
     int idx_lhs = _lhs->get_class_index();
     int idx_rhs = _rhs->get_class_index();
 
-    assert( idx_lhs >= 0 || idx_rhs >= 0 || idx_lhs < elements || idx_rhs < elements );
+    assert( idx_lhs >= 0 && idx_rhs >= 0 && idx_lhs < elements && idx_rhs < elements );
     assert( callbacks[idx_lhs * elements + idx_rhs] != 0 );
 
     return callbacks[idx_lhs * elements + idx_rhs]( _lhs, _rhs );
@@ -62,6 +65,8 @@ class aabb;
 class frustum;
 class ray;
 class triangle;
+class obb;
+class cone;
 
 //generic abstract shape class
 //needed so that any shape can intersect any other shape
@@ -71,7 +76,7 @@ class shape
   static dispatcher<shape*, shape*, bool> _is_inside;
   static dispatcher<shape*, shape*, bool> _is_intersecting;
   static dispatcher<shape*, shape*, mm::vec2> _intersect;
-  static bool is_setup;
+  static std::atomic<bool> is_setup;
 public:
   static void set_up_intersection();
 
@@ -107,7 +112,7 @@ dispatcher<shape*, shape*, bool> shape::_is_on_right_side;
 dispatcher<shape*, shape*, bool> shape::_is_inside;
 dispatcher<shape*, shape*, bool> shape::_is_intersecting;
 dispatcher<shape*, shape*, mm::vec2> shape::_intersect;
-bool shape::is_setup = false;
+std::atomic<bool> shape::is_setup( false );
 
 class MM_16_BYTE_ALIGNED ray : public shape
 {
@@ -255,7 +260,7 @@ public:
   }
 
   //signed distance
-  float distance( const mm::vec3& p )
+  float distance( const mm::vec3& p ) const
   {
     return get_minus_n_dot_p() + mm::dot( normal, p );
   }
@@ -455,11 +460,12 @@ public:
 
     mm::vec3 right = -mm::normalize( mm::cross( cam.up_vector, cam.view_dir ) );
 
-    float nw = f.near_lr.x - f.near_ll.x;
-    float nh = f.near_ul.y - f.near_ll.y;
+    //half extents of the near and far rectangles
+    float nw = ( f.near_lr.x - f.near_ll.x ) * 0.5f;
+    float nh = ( f.near_ul.y - f.near_ll.y ) * 0.5f;
 
-    float fw = f.far_lr.x - f.far_ll.x;
-    float fh = f.far_ul.y - f.far_ll.y;
+    float fw = ( f.far_lr.x - f.far_ll.x ) * 0.5f;
+    float fh = ( f.far_ul.y - f.far_ll.y ) * 0.5f;
 
     //near top left
     mm::vec3 ntl = nc + cam.up_vector * nh - right * nw;
@@ -482,12 +488,84 @@ public:
     points[FBL] = fbl;
     points[FBR] = fbr;
 
-    planes[TOP].set_up( ntr, ntl, ftl );
-    planes[BOTTOM].set_up( nbl, nbr, fbr );
-    planes[LEFT].set_up( ntl, nbl, fbl );
-    planes[RIGHT].set_up( nbr, ntr, fbr );
-    planes[NEAR].set_up( ntl, ntr, nbr );
-    planes[FAR].set_up( ftr, ftl, fbl );
+    set_up_planes();
+  }
+
+  //the part of the camera's frustum that is behind the screen rectangle [min...max]
+  //the rectangle is in [0...1] window coordinates with y pointing up (like the mouse position in the editor)
+  //eg. for box selection
+  void set_up( const mm::camera<float>& cam, const mm::frame<float>& f, const mm::vec2& min, const mm::vec2& max )
+  {
+    mm::vec3 right = -mm::normalize( mm::cross( cam.up_vector, cam.view_dir ) );
+
+    //view space point of the frame's near or far rectangle to world space
+    auto get_point = [&]( const mm::vec4& ll, const mm::vec4& ur, float x, float y )
+    {
+      float vx = ll.x + ( ur.x - ll.x ) * x;
+      float vy = ll.y + ( ur.y - ll.y ) * y;
+      return cam.pos + right * vx + cam.up_vector * vy - cam.view_dir * ll.z;
+    };
+
+    points[NTL] = get_point( f.near_ll, f.near_ur, min.x, max.y );
+    points[NTR] = get_point( f.near_ll, f.near_ur, max.x, max.y );
+    points[NBL] = get_point( f.near_ll, f.near_ur, min.x, min.y );
+    points[NBR] = get_point( f.near_ll, f.near_ur, max.x, min.y );
+
+    points[FTL] = get_point( f.far_ll, f.far_ur, min.x, max.y );
+    points[FTR] = get_point( f.far_ll, f.far_ur, max.x, max.y );
+    points[FBL] = get_point( f.far_ll, f.far_ur, min.x, min.y );
+    points[FBR] = get_point( f.far_ll, f.far_ur, max.x, min.y );
+
+    set_up_planes();
+  }
+
+  //the planes through the corner points
+  void set_up_planes()
+  {
+    planes[TOP].set_up( points[NTR], points[NTL], points[FTL] );
+    planes[BOTTOM].set_up( points[NBL], points[NBR], points[FBR] );
+    planes[LEFT].set_up( points[NTL], points[NBL], points[FBL] );
+    planes[RIGHT].set_up( points[NBR], points[NTR], points[FBR] );
+    planes[NEAR].set_up( points[NTL], points[NTR], points[NBR] );
+    planes[FAR].set_up( points[FTR], points[FTL], points[FBL] );
+  }
+
+  //extract the planes straight from a (view) projection matrix (Gribb-Hartmann)
+  //the normals point inwards, just like with the camera based set up
+  void set_up( const mm::mat4& m )
+  {
+    mm::vec4 row[4];
+
+    for( int c = 0; c < 4; ++c )
+      row[c] = mm::vec4( m[0][c], m[1][c], m[2][c], m[3][c] );
+
+    mm::vec4 eq[6];
+    eq[TOP] = row[3] - row[1];
+    eq[BOTTOM] = row[3] + row[1];
+    eq[LEFT] = row[3] + row[0];
+    eq[RIGHT] = row[3] - row[0];
+    eq[NEAR] = row[3] + row[2];
+    eq[FAR] = row[3] - row[2];
+
+    for( int c = 0; c < 6; ++c )
+    {
+      float len = mm::length( eq[c].xyz );
+      mm::vec3 n = eq[c].xyz / len;
+      float d = eq[c].w / len;
+
+      planes[c] = plane( n, n * -d );
+    }
+
+    mm::mat4 inv = mm::inverse( m );
+
+    points[NTL] = mm::unproject( mm::vec3( -1, 1, -1 ), inv );
+    points[NTR] = mm::unproject( mm::vec3( 1, 1, -1 ), inv );
+    points[NBL] = mm::unproject( mm::vec3( -1, -1, -1 ), inv );
+    points[NBR] = mm::unproject( mm::vec3( 1, -1, -1 ), inv );
+    points[FTL] = mm::unproject( mm::vec3( -1, 1, 1 ), inv );
+    points[FTR] = mm::unproject( mm::vec3( 1, 1, 1 ), inv );
+    points[FBL] = mm::unproject( mm::vec3( -1, -1, 1 ), inv );
+    points[FBR] = mm::unproject( mm::vec3( 1, -1, 1 ), inv );
   }
 
   void get_vertices( std::vector<mm::vec3>& v ) const
@@ -548,573 +626,2920 @@ public:
   }
 };
 
-namespace inner
+//oriented bounding box, stays tight when the object rotates
+class MM_16_BYTE_ALIGNED obb : public shape
 {
-  //only tells if the sphere is on the right side of the plane!
-  static bool is_on_right_side_sp( shape* aa, shape* bb )
-  {
-    auto a = static_cast<sphere*>( aa );
-    auto b = static_cast<plane*>( bb );
-
-    float dist = b->distance( a->get_center() );
-    //dist + radius == how far is the sphere from the plane (usable when we want to do lod using the near plane)
+public:
+  mm::vec3 center;
+  mm::vec3 axes[3]; //orthonormal
+  mm::vec3 extents; //half size along each axis
 
-    if( dist < -a->get_radius() )
-      return false;
+  static int get_class_idx()
+  {
+    static int idx = 6;
+    return idx;
+  }
 
-    return true;
+  int get_class_index() const
+  {
+    return get_class_idx();
   }
 
-  static bool is_on_right_side_ps( shape* aa, shape* bb )
+  //half length of the projection of the box onto the (not necessarily normalized) axis a
+  float get_radius( const mm::vec3& a ) const
   {
-    return is_on_right_side_sp( bb, aa );
+    return extents.x * std::abs( mm::dot( axes[0], a ) ) +
+           extents.y * std::abs( mm::dot( axes[1], a ) ) +
+           extents.z * std::abs( mm::dot( axes[2], a ) );
   }
 
-  //only tells if the sphere is on the right side of the plane!
-  static bool is_on_right_side_ap( shape* aa, shape* bb )
+  //the point of the box closest to p
+  mm::vec3 get_closest_point( const mm::vec3& p ) const
   {
-    auto a = static_cast<aabb*>( aa );
-    auto b = static_cast<plane*>( bb );
+    mm::vec3 d = p - center;
+    mm::vec3 res = center;
 
-    if( b->distance( a->get_pos_vertex( b->get_normal() ) ) < 0 )
-      return false;
+    for( int c = 0; c < 3; ++c )
+    {
+      float dist = std::max( -extents[c], std::min( mm::dot( d, axes[c] ), extents[c] ) );
+      res += axes[c] * dist;
+    }
 
-    return true;
+    return res;
   }
 
-  static bool is_on_right_side_pa( shape* aa, shape* bb )
+  void get_points( mm::vec3* p ) const
   {
-    return is_on_right_side_ap( bb, aa );
+    for( int c = 0; c < 8; ++c )
+    {
+      p[c] = center + axes[0] * ( c & 1 ? extents.x : -extents.x )
+                    + axes[1] * ( c & 2 ? extents.y : -extents.y )
+                    + axes[2] * ( c & 4 ? extents.z : -extents.z );
+    }
   }
 
-  static bool is_intersecting_ss( shape* aa, shape* bb )
+  //the aabb that contains this box
+  aabb get_aabb() const
   {
-    auto a = static_cast<sphere*>( aa );
-    auto b = static_cast<sphere*>( bb );
-
-    mm::vec3 diff = a->get_center() - b->get_center();
-    float dist = mm::dot( diff, diff );
-
-    float rad_sum = b->get_radius() + a->get_radius();
-
-    if( dist > rad_sum * rad_sum ) //squared distance check
-      return false;
+    mm::vec3 e = mm::abs( axes[0] ) * extents.x + mm::abs( axes[1] ) * extents.y + mm::abs( axes[2] ) * extents.z;
+    return aabb( center, e );
+  }
 
-    return true;
+  obb( const mm::vec3& c = mm::vec3( 0 ), const mm::vec3& e = mm::vec3( 0 ) ) : center( c ), extents( e )
+  {
+    axes[0] = mm::vec3( 1, 0, 0 );
+    axes[1] = mm::vec3( 0, 1, 0 );
+    axes[2] = mm::vec3( 0, 0, 1 );
   }
 
-  //checks if a sphere intersects a plane
-  static bool is_intersecting_sp( shape* aa, shape* bb )
+  obb( const aabb& a ) : center( a.get_pos() ), extents( a.get_extents() )
   {
-    auto a = static_cast<sphere*>( aa );
-    auto b = static_cast<plane*>( bb );
+    axes[0] = mm::vec3( 1, 0, 0 );
+    axes[1] = mm::vec3( 0, 1, 0 );
+    axes[2] = mm::vec3( 0, 0, 1 );
+  }
 
-    float dist = b->distance( a->get_center() );
+  //an object space box transformed by a model matrix (translation * rotation * scale, no shear)
+  //with non uniform scaling the box axes have to line up with the scaling axes, or the result is skewed
+  obb( const obb& o, const mm::mat4& m )
+  {
+    center = ( m * mm::vec4( o.center, 1 ) ).xyz;
 
-    if( abs( dist ) <= a->get_radius() )
-      return true;
+    for( int c = 0; c < 3; ++c )
+    {
+      mm::vec3 axis = ( m * mm::vec4( o.axes[c], 0 ) ).xyz;
+      float len = mm::length( axis );
 
-    return false;
+      axes[c] = len > 0 ? axis / len : o.axes[c];
+      extents[c] = o.extents[c] * len;
+    }
   }
 
-  static bool is_intersecting_ps( shape* aa, shape* bb )
+  obb( const aabb& a, const mm::mat4& m )
   {
-    return is_intersecting_sp( bb, aa );
+    *this = obb( obb( a ), m );
   }
+};
 
-  static bool is_intersecting_pp( shape* aa, shape* bb )
+namespace inner
+{
+  //eigenvectors of the symmetric matrix a (destroyed) into the columns of v, by cyclic jacobi rotations
+  static void get_eigenvectors( double a[3][3], double v[3][3] )
   {
-    auto a = static_cast<plane*>( aa );
-    auto b = static_cast<plane*>( bb );
+    for( int i = 0; i < 3; ++i )
+      for( int j = 0; j < 3; ++j )
+        v[i][j] = i == j;
 
-    mm::vec3 vector = mm::cross( a->get_normal(), b->get_normal() );
-
-    //if the cross product yields a null vector
-    //then the angle is either 0 or 180
-    //that is the two normals are parallel
-    // sin(alpha) = 0
-    // ==> |a| * |b| * sin(alpha) = 0
-    if( mm::all( mm::equal( vector, mm::vec3( 0 ) ) ) )
-      return false;
+    for( int it = 0; it < 50; ++it )
+    {
+      //zero the largest off diagonal element
+      int p = 0, q = 1;
 
-    return true;
-  }
+      if( std::abs( a[0][2] ) > std::abs( a[p][q] ) )
+        p = 0, q = 2;
 
-  static bool is_intersecting_aa( shape* aa, shape* bb )
-  {
-    auto a = static_cast<aabb*>( aa );
-    auto b = static_cast<aabb*>( bb );
+      if( std::abs( a[1][2] ) > std::abs( a[p][q] ) )
+        p = 1, q = 2;
 
-    mm::vec3 t = b->get_pos() - a->get_pos();
+      double diag = std::abs( a[0][0] ) + std::abs( a[1][1] ) + std::abs( a[2][2] );
 
-    mm::vec3 aextent = a->get_extents();
-    mm::vec3 bextent = b->get_extents();
+      if( std::abs( a[p][q] ) <= 1e-12 * diag || a[p][q] == 0 )
+        break;
 
-    if( abs( t.x ) > ( aextent.x + bextent.x ) )
-      return false;
+      double theta = ( a[q][q] - a[p][p] ) / ( 2 * a[p][q] );
+      double t = ( theta >= 0 ? 1 : -1 ) / ( std::abs( theta ) + std::sqrt( theta * theta + 1 ) );
+      double c = 1 / std::sqrt( t * t + 1 );
+      double s = t * c;
 
-    if( abs( t.y ) > ( aextent.y + bextent.y ) )
-      return false;
+      //a = j^t * a * j, v = v * j
+      for( int k = 0; k < 3; ++k )
+      {
+        double akp = a[k][p], akq = a[k][q];
+        a[k][p] = c * akp - s * akq;
+        a[k][q] = s * akp + c * akq;
+      }
 
-    if( abs( t.z ) > ( aextent.z + bextent.z ) )
-      return false;
+      for( int k = 0; k < 3; ++k )
+      {
+        double apk = a[p][k], aqk = a[q][k];
+        a[p][k] = c * apk - s * aqk;
+        a[q][k] = s * apk + c * aqk;
+      }
 
-    return true;
+      for( int k = 0; k < 3; ++k )
+      {
+        double vkp = v[k][p], vkq = v[k][q];
+        v[k][p] = c * vkp - s * vkq;
+        v[k][q] = s * vkp + c * vkq;
+      }
+    }
   }
+}
 
-  static bool is_intersecting_as( shape* aa, shape* bb )
-  {
-    auto a = static_cast<aabb*>( aa );
-    auto b = static_cast<sphere*>( bb );
+//fits an obb to a point cloud by principal component analysis
+//pca is skewed by uneven vertex density, so the axis aligned box is kept when it is tighter
+inline obb fit_obb( const mm::vec3* points, unsigned num )
+{
+  if( num == 0 )
+    return obb();
 
-    //square distance check between spheres and aabbs
-    mm::vec3 vec = b->get_center() - mm::clamp( a->get_pos() + ( b->get_center() - a->get_pos() ), a->min, a->max );
+  double mean[3] = { 0, 0, 0 };
 
-    float sqlength = mm::dot( vec, vec );
+  for( unsigned c = 0; c < num; ++c )
+    for( int i = 0; i < 3; ++i )
+      mean[i] += points[c][i];
 
-    if( sqlength > b->get_radius() * b->get_radius() )
-      return false;
+  for( int i = 0; i < 3; ++i )
+    mean[i] /= num;
 
-    return true;
-  }
+  double cov[3][3] = { { 0 } };
 
-  static bool is_intersecting_sa( shape* aa, shape* bb )
+  for( unsigned c = 0; c < num; ++c )
   {
-    return is_intersecting_as( bb, aa );
+    double d[3] = { points[c].x - mean[0], points[c].y - mean[1], points[c].z - mean[2] };
+
+    for( int i = 0; i < 3; ++i )
+      for( int j = 0; j < 3; ++j )
+        cov[i][j] += d[i] * d[j];
   }
 
-  static bool is_intersecting_ap( shape* aa, shape* bb )
+  double v[3][3];
+  inner::get_eigenvectors( cov, v );
+
+  obb res;
+  res.axes[0] = mm::normalize( mm::vec3( v[0][0], v[1][0], v[2][0] ) );
+  res.axes[2] = mm::normalize( mm::cross( res.axes[0], mm::vec3( v[0][1], v[1][1], v[2][1] ) ) );
+  res.axes[1] = mm::cross( res.axes[2], res.axes[0] );
+
+  mm::vec3 min( FLT_MAX ), max( -FLT_MAX );
+  aabb box;
+
+  for( unsigned c = 0; c < num; ++c )
   {
-    auto a = static_cast<aabb*>( aa );
-    auto b = static_cast<plane*>( bb );
+    mm::vec3 proj( mm::dot( points[c], res.axes[0] ), mm::dot( points[c], res.axes[1] ), mm::dot( points[c], res.axes[2] ) );
+    min = mm::min( min, proj );
+    max = mm::max( max, proj );
+    box.expand( points[c] );
+  }
 
-    mm::vec3 p = a->get_pos_vertex( b->get_normal() );
-    mm::vec3 n = a->get_neg_vertex( b->get_normal() );
+  mm::vec3 mid = ( min + max ) * 0.5f;
+  res.center = res.axes[0] * mid.x + res.axes[1] * mid.y + res.axes[2] * mid.z;
+  res.extents = ( max - min ) * 0.5f;
 
-    float dist_p = b->distance( p );
-    float dist_n = b->distance( n );
+  mm::vec3 box_extents = box.get_extents();
 
-    if( ( dist_n > 0 && dist_p > 0 ) ||
-      ( dist_n < 0 && dist_p < 0 ) )
-      return false;
+  if( box_extents.x * box_extents.y * box_extents.z <= res.extents.x * res.extents.y * res.extents.z )
+    return obb( box );
 
-    return true;
-  }
+  return res;
+}
 
-  static bool is_intersecting_pa( shape* aa, shape* bb )
-  {
-    return is_intersecting_ap( bb, aa );
-  }
+inline obb fit_obb( const std::vector<mm::vec3>& points )
+{
+  return points.empty() ? obb() : fit_obb( &points[0], points.size() );
+}
 
-  static bool is_intersecting_fs( shape* aa, shape* bb )
-  {
-    auto a = static_cast<frustum*>( aa );
+//xyz triplets, like mesh::vertices
+inline obb fit_obb( const std::vector<float>& vertices )
+{
+  std::vector<mm::vec3> points( vertices.size() / 3 );
 
-    for( int c = 0; c < 6; ++c )
-    {
-      if( !is_on_right_side_ps( &a->planes[c], bb ) )
-        return false;
-    }
+  for( unsigned c = 0; c < points.size(); ++c )
+    points[c] = mm::vec3( vertices[c * 3 + 0], vertices[c * 3 + 1], vertices[c * 3 + 2] );
 
-    return true;
-  }
+  return fit_obb( points );
+}
 
-  static bool is_intersecting_sf( shape* aa, shape* bb )
+//tight axis aligned box of xyz triplets (like mesh::vertices)
+inline aabb fit_aabb( const float* verts, unsigned num )
+{
+  aabb res;
+  unsigned c = 0;
+
+#ifdef MYMATH_USE_SSE2
+  //4 vertices are 3 registers: xyzx yzxy zxyz, each lane keeps the min / max of its component
+  __m128 mins[3], maxs[3];
+
+  for( int d = 0; d < 3; ++d )
   {
-    return is_intersecting_fs( bb, aa );
+    mins[d] = _mm_set1_ps( FLT_MAX );
+    maxs[d] = _mm_set1_ps( -FLT_MAX );
   }
 
-  static bool is_intersecting_fa( shape* aa, shape* bb )
+  for( ; c + 4 <= num; c += 4 )
   {
-    auto a = static_cast<frustum*>( aa );
-    auto b = static_cast<aabb*>( bb );
-
-    bool res = true;
-    for( int c = 0; c < 6; ++c )
+    for( int d = 0; d < 3; ++d )
     {
-      if( !bb->is_on_right_side( &a->planes[c] ) )
-      {
-        res = false;
-        break;
-      }
+      __m128 v = _mm_loadu_ps( verts + c * 3 + d * 4 );
+      mins[d] = _mm_min_ps( mins[d], v );
+      maxs[d] = _mm_max_ps( maxs[d], v );
     }
-    return res;
   }
 
-  static bool is_intersecting_af( shape* aa, shape* bb )
+  MM_16_BYTE_ALIGNED float lanes[2][3][4];
+
+  for( int d = 0; d < 3; ++d )
   {
-    return is_intersecting_fa( bb, aa );
+    _mm_store_ps( lanes[0][d], mins[d] );
+    _mm_store_ps( lanes[1][d], maxs[d] );
   }
 
-  //is a inside b?
-  static bool is_inside_sa( shape* aa, shape* bb )
-  {
-    auto a = static_cast<sphere*>( aa );
-    auto b = static_cast<aabb*>( bb );
+  //lane l of register d holds component ( d * 4 + l ) % 3
+  for( int d = 0; d < 3; ++d )
+    for( int l = 0; l < 4; ++l )
+    {
+      int comp = ( d * 4 + l ) % 3;
+      res.min[comp] = std::min( res.min[comp], lanes[0][d][l] );
+      res.max[comp] = std::max( res.max[comp], lanes[1][d][l] );
+    }
+#endif
 
-    mm::vec3 spheremax = a->get_center() + a->get_radius();
-    mm::vec3 spheremin = a->get_center() - a->get_radius();
+  for( ; c < num; ++c )
+    res.expand( mm::vec3( verts[c * 3 + 0], verts[c * 3 + 1], verts[c * 3 + 2] ) );
 
-    if( mm::all( mm::lessThanEqual( spheremax, b->max ) ) && mm::all( mm::greaterThanEqual( spheremin, b->min ) ) )
-      return true;
+  return res;
+}
 
-    return false;
-  }
+inline aabb fit_aabb( const std::vector<float>& vertices )
+{
+  return vertices.empty() ? aabb() : fit_aabb( &vertices[0], vertices.size() / 3 );
+}
 
-  //is a inside b?
-  static bool is_inside_as( shape* aa, shape* bb )
-  {
-    auto a = static_cast<aabb*>( aa );
-    auto b = static_cast<sphere*>( bb );
+inline aabb fit_aabb( const std::vector<mm::vec3>& points )
+{
+  aabb res;
 
-    mm::vec3 minvec = a->min - b->get_center();
-    mm::vec3 maxvec = a->max - b->get_center();
-    float sqrmaxlength = mm::dot( maxvec, maxvec );
-    float sqrminlength = mm::dot( minvec, minvec );
-    float sqrradius = b->get_radius() * b->get_radius();
+  for( auto& p : points )
+    res.expand( p );
 
-    if( sqrmaxlength <= sqrradius && sqrminlength <= sqrradius )
-      return true;
+  return res;
+}
 
-    return false;
-  }
+//bounding sphere of xyz triplets (like mesh::vertices), by ritter's method
+//the initial diameter is the farthest pair of the extremal points along 7 directions (as in epos-14),
+//then a second pass grows the sphere to cover every point. the result is at most a few percent larger than the minimal sphere
+inline sphere fit_sphere( const float* verts, unsigned num )
+{
+  if( num == 0 )
+    return sphere();
 
-  //is a inside b?
-  static bool is_inside_aa( shape* aa, shape* bb )
+  static const float dirs[7][3] =
   {
-    auto a = static_cast<aabb*>( aa );
-    auto b = static_cast<aabb*>( bb );
+    { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 },
+    { 1, 1, 1 }, { 1, 1, -1 }, { 1, -1, 1 }, { 1, -1, -1 }
+  };
 
-    if( mm::all( mm::greaterThanEqual( a->min, b->min ) ) && mm::all( mm::lessThanEqual( a->max, b->max ) ) )
-      return true;
+  unsigned min_idx[7] = { 0 }, max_idx[7] = { 0 };
+  float min_proj[7], max_proj[7];
 
-    return false;
+  for( int d = 0; d < 7; ++d )
+  {
+    min_proj[d] = FLT_MAX;
+    max_proj[d] = -FLT_MAX;
   }
 
-  //is a inside b?
-  static bool is_inside_ss( shape* aa, shape* bb )
+  for( unsigned c = 0; c < num; ++c )
   {
-    auto a = static_cast<sphere*>( aa );
-    auto b = static_cast<sphere*>( bb );
-
-    mm::vec3 spheredist = b->get_center() - a->get_center();
+    const float* p = verts + c * 3;
 
-    if( mm::dot( spheredist, spheredist ) <= b->get_radius() * b->get_radius() )
-      return true;
+    for( int d = 0; d < 7; ++d )
+    {
+      float proj = p[0] * dirs[d][0] + p[1] * dirs[d][1] + p[2] * dirs[d][2];
 
-    return false;
-  }
+      if( proj < min_proj[d] )
+      {
+        min_proj[d] = proj;
+        min_idx[d] = c;
+      }
+
+      if( proj > max_proj[d] )
+      {
+        max_proj[d] = proj;
+        max_idx[d] = c;
+      }
+    }
+  }
+
+  auto get_point = [&]( unsigned i )
+  {
+    return mm::vec3( verts[i * 3 + 0], verts[i * 3 + 1], verts[i * 3 + 2] );
+  };
+
+  mm::vec3 a = get_point( min_idx[0] ), b = get_point( max_idx[0] );
+  float best = -1;
+
+  for( int d = 0; d < 7; ++d )
+  {
+    mm::vec3 k = get_point( min_idx[d] ), l = get_point( max_idx[d] );
+    mm::vec3 e = l - k;
+    float dist2 = mm::dot( e, e );
+
+    if( dist2 > best )
+    {
+      best = dist2;
+      a = k;
+      b = l;
+    }
+  }
+
+  mm::vec3 center = ( a + b ) * 0.5f;
+  float radius = mm::length( b - a ) * 0.5f;
+
+  //grow the sphere just enough to reach each point outside, keeping the far side in place
+  for( unsigned c = 0; c < num; ++c )
+  {
+    mm::vec3 p = get_point( c );
+    float dist = mm::length( p - center );
+
+    if( dist > radius )
+    {
+      float new_radius = ( radius + dist ) * 0.5f;
+      center += ( p - center ) * ( ( new_radius - radius ) / dist );
+      radius = new_radius;
+    }
+  }
+
+  return sphere( center, radius );
+}
+
+inline sphere fit_sphere( const std::vector<float>& vertices )
+{
+  return vertices.empty() ? sphere() : fit_sphere( &vertices[0], vertices.size() / 3 );
+}
+
+//the axis aligned box of a transformed box, by arvo's method
+//each component of the result is the sum of the smaller / larger products with the matrix,
+//so it costs 9 multiplications per bound instead of transforming the 8 corners
+inline aabb transform_aabb( const aabb& box, const mm::mat4& m )
+{
+  if( box.min.x > box.max.x )
+    return box; //empty
+
+  aabb res;
+
+  for( int i = 0; i < 3; ++i )
+  {
+    res.min[i] = res.max[i] = m[3][i];
+
+    for( int j = 0; j < 3; ++j )
+    {
+      float e = m[j][i] * box.min[j];
+      float f = m[j][i] * box.max[j];
+      res.min[i] += std::min( e, f );
+      res.max[i] += std::max( e, f );
+    }
+  }
+
+  return res;
+}
+
+//the sphere of a transformed sphere, the radius grows by the largest scaling of the matrix
+inline sphere transform_sphere( const sphere& s, const mm::mat4& m )
+{
+  float scale = 0;
+
+  for( int j = 0; j < 3; ++j )
+    scale = std::max( scale, mm::length( m[j].xyz ) );
+
+  return sphere( ( m * mm::vec4( s.get_center(), 1 ) ).xyz, s.get_radius() * scale );
+}
+
+//1/d, but axis parallel directions give a huge finite number instead of inf
+//so that 0 * inv_dir stays 0 instead of nan
+inline mm::vec3 get_safe_inv_dir( const mm::vec3& d )
+{
+  mm::vec3 res;
+
+  for( int c = 0; c < 3; ++c )
+  {
+    if( std::abs( d[c] ) > mm::epsilon * mm::epsilon )
+      res[c] = 1.0f / d[c];
+    else
+      res[c] = d[c] < 0 ? -FLT_MAX : FLT_MAX;
+  }
+
+  return res;
+}
+
+//a cone with a flat base, eg. the lit volume of a spot light
+class MM_16_BYTE_ALIGNED cone : public shape
+{
+public:
+  mm::vec3 apex;
+  mm::vec3 direction; //normalized, from the apex towards the base
+  float range; //distance of the base from the apex
+  float cos_angle, sin_angle; //of the half angle
+
+  static int get_class_idx()
+  {
+    static int idx = 7;
+    return idx;
+  }
+
+  int get_class_index() const
+  {
+    return get_class_idx();
+  }
+
+  void set_angle( float half_angle )
+  {
+    cos_angle = std::cos( half_angle );
+    sin_angle = std::sin( half_angle );
+  }
+
+  mm::vec3 get_base_center() const
+  {
+    return apex + direction * range;
+  }
+
+  float get_base_radius() const
+  {
+    return range * sin_angle / cos_angle;
+  }
+
+  //largest signed distance of the cone from the plane dot( n, p ) + d = 0
+  //it is either the apex or a point of the base rim
+  float get_max_distance( const mm::vec3& n, float d ) const
+  {
+    float nd = mm::dot( n, direction );
+    float rim = mm::dot( n, get_base_center() ) + d + get_base_radius() * std::sqrt( std::max( 0.0f, 1 - nd * nd ) );
+    return std::max( mm::dot( n, apex ) + d, rim );
+  }
+
+  cone( const mm::vec3& a = mm::vec3( 0 ), const mm::vec3& dir = mm::vec3( 0, 0, -1 ), float half_angle = mm::pi / 4, float r = 1 ) : apex( a ), direction( dir ), range( r )
+  {
+    set_angle( half_angle );
+  }
+};
+
+//result of an exact ray-triangle hit
+//the hit point is k * ( 1 - u - v ) + l * u + m * v
+struct triangle_hit
+{
+  float t, u, v;
+  unsigned triangle; //index of the triangle in the mesh
+  mm::vec3 normal; //geometric normal of the triangle, only set by triangle_bvh::intersect
+
+  triangle_hit() : t( INVALID ), u( 0 ), v( 0 ), triangle( ~0u ), normal( 0 )
+  {
+  }
+};
+
+//per ray data of the watertight ray-triangle test (Woop, Benthin, Wald 2013)
+//computing it once is worth it when the same ray is tested against lots of triangles
+class watertight_ray
+{
+public:
+  mm::vec3 origin;
+  int kx, ky, kz; //axes permuted so that kz is the dominant direction axis
+  float sx, sy, sz; //shear constants
+
+  void set_up( const ray& r )
+  {
+    origin = r.origin;
+
+    mm::vec3 d = mm::abs( r.direction );
+    kz = d.x > d.y ? ( d.x > d.z ? 0 : 2 ) : ( d.y > d.z ? 1 : 2 );
+    kx = ( kz + 1 ) % 3;
+    ky = ( kx + 1 ) % 3;
+
+    //keep the winding
+    if( r.direction[kz] < 0 )
+      std::swap( kx, ky );
+
+    sx = r.direction[kx] / r.direction[kz];
+    sy = r.direction[ky] / r.direction[kz];
+    sz = 1.0f / r.direction[kz];
+  }
+
+  watertight_ray( const ray& r )
+  {
+    set_up( r );
+  }
+};
+
+//exact ray-triangle test, no cracks along shared edges or at shared vertices
+//both windings count as a hit, only hits in [0...max_dist] are reported
+inline bool intersect_watertight( const watertight_ray& r, const mm::vec3& k, const mm::vec3& l, const mm::vec3& m, triangle_hit& hit, float max_dist = FLT_MAX )
+{
+  mm::vec3 a = k - r.origin;
+  mm::vec3 b = l - r.origin;
+  mm::vec3 c = m - r.origin;
+
+  float ax = a[r.kx] - r.sx * a[r.kz];
+  float ay = a[r.ky] - r.sy * a[r.kz];
+  float bx = b[r.kx] - r.sx * b[r.kz];
+  float by = b[r.ky] - r.sy * b[r.kz];
+  float cx = c[r.kx] - r.sx * c[r.kz];
+  float cy = c[r.ky] - r.sy * c[r.kz];
+
+  //scaled barycentrics, the products are exact in double precision
+  //so the edge functions stay antisymmetric even when the compiler contracts to fma
+  float u = float( double( cx ) * double( by ) - double( cy ) * double( bx ) );
+  float v = float( double( ax ) * double( cy ) - double( ay ) * double( cx ) );
+  float w = float( double( bx ) * double( ay ) - double( by ) * double( ax ) );
+
+  if( ( u < 0 || v < 0 || w < 0 ) && ( u > 0 || v > 0 || w > 0 ) )
+    return false;
+
+  float det = u + v + w;
+
+  if( det == 0 )
+    return false;
+
+  float t = u * r.sz * a[r.kz] + v * r.sz * b[r.kz] + w * r.sz * c[r.kz];
+
+  //t / det has to be in [0...max_dist], without the division
+  if( det < 0 ? ( t > 0 || t < max_dist * det ) : ( t < 0 || t > max_dist * det ) )
+    return false;
+
+  float inv_det = 1.0f / det;
+
+  hit.t = t * inv_det;
+  hit.u = v * inv_det;
+  hit.v = w * inv_det;
+
+  return true;
+}
+
+namespace inner
+{
+  //only tells if the sphere is on the right side of the plane!
+  static bool is_on_right_side_sp( shape* aa, shape* bb )
+  {
+    auto a = static_cast<sphere*>( aa );
+    auto b = static_cast<plane*>( bb );
+
+    float dist = b->distance( a->get_center() );
+    //dist + radius == how far is the sphere from the plane (usable when we want to do lod using the near plane)
+
+    if( dist < -a->get_radius() )
+      return false;
+
+    return true;
+  }
+
+  static bool is_on_right_side_ps( shape* aa, shape* bb )
+  {
+    return is_on_right_side_sp( bb, aa );
+  }
+
+  //only tells if the sphere is on the right side of the plane!
+  static bool is_on_right_side_ap( shape* aa, shape* bb )
+  {
+    auto a = static_cast<aabb*>( aa );
+    auto b = static_cast<plane*>( bb );
+
+    if( b->distance( a->get_pos_vertex( b->get_normal() ) ) < 0 )
+      return false;
+
+    return true;
+  }
+
+  static bool is_on_right_side_pa( shape* aa, shape* bb )
+  {
+    return is_on_right_side_ap( bb, aa );
+  }
+
+  static bool is_intersecting_ss( shape* aa, shape* bb )
+  {
+    auto a = static_cast<sphere*>( aa );
+    auto b = static_cast<sphere*>( bb );
+
+    mm::vec3 diff = a->get_center() - b->get_center();
+    float dist = mm::dot( diff, diff );
+
+    float rad_sum = b->get_radius() + a->get_radius();
+
+    if( dist > rad_sum * rad_sum ) //squared distance check
+      return false;
+
+    return true;
+  }
+
+  //checks if a sphere intersects a plane
+  static bool is_intersecting_sp( shape* aa, shape* bb )
+  {
+    auto a = static_cast<sphere*>( aa );
+    auto b = static_cast<plane*>( bb );
+
+    float dist = b->distance( a->get_center() );
+
+    if( abs( dist ) <= a->get_radius() )
+      return true;
+
+    return false;
+  }
+
+  static bool is_intersecting_ps( shape* aa, shape* bb )
+  {
+    return is_intersecting_sp( bb, aa );
+  }
+
+  static bool is_intersecting_pp( shape* aa, shape* bb )
+  {
+    auto a = static_cast<plane*>( aa );
+    auto b = static_cast<plane*>( bb );
+
+    mm::vec3 vector = mm::cross( a->get_normal(), b->get_normal() );
+
+    //if the cross product yields a null vector
+    //then the angle is either 0 or 180
+    //that is the two normals are parallel
+    // sin(alpha) = 0
+    // ==> |a| * |b| * sin(alpha) = 0
+    if( mm::all( mm::equal( vector, mm::vec3( 0 ) ) ) )
+      return false;
+
+    return true;
+  }
+
+  static bool is_intersecting_aa( shape* aa, shape* bb )
+  {
+    auto a = static_cast<aabb*>( aa );
+    auto b = static_cast<aabb*>( bb );
+
+    mm::vec3 t = b->get_pos() - a->get_pos();
+
+    mm::vec3 aextent = a->get_extents();
+    mm::vec3 bextent = b->get_extents();
+
+    if( abs( t.x ) > ( aextent.x + bextent.x ) )
+      return false;
+
+    if( abs( t.y ) > ( aextent.y + bextent.y ) )
+      return false;
+
+    if( abs( t.z ) > ( aextent.z + bextent.z ) )
+      return false;
+
+    return true;
+  }
+
+  static bool is_intersecting_as( shape* aa, shape* bb )
+  {
+    auto a = static_cast<aabb*>( aa );
+    auto b = static_cast<sphere*>( bb );
+
+    //square distance check between spheres and aabbs
+    mm::vec3 vec = b->get_center() - mm::clamp( a->get_pos() + ( b->get_center() - a->get_pos() ), a->min, a->max );
+
+    float sqlength = mm::dot( vec, vec );
+
+    if( sqlength > b->get_radius() * b->get_radius() )
+      return false;
+
+    return true;
+  }
+
+  static bool is_intersecting_sa( shape* aa, shape* bb )
+  {
+    return is_intersecting_as( bb, aa );
+  }
+
+  static bool is_intersecting_ap( shape* aa, shape* bb )
+  {
+    auto a = static_cast<aabb*>( aa );
+    auto b = static_cast<plane*>( bb );
+
+    mm::vec3 p = a->get_pos_vertex( b->get_normal() );
+    mm::vec3 n = a->get_neg_vertex( b->get_normal() );
+
+    float dist_p = b->distance( p );
+    float dist_n = b->distance( n );
+
+    if( ( dist_n > 0 && dist_p > 0 ) ||
+      ( dist_n < 0 && dist_p < 0 ) )
+      return false;
+
+    return true;
+  }
+
+  static bool is_intersecting_pa( shape* aa, shape* bb )
+  {
+    return is_intersecting_ap( bb, aa );
+  }
+
+  static bool is_intersecting_fs( shape* aa, shape* bb )
+  {
+    auto a = static_cast<frustum*>( aa );
+
+    for( int c = 0; c < 6; ++c )
+    {
+      if( !is_on_right_side_ps( &a->planes[c], bb ) )
+        return false;
+    }
+
+    return true;
+  }
+
+  static bool is_intersecting_sf( shape* aa, shape* bb )
+  {
+    return is_intersecting_fs( bb, aa );
+  }
+
+  static bool is_intersecting_fa( shape* aa, shape* bb )
+  {
+    auto a = static_cast<frustum*>( aa );
+    auto b = static_cast<aabb*>( bb );
+
+    bool res = true;
+    for( int c = 0; c < 6; ++c )
+    {
+      if( !is_on_right_side_ap( b, &a->planes[c] ) )
+      {
+        res = false;
+        break;
+      }
+    }
+    return res;
+  }
+
+  static bool is_intersecting_af( shape* aa, shape* bb )
+  {
+    return is_intersecting_fa( bb, aa );
+  }
+
+  //is a inside b?
+  static bool is_inside_sa( shape* aa, shape* bb )
+  {
+    auto a = static_cast<sphere*>( aa );
+    auto b = static_cast<aabb*>( bb );
+
+    mm::vec3 spheremax = a->get_center() + a->get_radius();
+    mm::vec3 spheremin = a->get_center() - a->get_radius();
+
+    if( mm::all( mm::lessThanEqual( spheremax, b->max ) ) && mm::all( mm::greaterThanEqual( spheremin, b->min ) ) )
+      return true;
+
+    return false;
+  }
+
+  //is a inside b?
+  static bool is_inside_as( shape* aa, shape* bb )
+  {
+    auto a = static_cast<aabb*>( aa );
+    auto b = static_cast<sphere*>( bb );
+
+    mm::vec3 minvec = a->min - b->get_center();
+    mm::vec3 maxvec = a->max - b->get_center();
+    float sqrmaxlength = mm::dot( maxvec, maxvec );
+    float sqrminlength = mm::dot( minvec, minvec );
+    float sqrradius = b->get_radius() * b->get_radius();
+
+    if( sqrmaxlength <= sqrradius && sqrminlength <= sqrradius )
+      return true;
+
+    return false;
+  }
+
+  //is a inside b?
+  static bool is_inside_aa( shape* aa, shape* bb )
+  {
+    auto a = static_cast<aabb*>( aa );
+    auto b = static_cast<aabb*>( bb );
+
+    if( mm::all( mm::greaterThanEqual( a->min, b->min ) ) && mm::all( mm::lessThanEqual( a->max, b->max ) ) )
+      return true;
+
+    return false;
+  }
+
+  //is a inside b?
+  static bool is_inside_ss( shape* aa, shape* bb )
+  {
+    auto a = static_cast<sphere*>( aa );
+    auto b = static_cast<sphere*>( bb );
+
+    mm::vec3 spheredist = b->get_center() - a->get_center();
+
+    if( mm::dot( spheredist, spheredist ) <= b->get_radius() * b->get_radius() )
+      return true;
+
+    return false;
+  }
 
   static bool is_intersecting_rt( shape* aa, shape* bb )
   {
-    auto a = static_cast<ray*>( aa );
-    auto b = static_cast<triangle*>( bb );
+    auto a = static_cast<ray*>( aa );
+    auto b = static_cast<triangle*>( bb );
+
+    triangle_hit hit;
+    return intersect_watertight( watertight_ray( *a ), b->k, b->l, b->m, hit );
+  }
+
+  static mm::vec2 intersect_rt( shape* aa, shape* bb )
+  {
+    auto a = static_cast<ray*>( aa );
+    auto b = static_cast<triangle*>( bb );
+
+    //a triangle is flat, entry and exit are the same
+    triangle_hit hit;
+    if( intersect_watertight( watertight_ray( *a ), b->k, b->l, b->m, hit ) )
+      return mm::vec2( hit.t, hit.t );
+
+    return INVALID;
+  }
+
+  static bool is_intersecting_tr( shape* aa, shape* bb )
+  {
+    return is_intersecting_rt( bb, aa );
+  }
+
+  static mm::vec2 intersect_tr( shape* aa, shape* bb )
+  {
+    return intersect_rt( bb, aa );
+  }
+
+  static bool is_intersecting_rs( shape* aa, shape* bb )
+  {
+    auto a = static_cast<ray*>( aa );
+    auto b = static_cast<sphere*>( bb );
+
+    mm::vec3 diff = b->get_center() - a->origin;
+    float dist = mm::dot( diff, diff ) - ( b->get_radius() * b->get_radius() );
+
+    if( dist <= 0 )
+      return true;
+
+    float dist2 = mm::dot( a->direction, diff );
+
+    if( dist2 >= 0 )
+      return false;
+
+    return ( dist2 * dist2 - dist ) >= 0;
+  }
+
+  static mm::vec2 intersect_rs( shape* aa, shape* bb )
+  { //we assume ray dir is a unit vector
+    auto a = static_cast<ray*>( aa );
+    auto b = static_cast<sphere*>( bb );
+
+    mm::vec3 x = a->origin - b->get_center();
+
+    float bbb = mm::dot( a->direction, x ) * 2;
+    float ccc = mm::dot( x, x ) - b->get_radius() * b->get_radius();
+
+    float sqr = bbb * bbb - 4 * ccc;
+
+    if( sqr > 0 )
+    {
+      float root = std::sqrt( sqr );
+      float inv_2a = 0.5f;
+
+      float t1 = ( -bbb - root ) * inv_2a;
+      float t2 = ( -bbb + root ) * inv_2a;
+
+      if( t1 < 0 )
+      {
+        if( t2 < 0 )
+        {
+          return INVALID;
+        }
+        else
+        {
+          return mm::vec2( t2, t1 );
+        }
+      }
+      else
+      {
+        return mm::vec2( t1, t2 );
+      }
+    }
+
+    return INVALID;
+  }
+
+  static bool is_intersecting_sr( shape* aa, shape* bb )
+  {
+    return is_intersecting_rs( bb, aa );
+  }
+
+  static mm::vec2 intersect_sr( shape* aa, shape* bb )
+  {
+    return intersect_rs( bb, aa );
+  }
+
+  static bool is_intersecting_ra( shape* aa, shape* bb )
+  {
+    aabb* ab = static_cast<aabb*>( bb );
+    ray* r = static_cast<ray*>( aa );
+
+    // compute intersection of ray with all six bbox planes
+    mm::vec3 invR = get_safe_inv_dir( r->direction );
+
+    mm::vec3 tbot = invR * ( ab->min - r->origin );
+    mm::vec3 ttop = invR * ( ab->max - r->origin );
+
+    // re-order intersections to find smallest and largest on each axis
+    mm::vec3 tmin = mm::min( ttop, tbot );
+    mm::vec3 tmax = mm::max( ttop, tbot );
+
+    // find the largest tmin and the smallest tmax
+    float largest_tmin = mm::max( mm::max( tmin.x, tmin.y ), tmin.z );
+    float smallest_tmax = mm::min( mm::min( tmax.x, tmax.y ), tmax.z );
+
+    return smallest_tmax > largest_tmin ? true : false;
+  }
+
+  static mm::vec2 intersect_ra( shape* aa, shape* bb )
+  {
+    aabb* ab = static_cast<aabb*>( bb );
+    ray* r = static_cast<ray*>( aa );
+
+    // compute intersection of ray with all six bbox planes
+    mm::vec3 invR = get_safe_inv_dir( r->direction );
+
+    mm::vec3 tbot = invR * ( ab->min - r->origin );
+    mm::vec3 ttop = invR * ( ab->max - r->origin );
+
+    // re-order intersections to find smallest and largest on each axis
+    mm::vec3 tmin = mm::min( ttop, tbot );
+    mm::vec3 tmax = mm::max( ttop, tbot );
+
+    // find the largest tmin and the smallest tmax
+    float largest_tmin = mm::max( mm::max( tmin.x, tmin.y ), tmin.z );
+    float smallest_tmax = mm::min( mm::min( tmax.x, tmax.y ), tmax.z );
+
+    return smallest_tmax > largest_tmin ? ( largest_tmin >= 0 ? mm::vec2( largest_tmin, smallest_tmax ) : mm::vec2( smallest_tmax, largest_tmin ) ) : INVALID;
+  }
+
+  static bool is_intersecting_ar( shape* aa, shape* bb )
+  {
+    return is_intersecting_ra( bb, aa );
+  }
+
+  static mm::vec2 intersect_ar( shape* aa, shape* bb )
+  {
+    return intersect_ra( bb, aa );
+  }
+
+  static bool is_intersecting_rp( shape* aa, shape* bb )
+  {
+    auto a = static_cast<ray*>( aa );
+    auto b = static_cast<plane*>( bb );
+
+    float denom = mm::dot( a->direction, b->get_normal() );
+
+    if( !mm::impl::is_eq( denom, 0.0f ) )
+    {
+      float t = mm::dot( b->get_point() - a->origin, b->get_normal() );
+      float tmp = t * denom;
+
+      if( tmp > 0.0f )
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  static mm::vec2 intersect_rp( shape* aa, shape* bb )
+  {
+    auto a = static_cast<ray*>( aa );
+    auto b = static_cast<plane*>( bb );
+
+    float denom = mm::dot( a->direction, b->get_normal() );
+
+    if( !mm::impl::is_eq( denom, 0.0f ) )
+    {
+      float t = mm::dot( b->get_point() - a->origin, b->get_normal() );
+      float tmp = t * denom;
+
+      if( tmp > 0.0f )
+      {
+        return t / denom;
+      }
+    }
+
+    return INVALID;
+  }
+
+  static bool is_intersecting_pr( shape* aa, shape* bb )
+  {
+    return is_intersecting_rp( bb, aa );
+  }
+
+  static mm::vec2 intersect_pr( shape* aa, shape* bb )
+  {
+    return intersect_rp( bb, aa );
+  }
+
+  //only tells if the obb is on the right side of the plane!
+  static bool is_on_right_side_bp( shape* aa, shape* bb )
+  {
+    auto a = static_cast<obb*>( aa );
+    auto b = static_cast<plane*>( bb );
+
+    return b->distance( a->center ) >= -a->get_radius( b->get_normal() );
+  }
+
+  static bool is_on_right_side_pb( shape* aa, shape* bb )
+  {
+    return is_on_right_side_bp( bb, aa );
+  }
+
+  static bool is_intersecting_bp( shape* aa, shape* bb )
+  {
+    auto a = static_cast<obb*>( aa );
+    auto b = static_cast<plane*>( bb );
+
+    return std::abs( b->distance( a->center ) ) <= a->get_radius( b->get_normal() );
+  }
+
+  static bool is_intersecting_pb( shape* aa, shape* bb )
+  {
+    return is_intersecting_bp( bb, aa );
+  }
+
+  static bool is_intersecting_bs( shape* aa, shape* bb )
+  {
+    auto a = static_cast<obb*>( aa );
+    auto b = static_cast<sphere*>( bb );
+
+    mm::vec3 diff = a->get_closest_point( b->get_center() ) - b->get_center();
+
+    return mm::dot( diff, diff ) <= b->get_radius() * b->get_radius();
+  }
+
+  static bool is_intersecting_sb( shape* aa, shape* bb )
+  {
+    return is_intersecting_bs( bb, aa );
+  }
+
+  //separating axis test with the 15 candidate axes (Gottschalk, Lin, Manocha 1996)
+  static bool is_intersecting_bb( shape* aa, shape* bb )
+  {
+    auto a = static_cast<obb*>( aa );
+    auto b = static_cast<obb*>( bb );
+
+    //b's axes in a's frame
+    //the epsilon keeps near parallel edge pairs from producing a zero cross product axis
+    float r[3][3], abs_r[3][3];
+
+    for( int i = 0; i < 3; ++i )
+      for( int j = 0; j < 3; ++j )
+      {
+        r[i][j] = mm::dot( a->axes[i], b->axes[j] );
+        abs_r[i][j] = std::abs( r[i][j] ) + mm::epsilon;
+      }
+
+    mm::vec3 d = b->center - a->center;
+    float t[3] = { mm::dot( d, a->axes[0] ), mm::dot( d, a->axes[1] ), mm::dot( d, a->axes[2] ) };
+
+    const mm::vec3& ea = a->extents;
+    const mm::vec3& eb = b->extents;
+
+    //a's faces
+    for( int i = 0; i < 3; ++i )
+    {
+      float rb = eb.x * abs_r[i][0] + eb.y * abs_r[i][1] + eb.z * abs_r[i][2];
+
+      if( std::abs( t[i] ) > ea[i] + rb )
+        return false;
+    }
+
+    //b's faces
+    for( int j = 0; j < 3; ++j )
+    {
+      float ra = ea.x * abs_r[0][j] + ea.y * abs_r[1][j] + ea.z * abs_r[2][j];
+
+      if( std::abs( t[0] * r[0][j] + t[1] * r[1][j] + t[2] * r[2][j] ) > ra + eb[j] )
+        return false;
+    }
+
+    //edge pairs
+    for( int i = 0; i < 3; ++i )
+    {
+      int i1 = ( i + 1 ) % 3, i2 = ( i + 2 ) % 3;
+
+      for( int j = 0; j < 3; ++j )
+      {
+        int j1 = ( j + 1 ) % 3, j2 = ( j + 2 ) % 3;
+
+        float ra = ea[i1] * abs_r[i2][j] + ea[i2] * abs_r[i1][j];
+        float rb = eb[j1] * abs_r[i][j2] + eb[j2] * abs_r[i][j1];
+
+        if( std::abs( t[i2] * r[i1][j] - t[i1] * r[i2][j] ) > ra + rb )
+          return false;
+      }
+    }
+
+    return true;
+  }
+
+  static bool is_intersecting_ba( shape* aa, shape* bb )
+  {
+    obb b( *static_cast<aabb*>( bb ) );
+    return is_intersecting_bb( aa, &b );
+  }
+
+  static bool is_intersecting_ab( shape* aa, shape* bb )
+  {
+    return is_intersecting_ba( bb, aa );
+  }
+
+  //exact test: the frustum planes first, they reject most boxes,
+  //then the remaining separating axes, the box axes and the edge-edge cross products
+  static bool is_intersecting_fb( shape* aa, shape* bb )
+  {
+    auto a = static_cast<frustum*>( aa );
+    auto b = static_cast<obb*>( bb );
+
+    bool inside = true;
+
+    for( int c = 0; c < 6; ++c )
+    {
+      float dist = a->planes[c].distance( b->center );
+      float radius = b->get_radius( a->planes[c].get_normal() );
+
+      if( dist < -radius )
+        return false;
+
+      inside = inside && dist >= radius;
+    }
+
+    //completely inside, nothing can separate them
+    if( inside )
+      return true;
+
+    auto is_separating = [&]( const mm::vec3& axis )
+    {
+      if( mm::dot( axis, axis ) < mm::epsilon * mm::epsilon )
+        return false;
+
+      float min = FLT_MAX, max = -FLT_MAX;
+
+      for( int c = 0; c < 8; ++c )
+      {
+        float p = mm::dot( a->points[c], axis );
+        min = std::min( min, p );
+        max = std::max( max, p );
+      }
+
+      float center = mm::dot( b->center, axis );
+      float radius = b->get_radius( axis );
+
+      return center + radius < min || center - radius > max;
+    };
+
+    for( int c = 0; c < 3; ++c )
+      if( is_separating( b->axes[c] ) )
+        return false;
+
+    mm::vec3 edges[6] =
+    {
+      a->points[frustum::NTR] - a->points[frustum::NTL],
+      a->points[frustum::NTL] - a->points[frustum::NBL],
+      a->points[frustum::FTL] - a->points[frustum::NTL],
+      a->points[frustum::FTR] - a->points[frustum::NTR],
+      a->points[frustum::FBL] - a->points[frustum::NBL],
+      a->points[frustum::FBR] - a->points[frustum::NBR]
+    };
+
+    for( int c = 0; c < 3; ++c )
+      for( int d = 0; d < 6; ++d )
+        if( is_separating( mm::cross( b->axes[c], edges[d] ) ) )
+          return false;
+
+    return true;
+  }
+
+  static bool is_intersecting_bf( shape* aa, shape* bb )
+  {
+    return is_intersecting_fb( bb, aa );
+  }
+
+  //the ray is transformed into the frame of the box, then it's a slab test
+  //boxes behind the ray don't count
+  static bool get_ray_obb_range( const ray* a, const obb* b, float& entry, float& exit )
+  {
+    mm::vec3 d = a->origin - b->center;
+    mm::vec3 origin( mm::dot( d, b->axes[0] ), mm::dot( d, b->axes[1] ), mm::dot( d, b->axes[2] ) );
+    mm::vec3 dir( mm::dot( a->direction, b->axes[0] ), mm::dot( a->direction, b->axes[1] ), mm::dot( a->direction, b->axes[2] ) );
+    mm::vec3 inv = get_safe_inv_dir( dir );
+
+    mm::vec3 t1 = ( -b->extents - origin ) * inv;
+    mm::vec3 t2 = ( b->extents - origin ) * inv;
+    mm::vec3 tmin = mm::min( t1, t2 );
+    mm::vec3 tmax = mm::max( t1, t2 );
+
+    entry = std::max( std::max( tmin.x, tmin.y ), tmin.z );
+    exit = std::min( std::min( tmax.x, tmax.y ), tmax.z );
+
+    return entry <= exit && exit >= 0;
+  }
+
+  static mm::vec2 intersect_rb( shape* aa, shape* bb )
+  {
+    float entry, exit;
+
+    if( !get_ray_obb_range( static_cast<ray*>( aa ), static_cast<obb*>( bb ), entry, exit ) )
+      return INVALID;
+
+    return entry >= 0 ? mm::vec2( entry, exit ) : mm::vec2( exit, entry );
+  }
+
+  static bool is_intersecting_rb( shape* aa, shape* bb )
+  {
+    float entry, exit;
+    return get_ray_obb_range( static_cast<ray*>( aa ), static_cast<obb*>( bb ), entry, exit );
+  }
+
+  static mm::vec2 intersect_br( shape* aa, shape* bb )
+  {
+    return intersect_rb( bb, aa );
+  }
+
+  static bool is_intersecting_br( shape* aa, shape* bb )
+  {
+    return is_intersecting_rb( bb, aa );
+  }
+
+  //separating axis test on the corner points
+  //the candidate axes are the plane normals of both, and the cross products of their edges
+  static bool is_intersecting_ff( shape* aa, shape* bb )
+  {
+    auto a = static_cast<frustum*>( aa );
+    auto b = static_cast<frustum*>( bb );
+
+    auto is_separating = [&]( const mm::vec3& axis )
+    {
+      if( mm::dot( axis, axis ) < mm::epsilon * mm::epsilon )
+        return false;
+
+      float min_a = FLT_MAX, max_a = -FLT_MAX, min_b = FLT_MAX, max_b = -FLT_MAX;
+
+      for( int c = 0; c < 8; ++c )
+      {
+        float pa = mm::dot( a->points[c], axis );
+        float pb = mm::dot( b->points[c], axis );
+        min_a = std::min( min_a, pa );
+        max_a = std::max( max_a, pa );
+        min_b = std::min( min_b, pb );
+        max_b = std::max( max_b, pb );
+      }
+
+      return max_a < min_b || max_b < min_a;
+    };
+
+    //cheap early out, the bounding boxes of the corners
+    mm::vec3 box_min_a = a->points[0], box_max_a = a->points[0], box_min_b = b->points[0], box_max_b = b->points[0];
+
+    for( int c = 1; c < 8; ++c )
+    {
+      box_min_a = mm::min( box_min_a, a->points[c] );
+      box_max_a = mm::max( box_max_a, a->points[c] );
+      box_min_b = mm::min( box_min_b, b->points[c] );
+      box_max_b = mm::max( box_max_b, b->points[c] );
+    }
+
+    if( box_max_a.x < box_min_b.x || box_max_b.x < box_min_a.x ||
+        box_max_a.y < box_min_b.y || box_max_b.y < box_min_a.y ||
+        box_max_a.z < box_min_b.z || box_max_b.z < box_min_a.z )
+      return false;
+
+    for( int c = 0; c < 6; ++c )
+      if( is_separating( a->planes[c].get_normal() ) || is_separating( b->planes[c].get_normal() ) )
+        return false;
+
+    auto get_edges = []( const frustum* f, mm::vec3* e )
+    {
+      e[0] = f->points[frustum::NTR] - f->points[frustum::NTL];
+      e[1] = f->points[frustum::NTL] - f->points[frustum::NBL];
+      e[2] = f->points[frustum::FTL] - f->points[frustum::NTL];
+      e[3] = f->points[frustum::FTR] - f->points[frustum::NTR];
+      e[4] = f->points[frustum::FBL] - f->points[frustum::NBL];
+      e[5] = f->points[frustum::FBR] - f->points[frustum::NBR];
+    };
+
+    mm::vec3 edges_a[6], edges_b[6];
+    get_edges( a, edges_a );
+    get_edges( b, edges_b );
+
+    for( int c = 0; c < 6; ++c )
+      for( int d = 0; d < 6; ++d )
+        if( is_separating( mm::cross( edges_a[c], edges_b[d] ) ) )
+          return false;
+
+    return true;
+  }
+
+  //only tells if the cone is on the right side of the plane!
+  static bool is_on_right_side_cp( shape* aa, shape* bb )
+  {
+    auto a = static_cast<cone*>( aa );
+    auto b = static_cast<plane*>( bb );
+
+    return a->get_max_distance( b->get_normal(), b->get_minus_n_dot_p() ) >= 0;
+  }
+
+  static bool is_on_right_side_pc( shape* aa, shape* bb )
+  {
+    return is_on_right_side_cp( bb, aa );
+  }
+
+  //the cone straddles the plane if it reaches out on both sides
+  static bool is_intersecting_cp( shape* aa, shape* bb )
+  {
+    auto a = static_cast<cone*>( aa );
+    auto b = static_cast<plane*>( bb );
+
+    return a->get_max_distance( b->get_normal(), b->get_minus_n_dot_p() ) >= 0 &&
+           a->get_max_distance( -b->get_normal(), -b->get_minus_n_dot_p() ) >= 0;
+  }
+
+  static bool is_intersecting_pc( shape* aa, shape* bb )
+  {
+    return is_intersecting_cp( bb, aa );
+  }
+
+  //the base is treated as a spherical cap, so spheres just past the rim of the base may be accepted
+  static bool is_intersecting_cs( shape* aa, shape* bb )
+  {
+    auto a = static_cast<cone*>( aa );
+    auto b = static_cast<sphere*>( bb );
+
+    mm::vec3 v = b->get_center() - a->apex;
+    float len_sq = mm::dot( v, v );
+    float along = mm::dot( v, a->direction );
+    float radius = b->get_radius();
+
+    //behind the apex or past the base
+    if( along < -radius || along > a->range + radius )
+      return false;
+
+    //distance of the center from the side of the cone
+    float side_dist = a->cos_angle * std::sqrt( std::max( 0.0f, len_sq - along * along ) ) - along * a->sin_angle;
+
+    return side_dist <= radius;
+  }
+
+  static bool is_intersecting_sc( shape* aa, shape* bb )
+  {
+    return is_intersecting_cs( bb, aa );
+  }
+
+  //conservative: the box has to reach between the apex and the base planes,
+  //and its bounding sphere has to touch the cone
+  static bool is_intersecting_ca( shape* aa, shape* bb )
+  {
+    auto a = static_cast<cone*>( aa );
+    auto b = static_cast<aabb*>( bb );
+
+    mm::vec3 n = a->direction;
+
+    if( mm::dot( b->get_pos_vertex( n ), n ) < mm::dot( a->apex, n ) )
+      return false;
+
+    if( mm::dot( b->get_neg_vertex( n ), n ) > mm::dot( a->get_base_center(), n ) )
+      return false;
+
+    sphere s( b->get_pos(), mm::length( b->get_extents() ) );
+    return is_intersecting_cs( aa, &s );
+  }
+
+  static bool is_intersecting_ac( shape* aa, shape* bb )
+  {
+    return is_intersecting_ca( bb, aa );
+  }
+
+  //same as the aabb test, with the projected radius of the box
+  static bool is_intersecting_cb( shape* aa, shape* bb )
+  {
+    auto a = static_cast<cone*>( aa );
+    auto b = static_cast<obb*>( bb );
+
+    mm::vec3 n = a->direction;
+    float center = mm::dot( b->center, n );
+    float radius = b->get_radius( n );
+
+    if( center + radius < mm::dot( a->apex, n ) || center - radius > mm::dot( a->get_base_center(), n ) )
+      return false;
+
+    sphere s( b->center, mm::length( b->extents ) );
+    return is_intersecting_cs( aa, &s );
+  }
+
+  static bool is_intersecting_bc( shape* aa, shape* bb )
+  {
+    return is_intersecting_cb( bb, aa );
+  }
+
+  //like the other frustum tests, boxes near the corners of the frustum may be accepted
+  static bool is_intersecting_fc( shape* aa, shape* bb )
+  {
+    auto a = static_cast<frustum*>( aa );
+    auto b = static_cast<cone*>( bb );
+
+    for( int c = 0; c < 6; ++c )
+      if( !is_on_right_side_cp( b, &a->planes[c] ) )
+        return false;
+
+    return true;
+  }
+
+  static bool is_intersecting_cf( shape* aa, shape* bb )
+  {
+    return is_intersecting_fc( bb, aa );
+  }
+}
+
+//the supported shape pairs, shared by the runtime dispatcher and the static dispatch
+//x( lhs type, rhs type, suffix of the inner:: function ), b stands for obb, c for cone
+#define SHAPE_IS_ON_RIGHT_SIDE_PAIRS( x ) \
+  x( sphere, plane, sp ) \
+  x( aabb, plane, ap ) \
+  x( plane, sphere, ps ) \
+  x( plane, aabb, pa ) \
+  x( obb, plane, bp ) \
+  x( plane, obb, pb ) \
+  x( cone, plane, cp ) \
+  x( plane, cone, pc )
+
+#define SHAPE_IS_INTERSECTING_PAIRS( x ) \
+  x( aabb, aabb, aa ) \
+  x( aabb, sphere, as ) \
+  x( aabb, ray, ar ) \
+  x( aabb, frustum, af ) \
+  x( aabb, plane, ap ) \
+  x( plane, aabb, pa ) \
+  x( plane, sphere, ps ) \
+  x( plane, ray, pr ) \
+  x( plane, plane, pp ) \
+  x( sphere, aabb, sa ) \
+  x( sphere, sphere, ss ) \
+  x( sphere, ray, sr ) \
+  x( sphere, frustum, sf ) \
+  x( sphere, plane, sp ) \
+  x( frustum, aabb, fa ) \
+  x( frustum, sphere, fs ) \
+  x( ray, aabb, ra ) \
+  x( ray, sphere, rs ) \
+  x( ray, triangle, rt ) \
+  x( ray, plane, rp ) \
+  x( triangle, ray, tr ) \
+  x( obb, obb, bb ) \
+  x( obb, aabb, ba ) \
+  x( aabb, obb, ab ) \
+  x( obb, sphere, bs ) \
+  x( sphere, obb, sb ) \
+  x( obb, ray, br ) \
+  x( ray, obb, rb ) \
+  x( obb, frustum, bf ) \
+  x( frustum, obb, fb ) \
+  x( obb, plane, bp ) \
+  x( plane, obb, pb ) \
+  x( frustum, frustum, ff ) \
+  x( cone, sphere, cs ) \
+  x( sphere, cone, sc ) \
+  x( cone, aabb, ca ) \
+  x( aabb, cone, ac ) \
+  x( cone, obb, cb ) \
+  x( obb, cone, bc ) \
+  x( cone, frustum, cf ) \
+  x( frustum, cone, fc ) \
+  x( cone, plane, cp ) \
+  x( plane, cone, pc )
+
+//order matters
+#define SHAPE_IS_INSIDE_PAIRS( x ) \
+  x( aabb, aabb, aa ) \
+  x( aabb, sphere, as ) \
+  x( sphere, aabb, sa ) \
+  x( sphere, sphere, ss )
+
+#define SHAPE_INTERSECT_PAIRS( x ) \
+  x( aabb, ray, ar ) \
+  x( ray, aabb, ra ) \
+  x( plane, ray, pr ) \
+  x( ray, plane, rp ) \
+  x( sphere, ray, sr ) \
+  x( ray, sphere, rs ) \
+  x( triangle, ray, tr ) \
+  x( ray, triangle, rt ) \
+  x( obb, ray, br ) \
+  x( ray, obb, rb )
+
+//thread safe, only the first call does the work
+void shape::set_up_intersection()
+{
+  static std::once_flag flag;
+
+  std::call_once( flag, []()
+  {
+#define SHAPE_ADD_IS_ON_RIGHT_SIDE( a, b, s ) _is_on_right_side.add<a, b>( inner::is_on_right_side_##s );
+#define SHAPE_ADD_IS_INTERSECTING( a, b, s ) _is_intersecting.add<a, b>( inner::is_intersecting_##s );
+#define SHAPE_ADD_IS_INSIDE( a, b, s ) _is_inside.add<a, b>( inner::is_inside_##s );
+#define SHAPE_ADD_INTERSECT( a, b, s ) _intersect.add<a, b>( inner::intersect_##s );
+
+    _is_on_right_side.set_elements( 8 );
+    SHAPE_IS_ON_RIGHT_SIDE_PAIRS( SHAPE_ADD_IS_ON_RIGHT_SIDE )
+
+    _is_intersecting.set_elements( 8 );
+    SHAPE_IS_INTERSECTING_PAIRS( SHAPE_ADD_IS_INTERSECTING )
+
+    _is_inside.set_elements( 8 );
+    SHAPE_IS_INSIDE_PAIRS( SHAPE_ADD_IS_INSIDE )
+
+    _intersect.set_elements( 8 );
+    SHAPE_INTERSECT_PAIRS( SHAPE_ADD_INTERSECT )
+
+#undef SHAPE_ADD_IS_ON_RIGHT_SIDE
+#undef SHAPE_ADD_IS_INTERSECTING
+#undef SHAPE_ADD_IS_INSIDE
+#undef SHAPE_ADD_INTERSECT
+
+    //usage
+    //is_on_the_right_side.go(new aabb(), new sphere());
+
+    is_setup = true;
+  } );
+}
+
+//////////////////////////////////////////////////
+// static dispatch
+// when both shape types are known at compile time the query is resolved
+// without virtual calls or the dispatcher's function pointer table,
+// eg. is_intersecting( r, box ) instead of r.is_intersecting( &box )
+//////////////////////////////////////////////////
+
+namespace inner
+{
+  //no generic versions, unsupported pairs don't compile
+  template<class a, class b> struct static_is_on_right_side;
+  template<class a, class b> struct static_is_intersecting;
+  template<class a, class b> struct static_is_inside;
+  template<class a, class b> struct static_intersect;
+
+#define SHAPE_STATIC_QUERY( query, ret, a, b, s ) \
+  template<> struct static_##query<a, b> \
+  { \
+    static ret go( const a& x, const b& y ) \
+    { \
+      return query##_##s( const_cast<a*>( &x ), const_cast<b*>( &y ) ); \
+    } \
+  };
+
+#define SHAPE_STATIC_IS_ON_RIGHT_SIDE( a, b, s ) SHAPE_STATIC_QUERY( is_on_right_side, bool, a, b, s )
+#define SHAPE_STATIC_IS_INTERSECTING( a, b, s ) SHAPE_STATIC_QUERY( is_intersecting, bool, a, b, s )
+#define SHAPE_STATIC_IS_INSIDE( a, b, s ) SHAPE_STATIC_QUERY( is_inside, bool, a, b, s )
+#define SHAPE_STATIC_INTERSECT( a, b, s ) SHAPE_STATIC_QUERY( intersect, mm::vec2, a, b, s )
+
+  SHAPE_IS_ON_RIGHT_SIDE_PAIRS( SHAPE_STATIC_IS_ON_RIGHT_SIDE )
+  SHAPE_IS_INTERSECTING_PAIRS( SHAPE_STATIC_IS_INTERSECTING )
+  SHAPE_IS_INSIDE_PAIRS( SHAPE_STATIC_IS_INSIDE )
+  SHAPE_INTERSECT_PAIRS( SHAPE_STATIC_INTERSECT )
+
+#undef SHAPE_STATIC_IS_ON_RIGHT_SIDE
+#undef SHAPE_STATIC_IS_INTERSECTING
+#undef SHAPE_STATIC_IS_INSIDE
+#undef SHAPE_STATIC_INTERSECT
+#undef SHAPE_STATIC_QUERY
+}
+
+template<class a, class b>
+bool is_on_right_side( const a& x, const b& y )
+{
+  return inner::static_is_on_right_side<a, b>::go( x, y );
+}
+
+template<class a, class b>
+bool is_intersecting( const a& x, const b& y )
+{
+  return inner::static_is_intersecting<a, b>::go( x, y );
+}
+
+//is a inside b?
+template<class a, class b>
+bool is_inside( const a& x, const b& y )
+{
+  return inner::static_is_inside<a, b>::go( x, y );
+}
+
+//x: min, y: max intersection
+template<class a, class b>
+mm::vec2 intersect( const a& x, const b& y )
+{
+  return inner::static_intersect<a, b>::go( x, y );
+}
+
+//a bounding volume stored by value (no heap allocation)
+//the shape type is a tag, queries switch on it and then use the static dispatch
+class MM_16_BYTE_ALIGNED bounding_volume
+{
+public:
+  enum type
+  {
+    NONE = 0, SPHERE, AABB, OBB
+  };
+
+private:
+  static const size_t storage_size = sizeof( obb ) > sizeof( aabb ) ?
+                                     ( sizeof( obb ) > sizeof( sphere ) ? sizeof( obb ) : sizeof( sphere ) ) :
+                                     ( sizeof( aabb ) > sizeof( sphere ) ? sizeof( aabb ) : sizeof( sphere ) );
+
+  MM_16_BYTE_ALIGNED unsigned char storage[storage_size];
+  type tag;
+
+  void copy( const bounding_volume& other )
+  {
+    tag = other.tag;
+
+    switch( tag )
+    {
+      case SPHERE:
+        new( storage ) sphere( other.get_sphere() );
+        break;
+      case AABB:
+        new( storage ) aabb( other.get_aabb() );
+        break;
+      case OBB:
+        new( storage ) obb( other.get_obb() );
+        break;
+      default:
+        break;
+    }
+  }
+
+public:
+  type get_type() const
+  {
+    return tag;
+  }
+
+  bool empty() const
+  {
+    return tag == NONE;
+  }
+
+  const sphere& get_sphere() const
+  {
+    assert( tag == SPHERE );
+    return *reinterpret_cast<const sphere*>( storage );
+  }
+
+  sphere& get_sphere()
+  {
+    assert( tag == SPHERE );
+    return *reinterpret_cast<sphere*>( storage );
+  }
+
+  const aabb& get_aabb() const
+  {
+    assert( tag == AABB );
+    return *reinterpret_cast<const aabb*>( storage );
+  }
+
+  aabb& get_aabb()
+  {
+    assert( tag == AABB );
+    return *reinterpret_cast<aabb*>( storage );
+  }
+
+  const obb& get_obb() const
+  {
+    assert( tag == OBB );
+    return *reinterpret_cast<const obb*>( storage );
+  }
+
+  obb& get_obb()
+  {
+    assert( tag == OBB );
+    return *reinterpret_cast<obb*>( storage );
+  }
+
+  //for the runtime dispatcher
+  shape* get()
+  {
+    return tag == NONE ? 0 : reinterpret_cast<shape*>( storage );
+  }
+
+  bounding_volume& operator=( const bounding_volume& other )
+  {
+    if( this != &other )
+      copy( other );
+
+    return *this;
+  }
+
+  bounding_volume() : tag( NONE )
+  {
+  }
+
+  bounding_volume( const bounding_volume& other )
+  {
+    copy( other );
+  }
+
+  bounding_volume( const sphere& s ) : tag( SPHERE )
+  {
+    new( storage ) sphere( s );
+  }
+
+  bounding_volume( const aabb& a ) : tag( AABB )
+  {
+    new( storage ) aabb( a );
+  }
+
+  bounding_volume( const obb& o ) : tag( OBB )
+  {
+    new( storage ) obb( o );
+  }
+};
+
+template<class t>
+bool is_intersecting( const bounding_volume& a, const t& b )
+{
+  switch( a.get_type() )
+  {
+    case bounding_volume::SPHERE:
+      return is_intersecting( a.get_sphere(), b );
+    case bounding_volume::AABB:
+      return is_intersecting( a.get_aabb(), b );
+    case bounding_volume::OBB:
+      return is_intersecting( a.get_obb(), b );
+    default:
+      return false;
+  }
+}
+
+template<class t>
+bool is_intersecting( const t& a, const bounding_volume& b )
+{
+  switch( b.get_type() )
+  {
+    case bounding_volume::SPHERE:
+      return is_intersecting( a, b.get_sphere() );
+    case bounding_volume::AABB:
+      return is_intersecting( a, b.get_aabb() );
+    case bounding_volume::OBB:
+      return is_intersecting( a, b.get_obb() );
+    default:
+      return false;
+  }
+}
+
+inline bool is_intersecting( const bounding_volume& a, const bounding_volume& b )
+{
+  switch( a.get_type() )
+  {
+    case bounding_volume::SPHERE:
+      return is_intersecting( a.get_sphere(), b );
+    case bounding_volume::AABB:
+      return is_intersecting( a.get_aabb(), b );
+    case bounding_volume::OBB:
+      return is_intersecting( a.get_obb(), b );
+    default:
+      return false;
+  }
+}
+
+//is a inside b?
+inline bool is_inside( const bounding_volume& a, const bounding_volume& b )
+{
+  if( a.get_type() == bounding_volume::SPHERE && b.get_type() == bounding_volume::SPHERE )
+    return is_inside( a.get_sphere(), b.get_sphere() );
+  else if( a.get_type() == bounding_volume::SPHERE && b.get_type() == bounding_volume::AABB )
+    return is_inside( a.get_sphere(), b.get_aabb() );
+  else if( a.get_type() == bounding_volume::AABB && b.get_type() == bounding_volume::SPHERE )
+    return is_inside( a.get_aabb(), b.get_sphere() );
+  else if( a.get_type() == bounding_volume::AABB && b.get_type() == bounding_volume::AABB )
+    return is_inside( a.get_aabb(), b.get_aabb() );
+
+  return false;
+}
+
+template<class t>
+bool is_on_right_side( const bounding_volume& a, const t& b )
+{
+  switch( a.get_type() )
+  {
+    case bounding_volume::SPHERE:
+      return is_on_right_side( a.get_sphere(), b );
+    case bounding_volume::AABB:
+      return is_on_right_side( a.get_aabb(), b );
+    case bounding_volume::OBB:
+      return is_on_right_side( a.get_obb(), b );
+    default:
+      return false;
+  }
+}
+
+//x: min, y: max intersection
+template<class t>
+mm::vec2 intersect( const bounding_volume& a, const t& b )
+{
+  switch( a.get_type() )
+  {
+    case bounding_volume::SPHERE:
+      return intersect( a.get_sphere(), b );
+    case bounding_volume::AABB:
+      return intersect( a.get_aabb(), b );
+    case bounding_volume::OBB:
+      return intersect( a.get_obb(), b );
+    default:
+      return INVALID;
+  }
+}
+
+template<class t>
+mm::vec2 intersect( const t& a, const bounding_volume& b )
+{
+  switch( b.get_type() )
+  {
+    case bounding_volume::SPHERE:
+      return intersect( a, b.get_sphere() );
+    case bounding_volume::AABB:
+      return intersect( a, b.get_aabb() );
+    case bounding_volume::OBB:
+      return intersect( a, b.get_obb() );
+    default:
+      return INVALID;
+  }
+}
+
+//////////////////////////////////////////////////
+// batch queries
+// these work on structure of arrays data and don't go through the dispatcher,
+// so they can stream over tens of thousands of bounds in a tight loop
+//////////////////////////////////////////////////
+
+inline unsigned count_bits( unsigned v )
+{
+  v = v - ( ( v >> 1 ) & 0x55555555 );
+  v = ( v & 0x33333333 ) + ( ( v >> 2 ) & 0x33333333 );
+  return ( ( ( v + ( v >> 4 ) ) & 0x0f0f0f0f ) * 0x01010101 ) >> 24;
+}
+
+//clears the bits of the padding lanes of a batch result and returns the number of set bits
+inline unsigned mask_padding( std::vector<unsigned>& bits, unsigned size )
+{
+  unsigned num = 0;
+
+  for( unsigned c = 0; c < bits.size(); ++c )
+  {
+    if( ( c + 1 ) * 32 > size )
+    {
+      unsigned valid = size > c * 32 ? size - c * 32 : 0;
+      bits[c] &= valid ? ( ~0u >> ( 32 - valid ) ) : 0;
+    }
+
+    num += count_bits( bits[c] );
+  }
+
+  return num;
+}
+
+//turns a batch result bitmask into a list of indices
+inline void compact_bits( const std::vector<unsigned>& bits, std::vector<unsigned>& indices )
+{
+  indices.clear();
+
+  for( unsigned c = 0; c < bits.size(); ++c )
+  {
+    unsigned word = bits[c];
+
+    while( word )
+    {
+      unsigned bit = 0;
+      while( !( word & ( 1u << bit ) ) )
+        ++bit;
+
+      indices.push_back( c * 32 + bit );
+      word &= word - 1;
+    }
+  }
+}
+
+//a set of aabbs stored as structure of arrays
+//the arrays are always padded to a multiple of 8 with empty boxes so the kernels can load whole registers
+class aabb_soa
+{
+  unsigned count;
+public:
+  std::vector<float> min_x, min_y, min_z, max_x, max_y, max_z;
+
+  unsigned size() const
+  {
+    return count;
+  }
+
+  unsigned padded_size() const
+  {
+    return min_x.size();
+  }
+
+  void resize( unsigned n )
+  {
+    unsigned padded = ( n + 7 ) & ~7u;
+
+    //shrinking has to reset the now unused lanes to empty boxes
+    for( unsigned c = n; c < count; ++c )
+      set( c, aabb() );
+
+    count = n;
+
+    min_x.resize( padded, FLT_MAX );
+    min_y.resize( padded, FLT_MAX );
+    min_z.resize( padded, FLT_MAX );
+    max_x.resize( padded, -FLT_MAX );
+    max_y.resize( padded, -FLT_MAX );
+    max_z.resize( padded, -FLT_MAX );
+  }
+
+  void reserve( unsigned n )
+  {
+    unsigned padded = ( n + 7 ) & ~7u;
+
+    min_x.reserve( padded );
+    min_y.reserve( padded );
+    min_z.reserve( padded );
+    max_x.reserve( padded );
+    max_y.reserve( padded );
+    max_z.reserve( padded );
+  }
+
+  void clear()
+  {
+    count = 0;
+
+    min_x.clear();
+    min_y.clear();
+    min_z.clear();
+    max_x.clear();
+    max_y.clear();
+    max_z.clear();
+  }
+
+  void set( unsigned i, const aabb& a )
+  {
+    min_x[i] = a.min.x;
+    min_y[i] = a.min.y;
+    min_z[i] = a.min.z;
+    max_x[i] = a.max.x;
+    max_y[i] = a.max.y;
+    max_z[i] = a.max.z;
+  }
+
+  aabb get( unsigned i ) const
+  {
+    aabb a;
+    a.min = mm::vec3( min_x[i], min_y[i], min_z[i] );
+    a.max = mm::vec3( max_x[i], max_y[i], max_z[i] );
+    return a;
+  }
+
+  void push_back( const aabb& a )
+  {
+    resize( count + 1 );
+    set( count - 1, a );
+  }
+
+  aabb_soa() : count( 0 )
+  {
+  }
+};
+
+//up to 8 coherent rays (eg. neighbouring pixels) stored as structure of arrays
+class ray_packet
+{
+public:
+  float ox[8], oy[8], oz[8]; //origins
+  float ix[8], iy[8], iz[8]; //inverse directions
+  unsigned size;
+
+  void set( unsigned i, const ray& r )
+  {
+    mm::vec3 inv = get_safe_inv_dir( r.direction );
+
+    ox[i] = r.origin.x;
+    oy[i] = r.origin.y;
+    oz[i] = r.origin.z;
+    ix[i] = inv.x;
+    iy[i] = inv.y;
+    iz[i] = inv.z;
+  }
+
+  void push_back( const ray& r )
+  {
+    assert( size < 8 );
+    set( size++, r );
+  }
+
+  ray_packet() : size( 0 )
+  {
+    for( int c = 0; c < 8; ++c )
+      set( c, ray() );
+  }
+};
+
+//the code path intersect_ra_batch, intersect_ra_packet and intersect_rb_batch are built with (eg. for benchmark output)
+#if defined( __AVX__ )
+const char* const ray_batch_variant = "avx";
+#elif defined( MYMATH_USE_SSE2 )
+const char* const ray_batch_variant = "sse2";
+#else
+const char* const ray_batch_variant = "scalar";
+#endif
+
+//tests one ray against every box of the set
+//hits: bit i of hits[i / 32] is set if box i is hit
+//dist: entry distance along the ray for every box (0 if the origin is inside, INVALID on a miss)
+//returns the number of boxes hit
+inline unsigned intersect_ra_batch( const ray& r, const aabb_soa& boxes, std::vector<unsigned>& hits, std::vector<float>& dist, float max_dist = FLT_MAX )
+{
+  unsigned size = boxes.size();
+  unsigned padded = boxes.padded_size();
+
+  hits.assign( ( padded + 31 ) / 32, 0 );
+  dist.resize( padded );
+
+  mm::vec3 inv = get_safe_inv_dir( r.direction );
+  unsigned c = 0;
+
+#if defined( __AVX__ )
+  __m256 ox = _mm256_set1_ps( r.origin.x ), oy = _mm256_set1_ps( r.origin.y ), oz = _mm256_set1_ps( r.origin.z );
+  __m256 ix = _mm256_set1_ps( inv.x ), iy = _mm256_set1_ps( inv.y ), iz = _mm256_set1_ps( inv.z );
+  __m256 zero = _mm256_setzero_ps(), far_limit = _mm256_set1_ps( max_dist ), invalid = _mm256_set1_ps( INVALID );
+
+  for( ; c < padded; c += 8 )
+  {
+    __m256 tx1 = _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( &boxes.min_x[c] ), ox ), ix );
+    __m256 tx2 = _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( &boxes.max_x[c] ), ox ), ix );
+    __m256 ty1 = _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( &boxes.min_y[c] ), oy ), iy );
+    __m256 ty2 = _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( &boxes.max_y[c] ), oy ), iy );
+    __m256 tz1 = _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( &boxes.min_z[c] ), oz ), iz );
+    __m256 tz2 = _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( &boxes.max_z[c] ), oz ), iz );
+
+    __m256 tnear = _mm256_max_ps( _mm256_max_ps( _mm256_min_ps( tx1, tx2 ), _mm256_min_ps( ty1, ty2 ) ), _mm256_max_ps( _mm256_min_ps( tz1, tz2 ), zero ) );
+    __m256 tfar = _mm256_min_ps( _mm256_min_ps( _mm256_max_ps( tx1, tx2 ), _mm256_max_ps( ty1, ty2 ) ), _mm256_min_ps( _mm256_max_ps( tz1, tz2 ), far_limit ) );
+
+    __m256 hit = _mm256_cmp_ps( tnear, tfar, _CMP_LE_OQ );
+
+    _mm256_storeu_ps( &dist[c], _mm256_blendv_ps( invalid, tnear, hit ) );
+    hits[c >> 5] |= unsigned( _mm256_movemask_ps( hit ) ) << ( c & 31 );
+  }
+#elif defined( MYMATH_USE_SSE2 )
+  __m128 ox = _mm_set1_ps( r.origin.x ), oy = _mm_set1_ps( r.origin.y ), oz = _mm_set1_ps( r.origin.z );
+  __m128 ix = _mm_set1_ps( inv.x ), iy = _mm_set1_ps( inv.y ), iz = _mm_set1_ps( inv.z );
+  __m128 zero = _mm_setzero_ps(), far_limit = _mm_set1_ps( max_dist ), invalid = _mm_set1_ps( INVALID );
+
+  for( ; c < padded; c += 4 )
+  {
+    __m128 tx1 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( &boxes.min_x[c] ), ox ), ix );
+    __m128 tx2 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( &boxes.max_x[c] ), ox ), ix );
+    __m128 ty1 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( &boxes.min_y[c] ), oy ), iy );
+    __m128 ty2 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( &boxes.max_y[c] ), oy ), iy );
+    __m128 tz1 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( &boxes.min_z[c] ), oz ), iz );
+    __m128 tz2 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( &boxes.max_z[c] ), oz ), iz );
+
+    __m128 tnear = _mm_max_ps( _mm_max_ps( _mm_min_ps( tx1, tx2 ), _mm_min_ps( ty1, ty2 ) ), _mm_max_ps( _mm_min_ps( tz1, tz2 ), zero ) );
+    __m128 tfar = _mm_min_ps( _mm_min_ps( _mm_max_ps( tx1, tx2 ), _mm_max_ps( ty1, ty2 ) ), _mm_min_ps( _mm_max_ps( tz1, tz2 ), far_limit ) );
+
+    __m128 hit = _mm_cmple_ps( tnear, tfar );
+
+    _mm_storeu_ps( &dist[c], _mm_or_ps( _mm_and_ps( hit, tnear ), _mm_andnot_ps( hit, invalid ) ) );
+    hits[c >> 5] |= unsigned( _mm_movemask_ps( hit ) ) << ( c & 31 );
+  }
+#else
+  for( ; c < padded; ++c )
+  {
+    float tx1 = ( boxes.min_x[c] - r.origin.x ) * inv.x, tx2 = ( boxes.max_x[c] - r.origin.x ) * inv.x;
+    float ty1 = ( boxes.min_y[c] - r.origin.y ) * inv.y, ty2 = ( boxes.max_y[c] - r.origin.y ) * inv.y;
+    float tz1 = ( boxes.min_z[c] - r.origin.z ) * inv.z, tz2 = ( boxes.max_z[c] - r.origin.z ) * inv.z;
+
+    float tnear = std::max( std::max( std::min( tx1, tx2 ), std::min( ty1, ty2 ) ), std::max( std::min( tz1, tz2 ), 0.0f ) );
+    float tfar = std::min( std::min( std::max( tx1, tx2 ), std::max( ty1, ty2 ) ), std::min( std::max( tz1, tz2 ), max_dist ) );
+
+    bool hit = tnear <= tfar;
+
+    dist[c] = hit ? tnear : INVALID;
+    hits[c >> 5] |= unsigned( hit ) << ( c & 31 );
+  }
+#endif
+
+  //the padding lanes are inverted boxes, which the min/max slab test can't reject on its own
+  for( unsigned d = size; d < padded; ++d )
+    dist[d] = INVALID;
+
+  return mask_padding( hits, size );
+}
+
+//tests every ray of the packet against every box of the set
+//masks: bit j of masks[i] is set if ray j hits box i
+//dist: entry distance of ray j into box i is at dist[i * 8 + j] (0 if the origin is inside, INVALID on a miss)
+//returns the number of boxes hit by at least one ray
+inline unsigned intersect_ra_packet( const ray_packet& p, const aabb_soa& boxes, std::vector<unsigned char>& masks, std::vector<float>& dist, float max_dist = FLT_MAX )
+{
+  unsigned size = boxes.size();
+  unsigned ray_mask = p.size >= 8 ? 0xff : ( 1u << p.size ) - 1;
+  unsigned num_hits = 0;
+
+  masks.resize( size );
+  dist.resize( size * 8 );
+
+#if defined( __AVX__ )
+  __m256 ox = _mm256_loadu_ps( p.ox ), oy = _mm256_loadu_ps( p.oy ), oz = _mm256_loadu_ps( p.oz );
+  __m256 ix = _mm256_loadu_ps( p.ix ), iy = _mm256_loadu_ps( p.iy ), iz = _mm256_loadu_ps( p.iz );
+  __m256 zero = _mm256_setzero_ps(), far_limit = _mm256_set1_ps( max_dist ), invalid = _mm256_set1_ps( INVALID );
+
+  for( unsigned c = 0; c < size; ++c )
+  {
+    __m256 tx1 = _mm256_mul_ps( _mm256_sub_ps( _mm256_broadcast_ss( &boxes.min_x[c] ), ox ), ix );
+    __m256 tx2 = _mm256_mul_ps( _mm256_sub_ps( _mm256_broadcast_ss( &boxes.max_x[c] ), ox ), ix );
+    __m256 ty1 = _mm256_mul_ps( _mm256_sub_ps( _mm256_broadcast_ss( &boxes.min_y[c] ), oy ), iy );
+    __m256 ty2 = _mm256_mul_ps( _mm256_sub_ps( _mm256_broadcast_ss( &boxes.max_y[c] ), oy ), iy );
+    __m256 tz1 = _mm256_mul_ps( _mm256_sub_ps( _mm256_broadcast_ss( &boxes.min_z[c] ), oz ), iz );
+    __m256 tz2 = _mm256_mul_ps( _mm256_sub_ps( _mm256_broadcast_ss( &boxes.max_z[c] ), oz ), iz );
+
+    __m256 tnear = _mm256_max_ps( _mm256_max_ps( _mm256_min_ps( tx1, tx2 ), _mm256_min_ps( ty1, ty2 ) ), _mm256_max_ps( _mm256_min_ps( tz1, tz2 ), zero ) );
+    __m256 tfar = _mm256_min_ps( _mm256_min_ps( _mm256_max_ps( tx1, tx2 ), _mm256_max_ps( ty1, ty2 ) ), _mm256_min_ps( _mm256_max_ps( tz1, tz2 ), far_limit ) );
+
+    __m256 hit = _mm256_cmp_ps( tnear, tfar, _CMP_LE_OQ );
+
+    _mm256_storeu_ps( &dist[c * 8], _mm256_blendv_ps( invalid, tnear, hit ) );
+    masks[c] = _mm256_movemask_ps( hit ) & ray_mask;
+    num_hits += masks[c] != 0;
+  }
+#elif defined( MYMATH_USE_SSE2 )
+  __m128 zero = _mm_setzero_ps(), far_limit = _mm_set1_ps( max_dist ), invalid = _mm_set1_ps( INVALID );
+
+  for( unsigned c = 0; c < size; ++c )
+  {
+    __m128 minx = _mm_set1_ps( boxes.min_x[c] ), miny = _mm_set1_ps( boxes.min_y[c] ), minz = _mm_set1_ps( boxes.min_z[c] );
+    __m128 maxx = _mm_set1_ps( boxes.max_x[c] ), maxy = _mm_set1_ps( boxes.max_y[c] ), maxz = _mm_set1_ps( boxes.max_z[c] );
+    unsigned mask = 0;
+
+    //two halves of the packet, skip the second one for 4 wide packets
+    for( unsigned g = 0; g < p.size; g += 4 )
+    {
+      __m128 ox = _mm_loadu_ps( p.ox + g ), oy = _mm_loadu_ps( p.oy + g ), oz = _mm_loadu_ps( p.oz + g );
+      __m128 ix = _mm_loadu_ps( p.ix + g ), iy = _mm_loadu_ps( p.iy + g ), iz = _mm_loadu_ps( p.iz + g );
+
+      __m128 tx1 = _mm_mul_ps( _mm_sub_ps( minx, ox ), ix ), tx2 = _mm_mul_ps( _mm_sub_ps( maxx, ox ), ix );
+      __m128 ty1 = _mm_mul_ps( _mm_sub_ps( miny, oy ), iy ), ty2 = _mm_mul_ps( _mm_sub_ps( maxy, oy ), iy );
+      __m128 tz1 = _mm_mul_ps( _mm_sub_ps( minz, oz ), iz ), tz2 = _mm_mul_ps( _mm_sub_ps( maxz, oz ), iz );
+
+      __m128 tnear = _mm_max_ps( _mm_max_ps( _mm_min_ps( tx1, tx2 ), _mm_min_ps( ty1, ty2 ) ), _mm_max_ps( _mm_min_ps( tz1, tz2 ), zero ) );
+      __m128 tfar = _mm_min_ps( _mm_min_ps( _mm_max_ps( tx1, tx2 ), _mm_max_ps( ty1, ty2 ) ), _mm_min_ps( _mm_max_ps( tz1, tz2 ), far_limit ) );
+
+      __m128 hit = _mm_cmple_ps( tnear, tfar );
+
+      _mm_storeu_ps( &dist[c * 8 + g], _mm_or_ps( _mm_and_ps( hit, tnear ), _mm_andnot_ps( hit, invalid ) ) );
+      mask |= unsigned( _mm_movemask_ps( hit ) ) << g;
+    }
+
+    masks[c] = mask & ray_mask;
+    num_hits += masks[c] != 0;
+  }
+#else
+  for( unsigned c = 0; c < size; ++c )
+  {
+    unsigned mask = 0;
+
+    for( unsigned j = 0; j < p.size; ++j )
+    {
+      float tx1 = ( boxes.min_x[c] - p.ox[j] ) * p.ix[j], tx2 = ( boxes.max_x[c] - p.ox[j] ) * p.ix[j];
+      float ty1 = ( boxes.min_y[c] - p.oy[j] ) * p.iy[j], ty2 = ( boxes.max_y[c] - p.oy[j] ) * p.iy[j];
+      float tz1 = ( boxes.min_z[c] - p.oz[j] ) * p.iz[j], tz2 = ( boxes.max_z[c] - p.oz[j] ) * p.iz[j];
+
+      float tnear = std::max( std::max( std::min( tx1, tx2 ), std::min( ty1, ty2 ) ), std::max( std::min( tz1, tz2 ), 0.0f ) );
+      float tfar = std::min( std::min( std::max( tx1, tx2 ), std::max( ty1, ty2 ) ), std::min( std::max( tz1, tz2 ), max_dist ) );
+
+      bool hit = tnear <= tfar;
+
+      dist[c * 8 + j] = hit ? tnear : INVALID;
+      mask |= unsigned( hit ) << j;
+    }
+
+    masks[c] = mask;
+    num_hits += mask != 0;
+  }
+#endif
+
+  //lanes of unused rays
+  for( unsigned c = 0; c < size; ++c )
+    for( unsigned j = p.size; j < 8; ++j )
+      dist[c * 8 + j] = INVALID;
+
+  return num_hits;
+}
+
+//a set of obbs stored as structure of arrays, padded to a multiple of 8
+class obb_soa
+{
+  unsigned count;
+public:
+  std::vector<float> center[3]; //x, y, z
+  std::vector<float> extents[3];
+  std::vector<float> axes[3][3]; //axes[i][k]: component k of axis i
+
+  unsigned size() const
+  {
+    return count;
+  }
+
+  unsigned padded_size() const
+  {
+    return center[0].size();
+  }
+
+  void resize( unsigned n )
+  {
+    unsigned padded = ( n + 7 ) & ~7u;
+
+    //shrinking has to reset the now unused lanes
+    for( unsigned c = n; c < count; ++c )
+      set( c, obb() );
+
+    count = n;
+
+    for( int i = 0; i < 3; ++i )
+    {
+      center[i].resize( padded, 0 );
+      extents[i].resize( padded, 0 );
+
+      for( int k = 0; k < 3; ++k )
+        axes[i][k].resize( padded, float( i == k ) );
+    }
+  }
+
+  void reserve( unsigned n )
+  {
+    unsigned padded = ( n + 7 ) & ~7u;
+
+    for( int i = 0; i < 3; ++i )
+    {
+      center[i].reserve( padded );
+      extents[i].reserve( padded );
+
+      for( int k = 0; k < 3; ++k )
+        axes[i][k].reserve( padded );
+    }
+  }
+
+  void clear()
+  {
+    count = 0;
+
+    for( int i = 0; i < 3; ++i )
+    {
+      center[i].clear();
+      extents[i].clear();
+
+      for( int k = 0; k < 3; ++k )
+        axes[i][k].clear();
+    }
+  }
+
+  void set( unsigned idx, const obb& o )
+  {
+    for( int i = 0; i < 3; ++i )
+    {
+      center[i][idx] = o.center[i];
+      extents[i][idx] = o.extents[i];
+
+      for( int k = 0; k < 3; ++k )
+        axes[i][k][idx] = o.axes[i][k];
+    }
+  }
+
+  obb get( unsigned idx ) const
+  {
+    obb o;
+
+    for( int i = 0; i < 3; ++i )
+    {
+      o.center[i] = center[i][idx];
+      o.extents[i] = extents[i][idx];
+
+      for( int k = 0; k < 3; ++k )
+        o.axes[i][k] = axes[i][k][idx];
+    }
+
+    return o;
+  }
+
+  void push_back( const obb& o )
+  {
+    resize( count + 1 );
+    set( count - 1, o );
+  }
+
+  obb_soa() : count( 0 )
+  {
+  }
+};
+
+//tests one ray against every obb of the set, the ray is rotated into the frame of each box in the registers
+//hits: bit i of hits[i / 32] is set if box i is hit
+//dist: entry distance along the ray for every box (0 if the origin is inside, INVALID on a miss)
+//returns the number of boxes hit
+inline unsigned intersect_rb_batch( const ray& r, const obb_soa& boxes, std::vector<unsigned>& hits, std::vector<float>& dist, float max_dist = FLT_MAX )
+{
+  unsigned size = boxes.size();
+  unsigned padded = boxes.padded_size();
+
+  hits.assign( ( padded + 31 ) / 32, 0 );
+  dist.resize( padded );
+
+  //smallest direction component that still gets a real reciprocal, like get_safe_inv_dir
+  const float min_dir = mm::epsilon * mm::epsilon;
+  unsigned c = 0;
+
+#if defined( __AVX__ )
+  __m256 ox = _mm256_set1_ps( r.origin.x ), oy = _mm256_set1_ps( r.origin.y ), oz = _mm256_set1_ps( r.origin.z );
+  __m256 rx = _mm256_set1_ps( r.direction.x ), ry = _mm256_set1_ps( r.direction.y ), rz = _mm256_set1_ps( r.direction.z );
+  __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps( 1 ), far_limit = _mm256_set1_ps( max_dist ), invalid = _mm256_set1_ps( INVALID );
+  __m256 sign_mask = _mm256_set1_ps( -0.0f ), tiny = _mm256_set1_ps( min_dir );
+
+  for( ; c < padded; c += 8 )
+  {
+    __m256 dx = _mm256_sub_ps( ox, _mm256_loadu_ps( &boxes.center[0][c] ) );
+    __m256 dy = _mm256_sub_ps( oy, _mm256_loadu_ps( &boxes.center[1][c] ) );
+    __m256 dz = _mm256_sub_ps( oz, _mm256_loadu_ps( &boxes.center[2][c] ) );
 
-    mm::vec3 e = b->k - b->m;
-    mm::vec3 f = b->l - b->m;
+    __m256 tnear = zero, tfar = far_limit;
 
-    mm::vec3 g = a->origin - b->m;
+    for( int i = 0; i < 3; ++i )
+    {
+      __m256 ax = _mm256_loadu_ps( &boxes.axes[i][0][c] );
+      __m256 ay = _mm256_loadu_ps( &boxes.axes[i][1][c] );
+      __m256 az = _mm256_loadu_ps( &boxes.axes[i][2][c] );
+      __m256 e = _mm256_loadu_ps( &boxes.extents[i][c] );
+
+      __m256 o = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( dx, ax ), _mm256_mul_ps( dy, ay ) ), _mm256_mul_ps( dz, az ) );
+      __m256 d = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( rx, ax ), _mm256_mul_ps( ry, ay ) ), _mm256_mul_ps( rz, az ) );
+
+      //keep the sign, clamp the magnitude
+      d = _mm256_or_ps( _mm256_max_ps( _mm256_andnot_ps( sign_mask, d ), tiny ), _mm256_and_ps( sign_mask, d ) );
+      __m256 inv = _mm256_div_ps( one, d );
+
+      __m256 t1 = _mm256_mul_ps( _mm256_sub_ps( _mm256_xor_ps( e, sign_mask ), o ), inv );
+      __m256 t2 = _mm256_mul_ps( _mm256_sub_ps( e, o ), inv );
 
-    //apply barycentric triangle math
-    float t = 1.0f / mm::dot( mm::cross( a->direction, f ), e );
-    mm::vec3 tkl = t * mm::vec3( mm::dot( mm::cross( g, e ), f ),
-      mm::dot( mm::cross( a->direction, f ), g ),
-      mm::dot( mm::cross( g, e ), a->direction ) );
+      tnear = _mm256_max_ps( tnear, _mm256_min_ps( t1, t2 ) );
+      tfar = _mm256_min_ps( tfar, _mm256_max_ps( t1, t2 ) );
+    }
+
+    __m256 hit = _mm256_cmp_ps( tnear, tfar, _CMP_LE_OQ );
 
-    //barycentric coordinate check
-    //if between 0...1 the point is inside
-    return tkl.y > 0 && tkl.z > 0 && ( tkl.y + tkl.z ) < 1;
+    _mm256_storeu_ps( &dist[c], _mm256_blendv_ps( invalid, tnear, hit ) );
+    hits[c >> 5] |= unsigned( _mm256_movemask_ps( hit ) ) << ( c & 31 );
   }
+#elif defined( MYMATH_USE_SSE2 )
+  __m128 ox = _mm_set1_ps( r.origin.x ), oy = _mm_set1_ps( r.origin.y ), oz = _mm_set1_ps( r.origin.z );
+  __m128 rx = _mm_set1_ps( r.direction.x ), ry = _mm_set1_ps( r.direction.y ), rz = _mm_set1_ps( r.direction.z );
+  __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps( 1 ), far_limit = _mm_set1_ps( max_dist ), invalid = _mm_set1_ps( INVALID );
+  __m128 sign_mask = _mm_set1_ps( -0.0f ), tiny = _mm_set1_ps( min_dir );
 
-  static mm::vec2 intersect_rt( shape* aa, shape* bb )
+  for( ; c < padded; c += 4 )
   {
-    auto a = static_cast<ray*>( aa );
-    auto b = static_cast<triangle*>( bb );
+    __m128 dx = _mm_sub_ps( ox, _mm_loadu_ps( &boxes.center[0][c] ) );
+    __m128 dy = _mm_sub_ps( oy, _mm_loadu_ps( &boxes.center[1][c] ) );
+    __m128 dz = _mm_sub_ps( oz, _mm_loadu_ps( &boxes.center[2][c] ) );
+
+    __m128 tnear = zero, tfar = far_limit;
+
+    for( int i = 0; i < 3; ++i )
+    {
+      __m128 ax = _mm_loadu_ps( &boxes.axes[i][0][c] );
+      __m128 ay = _mm_loadu_ps( &boxes.axes[i][1][c] );
+      __m128 az = _mm_loadu_ps( &boxes.axes[i][2][c] );
+      __m128 e = _mm_loadu_ps( &boxes.extents[i][c] );
+
+      __m128 o = _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, ax ), _mm_mul_ps( dy, ay ) ), _mm_mul_ps( dz, az ) );
+      __m128 d = _mm_add_ps( _mm_add_ps( _mm_mul_ps( rx, ax ), _mm_mul_ps( ry, ay ) ), _mm_mul_ps( rz, az ) );
+
+      d = _mm_or_ps( _mm_max_ps( _mm_andnot_ps( sign_mask, d ), tiny ), _mm_and_ps( sign_mask, d ) );
+      __m128 inv = _mm_div_ps( one, d );
+
+      __m128 t1 = _mm_mul_ps( _mm_sub_ps( _mm_xor_ps( e, sign_mask ), o ), inv );
+      __m128 t2 = _mm_mul_ps( _mm_sub_ps( e, o ), inv );
+
+      tnear = _mm_max_ps( tnear, _mm_min_ps( t1, t2 ) );
+      tfar = _mm_min_ps( tfar, _mm_max_ps( t1, t2 ) );
+    }
+
+    __m128 hit = _mm_cmple_ps( tnear, tfar );
 
-    //klm
-    //TODO http://www.scratchapixel.com/lessons/3d-basic-rendering/ray-tracing-rendering-a-triangle/ray-triangle-intersection-geometric-solution
+    _mm_storeu_ps( &dist[c], _mm_or_ps( _mm_and_ps( hit, tnear ), _mm_andnot_ps( hit, invalid ) ) );
+    hits[c >> 5] |= unsigned( _mm_movemask_ps( hit ) ) << ( c & 31 );
   }
+#else
+  for( ; c < padded; ++c )
+  {
+    mm::vec3 d = r.origin - mm::vec3( boxes.center[0][c], boxes.center[1][c], boxes.center[2][c] );
+    float tnear = 0, tfar = max_dist;
 
-  static bool is_intersecting_tr( shape* aa, shape* bb )
+    for( int i = 0; i < 3; ++i )
+    {
+      mm::vec3 axis( boxes.axes[i][0][c], boxes.axes[i][1][c], boxes.axes[i][2][c] );
+      float e = boxes.extents[i][c];
+
+      float o = mm::dot( d, axis );
+      float dir = mm::dot( r.direction, axis );
+
+      dir = dir < 0 ? std::min( dir, -min_dir ) : std::max( dir, min_dir );
+      float inv = 1.0f / dir;
+
+      float t1 = ( -e - o ) * inv;
+      float t2 = ( e - o ) * inv;
+
+      tnear = std::max( tnear, std::min( t1, t2 ) );
+      tfar = std::min( tfar, std::max( t1, t2 ) );
+    }
+
+    bool hit = tnear <= tfar;
+
+    dist[c] = hit ? tnear : INVALID;
+    hits[c >> 5] |= unsigned( hit ) << ( c & 31 );
+  }
+#endif
+
+  for( unsigned d = size; d < padded; ++d )
+    dist[d] = INVALID;
+
+  return mask_padding( hits, size );
+}
+
+//a set of spheres stored as structure of arrays, padded to a multiple of 8
+class sphere_soa
+{
+  unsigned count;
+public:
+  std::vector<float> x, y, z, r;
+
+  unsigned size() const
   {
-    return is_intersecting_rt( bb, aa );
+    return count;
   }
 
-  static mm::vec2 intersect_tr( shape* aa, shape* bb )
+  unsigned padded_size() const
   {
-    return intersect_rt( bb, aa );
+    return x.size();
   }
 
-  static bool is_intersecting_rs( shape* aa, shape* bb )
+  void resize( unsigned n )
   {
-    auto a = static_cast<ray*>( aa );
-    auto b = static_cast<sphere*>( bb );
+    unsigned padded = ( n + 7 ) & ~7u;
 
-    mm::vec3 diff = b->get_center() - a->origin;
-    float dist = mm::dot( diff, diff ) - ( b->get_radius() * b->get_radius() );
+    for( unsigned c = n; c < count; ++c )
+      set( c, sphere() );
 
-    if( dist <= 0 )
-      return true;
+    count = n;
 
-    float dist2 = mm::dot( a->direction, diff );
+    x.resize( padded, 0 );
+    y.resize( padded, 0 );
+    z.resize( padded, 0 );
+    r.resize( padded, 0 );
+  }
 
-    if( dist2 >= 0 )
-      return false;
+  void clear()
+  {
+    count = 0;
 
-    return ( dist2 * dist2 - dist ) >= 0;
+    x.clear();
+    y.clear();
+    z.clear();
+    r.clear();
   }
 
-  static mm::vec2 intersect_rs( shape* aa, shape* bb )
-  { //we assume ray dir is a unit vector
-    auto a = static_cast<ray*>( aa );
-    auto b = static_cast<sphere*>( bb );
+  void set( unsigned i, const sphere& s )
+  {
+    mm::vec3 c = s.get_center();
 
-    mm::vec3 x = a->origin - b->get_center();
+    x[i] = c.x;
+    y[i] = c.y;
+    z[i] = c.z;
+    r[i] = s.get_radius();
+  }
 
-    float bbb = mm::dot( a->direction, x ) * 2;
-    float ccc = mm::dot( x, x ) - b->get_radius() * b->get_radius();
+  sphere get( unsigned i ) const
+  {
+    return sphere( mm::vec3( x[i], y[i], z[i] ), r[i] );
+  }
 
-    float sqr = bbb * bbb - 4 * ccc;
+  void push_back( const sphere& s )
+  {
+    resize( count + 1 );
+    set( count - 1, s );
+  }
 
-    if( sqr > 0 )
+  sphere_soa() : count( 0 )
+  {
+  }
+};
+
+//the six frustum planes prepared for the batch culling kernels
+//plane equation: dot(n, p) + d >= 0 is inside
+class batch_frustum
+{
+public:
+  float nx[6], ny[6], nz[6], d[6];
+  //p-vertex octant of each plane, bit 0/1/2 set if the x/y/z component of the normal is negative
+  //(the p-vertex then takes the min of the box on that axis, otherwise the max)
+  unsigned octant[6];
+
+  void set_up( const frustum& f )
+  {
+    for( int c = 0; c < 6; ++c )
     {
-      float root = std::sqrt( sqr );
-      float inv_2a = 0.5f;
+      mm::vec3 n = f.planes[c].get_normal();
 
-      float t1 = ( -bbb - root ) * inv_2a;
-      float t2 = ( -bbb + root ) * inv_2a;
+      nx[c] = n.x;
+      ny[c] = n.y;
+      nz[c] = n.z;
+      d[c] = f.planes[c].get_minus_n_dot_p();
 
-      if( t1 < 0 )
-      {
-        if( t2 < 0 )
-        {
-          return INVALID;
-        }
-        else
-        {
-          return mm::vec2( t2, t1 );
-        }
-      }
-      else
-      {
-        return mm::vec2( t1, t2 );
-      }
+      octant[c] = ( n.x < 0 ? 1 : 0 ) | ( n.y < 0 ? 2 : 0 ) | ( n.z < 0 ? 4 : 0 );
     }
+  }
 
-    return INVALID;
+  void set_up( const mm::mat4& view_proj )
+  {
+    frustum f;
+    f.set_up( view_proj );
+    set_up( f );
   }
 
-  static bool is_intersecting_sr( shape* aa, shape* bb )
+  batch_frustum()
   {
-    return is_intersecting_rs( bb, aa );
   }
 
-  static mm::vec2 intersect_sr( shape* aa, shape* bb )
+  batch_frustum( const frustum& f )
   {
-    return intersect_rs( bb, aa );
+    set_up( f );
   }
 
-  static bool is_intersecting_ra( shape* aa, shape* bb )
+  batch_frustum( const mm::mat4& view_proj )
   {
-    aabb* ab = static_cast<aabb*>( bb );
-    ray* r = static_cast<ray*>( aa );
-    mm::vec3 invR;
+    set_up( view_proj );
+  }
+};
 
-    // compute intersection of ray with all six bbox planes
-#ifdef _DEBUG
-    //in debug mode, pay attention to asserts
-    for( int c = 0; c < 3; ++c )
-    {
-      if( mm::impl::is_eq( r->direction[c], 0 ) )
-      {
-        invR[c] = FLT_MAX;
-      }
-      else
-      {
-        invR[c] = 1.0f / r->direction[c];
-      }
-    }
+//the code path cull_aabb_batch, cull_sphere_batch and project_aabb_batch are built with, they have no avx version
+#if defined( MYMATH_USE_SSE2 )
+const char* const cull_batch_variant = "sse2";
 #else
-    //in release mode we dgaf about div by zero
-    invR = 1.0f / r->direction;
+const char* const cull_batch_variant = "scalar";
 #endif
 
-    mm::vec3 tbot = invR * ( ab->min - r->origin );
-    mm::vec3 ttop = invR * ( ab->max - r->origin );
+//culls every box of the set against the frustum
+//last_plane: per box index of the plane that rejected it last time, tested first (plane coherency)
+//visible: bit i of visible[i / 32] is set if box i is inside or intersects the frustum
+//returns the number of visible boxes
+inline unsigned cull_aabb_batch( const batch_frustum& f, const aabb_soa& boxes, std::vector<unsigned char>& last_plane, std::vector<unsigned>& visible )
+{
+  unsigned size = boxes.size();
+  unsigned padded = boxes.padded_size();
 
-    // re-order intersections to find smallest and largest on each axis
-    mm::vec3 tmin = mm::min( ttop, tbot );
-    mm::vec3 tmax = mm::max( ttop, tbot );
+  visible.assign( ( padded + 31 ) / 32, 0 );
 
-    // find the largest tmin and the smallest tmax
-    float largest_tmin = mm::max( mm::max( tmin.x, tmin.y ), mm::max( tmin.x, tmin.z ) );
-    float smallest_tmax = mm::min( mm::min( tmax.x, tmax.y ), mm::min( tmax.x, tmax.z ) );
+  if( last_plane.size() < padded )
+    last_plane.resize( padded, 0 );
 
-    return smallest_tmax > largest_tmin ? true : false;
+  //per plane p-vertex source arrays
+  const float* px[6], *py[6], *pz[6];
+
+  for( int p = 0; p < 6; ++p )
+  {
+    px[p] = f.octant[p] & 1 ? boxes.min_x.data() : boxes.max_x.data();
+    py[p] = f.octant[p] & 2 ? boxes.min_y.data() : boxes.max_y.data();
+    pz[p] = f.octant[p] & 4 ? boxes.min_z.data() : boxes.max_z.data();
   }
 
-  static mm::vec2 intersect_ra( shape* aa, shape* bb )
+#ifdef MYMATH_USE_SSE2
+  __m128 zero = _mm_setzero_ps();
+
+  for( unsigned c = 0; c < padded; c += 4 )
   {
-    aabb* ab = static_cast<aabb*>( bb );
-    ray* r = static_cast<ray*>( aa );
-    mm::vec3 invR;
+    unsigned char* lp = &last_plane[c];
 
-    // compute intersection of ray with all six bbox planes
-#ifdef _DEBUG
-    //in debug mode, pay attention to asserts
-    for( int c = 0; c < 3; ++c )
+    //first try the plane that rejected each lane last time
+    __m128 cnx = _mm_setr_ps( f.nx[lp[0]], f.nx[lp[1]], f.nx[lp[2]], f.nx[lp[3]] );
+    __m128 cny = _mm_setr_ps( f.ny[lp[0]], f.ny[lp[1]], f.ny[lp[2]], f.ny[lp[3]] );
+    __m128 cnz = _mm_setr_ps( f.nz[lp[0]], f.nz[lp[1]], f.nz[lp[2]], f.nz[lp[3]] );
+    __m128 cd = _mm_setr_ps( f.d[lp[0]], f.d[lp[1]], f.d[lp[2]], f.d[lp[3]] );
+
+    __m128 sx = _mm_cmplt_ps( cnx, zero ), sy = _mm_cmplt_ps( cny, zero ), sz = _mm_cmplt_ps( cnz, zero );
+    __m128 vx = _mm_or_ps( _mm_and_ps( sx, _mm_loadu_ps( &boxes.min_x[c] ) ), _mm_andnot_ps( sx, _mm_loadu_ps( &boxes.max_x[c] ) ) );
+    __m128 vy = _mm_or_ps( _mm_and_ps( sy, _mm_loadu_ps( &boxes.min_y[c] ) ), _mm_andnot_ps( sy, _mm_loadu_ps( &boxes.max_y[c] ) ) );
+    __m128 vz = _mm_or_ps( _mm_and_ps( sz, _mm_loadu_ps( &boxes.min_z[c] ) ), _mm_andnot_ps( sz, _mm_loadu_ps( &boxes.max_z[c] ) ) );
+
+    __m128 dist = _mm_add_ps( _mm_add_ps( _mm_mul_ps( cnx, vx ), _mm_mul_ps( cny, vy ) ), _mm_add_ps( _mm_mul_ps( cnz, vz ), cd ) );
+    unsigned out = _mm_movemask_ps( _mm_cmplt_ps( dist, zero ) );
+
+    for( int p = 0; p < 6 && out != 0xf; ++p )
     {
-      if( mm::impl::is_eq( r->direction[c], 0 ) )
-      {
-        invR[c] = FLT_MAX;
-      }
-      else
+      dist = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_set1_ps( f.nx[p] ), _mm_loadu_ps( px[p] + c ) ),
+                                     _mm_mul_ps( _mm_set1_ps( f.ny[p] ), _mm_loadu_ps( py[p] + c ) ) ),
+                         _mm_add_ps( _mm_mul_ps( _mm_set1_ps( f.nz[p] ), _mm_loadu_ps( pz[p] + c ) ),
+                                     _mm_set1_ps( f.d[p] ) ) );
+
+      unsigned rejected = _mm_movemask_ps( _mm_cmplt_ps( dist, zero ) ) & ~out;
+
+      for( unsigned l = 0; l < 4; ++l )
+        if( rejected & ( 1u << l ) )
+          lp[l] = p;
+
+      out |= rejected;
+    }
+
+    visible[c >> 5] |= ( ~out & 0xf ) << ( c & 31 );
+  }
+#else
+  for( unsigned c = 0; c < padded; ++c )
+  {
+    unsigned char& lp = last_plane[c];
+
+    bool out = f.nx[lp] * px[lp][c] + f.ny[lp] * py[lp][c] + f.nz[lp] * pz[lp][c] + f.d[lp] < 0;
+
+    for( int p = 0; p < 6 && !out; ++p )
+    {
+      if( f.nx[p] * px[p][c] + f.ny[p] * py[p][c] + f.nz[p] * pz[p][c] + f.d[p] < 0 )
       {
-        invR[c] = 1.0f / r->direction[c];
+        lp = p;
+        out = true;
       }
     }
-#else
-    //in release mode we dgaf about div by zero
-    invR = 1.0f / r->direction;
+
+    visible[c >> 5] |= unsigned( !out ) << ( c & 31 );
+  }
 #endif
 
-    mm::vec3 tbot = invR * ( ab->min - r->origin );
-    mm::vec3 ttop = invR * ( ab->max - r->origin );
+  return mask_padding( visible, size );
+}
 
-    // re-order intersections to find smallest and largest on each axis
-    mm::vec3 tmin = mm::min( ttop, tbot );
-    mm::vec3 tmax = mm::max( ttop, tbot );
+//culls every sphere of the set against the frustum
+//same outputs as cull_aabb_batch
+inline unsigned cull_sphere_batch( const batch_frustum& f, const sphere_soa& spheres, std::vector<unsigned char>& last_plane, std::vector<unsigned>& visible )
+{
+  unsigned size = spheres.size();
+  unsigned padded = spheres.padded_size();
 
-    // find the largest tmin and the smallest tmax
-    float largest_tmin = mm::max( mm::max( tmin.x, tmin.y ), mm::max( tmin.x, tmin.z ) );
-    float smallest_tmax = mm::min( mm::min( tmax.x, tmax.y ), mm::min( tmax.x, tmax.z ) );
+  visible.assign( ( padded + 31 ) / 32, 0 );
 
-    return smallest_tmax > largest_tmin ? ( largest_tmin >= 0 ? mm::vec2( largest_tmin, smallest_tmax ) : mm::vec2( smallest_tmax, largest_tmin ) ) : INVALID;
-  }
+  if( last_plane.size() < padded )
+    last_plane.resize( padded, 0 );
 
-  static bool is_intersecting_ar( shape* aa, shape* bb )
+#ifdef MYMATH_USE_SSE2
+  for( unsigned c = 0; c < padded; c += 4 )
   {
-    return is_intersecting_ra( bb, aa );
-  }
+    unsigned char* lp = &last_plane[c];
 
-  static mm::vec2 intersect_ar( shape* aa, shape* bb )
-  {
-    return intersect_ra( bb, aa );
-  }
+    __m128 x = _mm_loadu_ps( &spheres.x[c] );
+    __m128 y = _mm_loadu_ps( &spheres.y[c] );
+    __m128 z = _mm_loadu_ps( &spheres.z[c] );
+    __m128 neg_r = _mm_sub_ps( _mm_setzero_ps(), _mm_loadu_ps( &spheres.r[c] ) );
 
-  static bool is_intersecting_rp( shape* aa, shape* bb )
-  {
-    auto a = static_cast<ray*>( aa );
-    auto b = static_cast<plane*>( bb );
+    __m128 cnx = _mm_setr_ps( f.nx[lp[0]], f.nx[lp[1]], f.nx[lp[2]], f.nx[lp[3]] );
+    __m128 cny = _mm_setr_ps( f.ny[lp[0]], f.ny[lp[1]], f.ny[lp[2]], f.ny[lp[3]] );
+    __m128 cnz = _mm_setr_ps( f.nz[lp[0]], f.nz[lp[1]], f.nz[lp[2]], f.nz[lp[3]] );
+    __m128 cd = _mm_setr_ps( f.d[lp[0]], f.d[lp[1]], f.d[lp[2]], f.d[lp[3]] );
 
-    float denom = mm::dot( a->direction, b->get_normal() );
+    __m128 dist = _mm_add_ps( _mm_add_ps( _mm_mul_ps( cnx, x ), _mm_mul_ps( cny, y ) ), _mm_add_ps( _mm_mul_ps( cnz, z ), cd ) );
+    unsigned out = _mm_movemask_ps( _mm_cmplt_ps( dist, neg_r ) );
 
-    if( !mm::impl::is_eq( denom, 0.0f ) )
+    for( int p = 0; p < 6 && out != 0xf; ++p )
     {
-      float t = mm::dot( b->get_point() - a->origin, b->get_normal() );
-      float tmp = t * denom;
+      dist = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_set1_ps( f.nx[p] ), x ), _mm_mul_ps( _mm_set1_ps( f.ny[p] ), y ) ),
+                         _mm_add_ps( _mm_mul_ps( _mm_set1_ps( f.nz[p] ), z ), _mm_set1_ps( f.d[p] ) ) );
 
-      if( tmp > 0.0f )
-      {
-        return true;
-      }
+      unsigned rejected = _mm_movemask_ps( _mm_cmplt_ps( dist, neg_r ) ) & ~out;
+
+      for( unsigned l = 0; l < 4; ++l )
+        if( rejected & ( 1u << l ) )
+          lp[l] = p;
+
+      out |= rejected;
     }
 
-    return false;
+    visible[c >> 5] |= ( ~out & 0xf ) << ( c & 31 );
   }
-
-  static mm::vec2 intersect_rp( shape* aa, shape* bb )
+#else
+  for( unsigned c = 0; c < padded; ++c )
   {
-    auto a = static_cast<ray*>( aa );
-    auto b = static_cast<plane*>( bb );
+    unsigned char& lp = last_plane[c];
+    float x = spheres.x[c], y = spheres.y[c], z = spheres.z[c], r = spheres.r[c];
 
-    float denom = mm::dot( a->direction, b->get_normal() );
+    bool out = f.nx[lp] * x + f.ny[lp] * y + f.nz[lp] * z + f.d[lp] < -r;
 
-    if( !mm::impl::is_eq( denom, 0.0f ) )
+    for( int p = 0; p < 6 && !out; ++p )
     {
-      float t = mm::dot( b->get_point() - a->origin, b->get_normal() );
-      float tmp = t * denom;
-
-      if( tmp > 0.0f )
+      if( f.nx[p] * x + f.ny[p] * y + f.nz[p] * z + f.d[p] < -r )
       {
-        return t / denom;
+        lp = p;
+        out = true;
       }
     }
 
-    return INVALID;
+    visible[c >> 5] |= unsigned( !out ) << ( c & 31 );
   }
+#endif
 
-  static bool is_intersecting_pr( shape* aa, shape* bb )
+  return mask_padding( visible, size );
+}
+
+//projects a box with the (view) projection matrix m, the part of it in front of the near plane is bounded:
+//its corners there, and the points where its edges cross the near plane
+//x and y come out in [0...1] window coordinates, z is the ndc depth
+//a box completely behind the near plane comes out empty
+inline aabb project_aabb( const mm::mat4& m, const aabb& box )
+{
+  //only guards against degenerate matrices, in front of the near plane w is at least the near distance
+  const float min_w = 1e-5f;
+
+  mm::vec4 clip[8];
+  float near_dist[8]; //in front of the near plane if >= 0 (z >= -w)
+
+  for( int p = 0; p < 8; ++p )
   {
-    return is_intersecting_rp( bb, aa );
+    clip[p] = m * mm::vec4( p & 1 ? box.max.x : box.min.x, p & 2 ? box.max.y : box.min.y, p & 4 ? box.max.z : box.min.z, 1 );
+    near_dist[p] = clip[p].z + clip[p].w;
   }
 
-  static mm::vec2 intersect_pr( shape* aa, shape* bb )
+  aabb res;
+  bool any = false;
+
+  auto add = [&]( const mm::vec4& v )
   {
-    return intersect_rp( bb, aa );
+    res.expand( v.xyz * ( 1.0f / std::max( v.w, min_w ) ) );
+    any = true;
+  };
+
+  for( int p = 0; p < 8; ++p )
+  {
+    if( near_dist[p] >= 0 )
+      add( clip[p] );
+
+    //the edges from this corner towards the max side of each axis
+    for( int bit = 1; bit < 8; bit <<= 1 )
+    {
+      int q = p | bit;
+
+      if( q != p && ( near_dist[p] >= 0 ) != ( near_dist[q] >= 0 ) )
+        add( clip[p] + ( clip[q] - clip[p] ) * ( near_dist[p] / ( near_dist[p] - near_dist[q] ) ) );
+    }
   }
+
+  if( !any )
+    return aabb();
+
+  res.min.x = res.min.x * 0.5f + 0.5f;
+  res.min.y = res.min.y * 0.5f + 0.5f;
+  res.max.x = res.max.x * 0.5f + 0.5f;
+  res.max.y = res.max.y * 0.5f + 0.5f;
+
+  return res;
 }
 
-void shape::set_up_intersection()
+//projects every box of the set with the (view) projection matrix m, like project_aabb
+//out: the screen space bounds of each box, x and y in [0...1] window coordinates, z is the ndc depth
+//boxes completely behind the near plane come out empty, boxes that cross it are clipped to it
+inline void project_aabb_batch( const mm::mat4& m, const aabb_soa& boxes, aabb_soa& out )
 {
-  //order doesnt matter
-  _is_on_right_side.set_elements( 6 );
-  _is_on_right_side.add<sphere, plane>( inner::is_on_right_side_sp );
-  _is_on_right_side.add<aabb, plane>( inner::is_on_right_side_ap );
-  _is_on_right_side.add<plane, sphere>( inner::is_on_right_side_ps );
-  _is_on_right_side.add<plane, aabb>( inner::is_on_right_side_pa );
-
-  /////////////
-  _is_intersecting.set_elements( 6 );
-  _is_intersecting.add<aabb, aabb>( inner::is_intersecting_aa );
-  _is_intersecting.add<aabb, sphere>( inner::is_intersecting_as );
-  _is_intersecting.add<aabb, ray>( inner::is_intersecting_ar );
-  _is_intersecting.add<aabb, frustum>( inner::is_intersecting_af );
-  _is_intersecting.add<aabb, plane>( inner::is_intersecting_ap );
-
-  _is_intersecting.add<plane, aabb>( inner::is_intersecting_pa );
-  _is_intersecting.add<plane, sphere>( inner::is_intersecting_ps );
-  _is_intersecting.add<plane, ray>( inner::is_intersecting_pr );
-  _is_intersecting.add<plane, plane>( inner::is_intersecting_pp );
-
-  _is_intersecting.add<sphere, aabb>( inner::is_intersecting_sa );
-  _is_intersecting.add<sphere, sphere>( inner::is_intersecting_ss );
-  _is_intersecting.add<sphere, ray>( inner::is_intersecting_sr );
-  _is_intersecting.add<sphere, frustum>( inner::is_intersecting_sf );
-  _is_intersecting.add<sphere, plane>( inner::is_intersecting_sp );
-
-  _is_intersecting.add<frustum, aabb>( inner::is_intersecting_fa );
-  _is_intersecting.add<frustum, sphere>( inner::is_intersecting_fs );
-  //_is_intersecting.add<frustum, frustum>( inner::is_intersecting_ff ); //TODO
-
-  _is_intersecting.add<ray, aabb>( inner::is_intersecting_ra );
-  _is_intersecting.add<ray, sphere>( inner::is_intersecting_rs );
-  _is_intersecting.add<ray, triangle>( inner::is_intersecting_rt );
-  _is_intersecting.add<ray, plane>( inner::is_intersecting_rp );
-
-  _is_intersecting.add<triangle, ray>( inner::is_intersecting_tr );
-
-  //order matters
-  _is_inside.set_elements( 6 );
-  _is_inside.add<aabb, aabb>( inner::is_inside_aa );
-  _is_inside.add<aabb, sphere>( inner::is_inside_as );
-  _is_inside.add<sphere, aabb>( inner::is_inside_sa );
-  _is_inside.add<sphere, sphere>( inner::is_inside_ss );
-
-  _intersect.set_elements( 6 );
-  _intersect.add<aabb, ray>( inner::intersect_ar );
-  _intersect.add<ray, aabb>( inner::intersect_ra );
-  _intersect.add<plane, ray>( inner::intersect_pr );
-  _intersect.add<ray, plane>( inner::intersect_rp );
-  _intersect.add<sphere, ray>( inner::intersect_sr );
-  _intersect.add<ray, sphere>( inner::intersect_rs );
-  //_intersect.add<triangle, ray>( inner::intersect_tr ); //TODO
-  //_intersect.add<triangle, ray>( inner::intersect_rt );
-
-  //usage
-  //is_on_the_right_side.go(new aabb(), new sphere());
-
-  is_setup = true;
+  unsigned size = boxes.size();
+  unsigned padded = boxes.padded_size();
+
+  out.resize( size );
+
+#ifdef MYMATH_USE_SSE2
+  __m128 mat[4][4];
+
+  for( int c = 0; c < 4; ++c )
+    for( int d = 0; d < 4; ++d )
+      mat[c][d] = _mm_set1_ps( m[c][d] );
+
+  __m128 half = _mm_set1_ps( 0.5f ), one = _mm_set1_ps( 1 ), zero = _mm_setzero_ps();
+  __m128 max_float = _mm_set1_ps( FLT_MAX ), neg_max_float = _mm_set1_ps( -FLT_MAX ), min_w = _mm_set1_ps( 1e-5f );
+
+  for( unsigned c = 0; c < padded; c += 4 )
+  {
+    __m128 bx[2] = { _mm_loadu_ps( &boxes.min_x[c] ), _mm_loadu_ps( &boxes.max_x[c] ) };
+    __m128 by[2] = { _mm_loadu_ps( &boxes.min_y[c] ), _mm_loadu_ps( &boxes.max_y[c] ) };
+    __m128 bz[2] = { _mm_loadu_ps( &boxes.min_z[c] ), _mm_loadu_ps( &boxes.max_z[c] ) };
+
+    __m128 cx[8], cy[8], cz[8], cw[8], near_dist[8], in_front[8];
+
+    for( int p = 0; p < 8; ++p )
+    {
+      __m128 x = bx[p & 1], y = by[( p >> 1 ) & 1], z = bz[p >> 2];
+
+      cx[p] = _mm_add_ps( _mm_add_ps( _mm_mul_ps( mat[0][0], x ), _mm_mul_ps( mat[1][0], y ) ), _mm_add_ps( _mm_mul_ps( mat[2][0], z ), mat[3][0] ) );
+      cy[p] = _mm_add_ps( _mm_add_ps( _mm_mul_ps( mat[0][1], x ), _mm_mul_ps( mat[1][1], y ) ), _mm_add_ps( _mm_mul_ps( mat[2][1], z ), mat[3][1] ) );
+      cz[p] = _mm_add_ps( _mm_add_ps( _mm_mul_ps( mat[0][2], x ), _mm_mul_ps( mat[1][2], y ) ), _mm_add_ps( _mm_mul_ps( mat[2][2], z ), mat[3][2] ) );
+      cw[p] = _mm_add_ps( _mm_add_ps( _mm_mul_ps( mat[0][3], x ), _mm_mul_ps( mat[1][3], y ) ), _mm_add_ps( _mm_mul_ps( mat[2][3], z ), mat[3][3] ) );
+      near_dist[p] = _mm_add_ps( cz[p], cw[p] );
+      in_front[p] = _mm_cmpge_ps( near_dist[p], zero );
+    }
+
+    __m128 min_x = max_float, min_y = max_float, min_z = max_float;
+    __m128 max_x = neg_max_float, max_y = neg_max_float, max_z = neg_max_float;
+    __m128 any = zero;
+
+    //bounds the lanes of mask, the others may be nan, the masking drops them
+    auto add = [&]( __m128 x, __m128 y, __m128 z, __m128 w, __m128 mask )
+    {
+      __m128 inv_w = _mm_div_ps( one, _mm_max_ps( w, min_w ) );
+      x = _mm_mul_ps( x, inv_w );
+      y = _mm_mul_ps( y, inv_w );
+      z = _mm_mul_ps( z, inv_w );
+
+      min_x = _mm_min_ps( min_x, _mm_or_ps( _mm_and_ps( mask, x ), _mm_andnot_ps( mask, max_float ) ) );
+      min_y = _mm_min_ps( min_y, _mm_or_ps( _mm_and_ps( mask, y ), _mm_andnot_ps( mask, max_float ) ) );
+      min_z = _mm_min_ps( min_z, _mm_or_ps( _mm_and_ps( mask, z ), _mm_andnot_ps( mask, max_float ) ) );
+      max_x = _mm_max_ps( max_x, _mm_or_ps( _mm_and_ps( mask, x ), _mm_andnot_ps( mask, neg_max_float ) ) );
+      max_y = _mm_max_ps( max_y, _mm_or_ps( _mm_and_ps( mask, y ), _mm_andnot_ps( mask, neg_max_float ) ) );
+      max_z = _mm_max_ps( max_z, _mm_or_ps( _mm_and_ps( mask, z ), _mm_andnot_ps( mask, neg_max_float ) ) );
+      any = _mm_or_ps( any, mask );
+    };
+
+    for( int p = 0; p < 8; ++p )
+    {
+      add( cx[p], cy[p], cz[p], cw[p], in_front[p] );
+
+      //the edges from this corner towards the max side of each axis, where they cross the near plane
+      for( int bit = 1; bit < 8; bit <<= 1 )
+      {
+        int q = p | bit;
+
+        if( q == p )
+          continue;
+
+        __m128 crossing = _mm_xor_ps( in_front[p], in_front[q] );
+        __m128 t = _mm_div_ps( near_dist[p], _mm_sub_ps( near_dist[p], near_dist[q] ) );
+
+        add( _mm_add_ps( cx[p], _mm_mul_ps( _mm_sub_ps( cx[q], cx[p] ), t ) ),
+             _mm_add_ps( cy[p], _mm_mul_ps( _mm_sub_ps( cy[q], cy[p] ), t ) ),
+             _mm_add_ps( cz[p], _mm_mul_ps( _mm_sub_ps( cz[q], cz[p] ), t ) ),
+             _mm_add_ps( cw[p], _mm_mul_ps( _mm_sub_ps( cw[q], cw[p] ), t ) ), crossing );
+      }
+    }
+
+    //ndc to window coordinates, boxes that had nothing in front of the near plane stay empty
+    min_x = _mm_or_ps( _mm_and_ps( any, _mm_add_ps( _mm_mul_ps( min_x, half ), half ) ), _mm_andnot_ps( any, max_float ) );
+    min_y = _mm_or_ps( _mm_and_ps( any, _mm_add_ps( _mm_mul_ps( min_y, half ), half ) ), _mm_andnot_ps( any, max_float ) );
+    max_x = _mm_or_ps( _mm_and_ps( any, _mm_add_ps( _mm_mul_ps( max_x, half ), half ) ), _mm_andnot_ps( any, neg_max_float ) );
+    max_y = _mm_or_ps( _mm_and_ps( any, _mm_add_ps( _mm_mul_ps( max_y, half ), half ) ), _mm_andnot_ps( any, neg_max_float ) );
+
+    _mm_storeu_ps( &out.min_x[c], min_x );
+    _mm_storeu_ps( &out.min_y[c], min_y );
+    _mm_storeu_ps( &out.min_z[c], min_z );
+    _mm_storeu_ps( &out.max_x[c], max_x );
+    _mm_storeu_ps( &out.max_y[c], max_y );
+    _mm_storeu_ps( &out.max_z[c], max_z );
+  }
+
+  //the padding lanes have to stay empty
+  for( unsigned c = size; c < padded; ++c )
+    out.set( c, aabb() );
+#else
+  for( unsigned c = 0; c < size; ++c )
+    out.set( c, project_aabb( m, boxes.get( c ) ) );
+#endif
 }
 
 #endif
@@ -0,0 +1,301 @@
+#include "intersection.h"
+#include "benchmark_shapes.h"
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+// Throughput of the queries in intersection.h, as csv on stdout:
+// query,pair,variant,queries,ns_per_query,queries_per_sec,hits
+//
+// Every registered shape pair is timed through the static dispatch (variant "static").
+// The batch kernels of the picking and culling paths are timed against the same queries
+// done one by one (variant "static"), and report "avx", "sse2" or "scalar": the code path each kernel was built with
+// (ray_batch_variant, cull_batch_variant).
+// The inputs are random, but seeded, so runs are comparable. The hits column is there to check that
+// the variants of a query do the same work.
+//
+// Usage: intersection_benchmark [queries per pair] [seed]
+
+using namespace std;
+
+typedef chrono::high_resolution_clock bench_clock;
+
+//shapes per set, small enough to stay in the cache
+const size_t set_size = 4096;
+
+void report( const string& query, const string& pair, const string& variant, size_t num, double ns_per_query, size_t hits )
+{
+  cout << query << "," << pair << "," << variant << "," << num << ","
+       << ns_per_query << "," << 1e9 / ns_per_query << "," << hits << endl;
+}
+
+bool is_hit( bool b )
+{
+  return b;
+}
+
+bool is_hit( const mm::vec2& v )
+{
+  return v.x != float( INVALID );
+}
+
+template<class a, class b, class ret, class q>
+void run_pair( const string& query, const string& name, size_t num, unsigned seed, const q& static_query )
+{
+  rng_type rng( seed );
+
+  vector<a> lhs;
+  vector<b> rhs;
+
+  fill( rng, lhs, set_size );
+  fill( rng, rhs, set_size );
+
+  size_t mask = set_size - 1;
+  size_t hits = 0;
+
+  auto start = bench_clock::now();
+
+  for( size_t c = 0; c < num; ++c )
+    hits += is_hit( static_query( lhs[c & mask], rhs[( c * 7 ) & mask] ) );
+
+  report( query, name, "static", num, get_ns_per_query( start, num ), hits );
+}
+
+//one ray against a set of boxes, as in picking
+void run_ray_aabb( size_t num, unsigned seed )
+{
+  rng_type rng( seed );
+
+  vector<ray> rays;
+  vector<aabb> boxes;
+  fill( rng, rays, set_size );
+  fill( rng, boxes, set_size );
+
+  aabb_soa soa;
+  soa.resize( set_size );
+
+  for( size_t c = 0; c < set_size; ++c )
+    soa.set( c, boxes[c] );
+
+  size_t rounds = ( num + set_size - 1 ) / set_size;
+  size_t hits = 0;
+
+  auto start = bench_clock::now();
+
+  //is_intersecting tests the whole line, the kernel only what is in front of the origin
+  for( size_t c = 0; c < rounds; ++c )
+    for( size_t d = 0; d < set_size; ++d )
+    {
+      mm::vec2 t = intersect( rays[c % set_size], boxes[d] );
+      hits += t.x != float( INVALID ) && std::max( t.x, t.y ) >= 0;
+    }
+
+  report( "is_intersecting", "ray-aabb_set", "static", rounds * set_size, get_ns_per_query( start, rounds * set_size ), hits );
+
+  vector<unsigned> hit_bits;
+  vector<float> dist;
+  hits = 0;
+  start = bench_clock::now();
+
+  for( size_t c = 0; c < rounds; ++c )
+    hits += intersect_ra_batch( rays[c % set_size], soa, hit_bits, dist );
+
+  report( "is_intersecting", "ray-aabb_set", ray_batch_variant, rounds * set_size, get_ns_per_query( start, rounds * set_size ), hits );
+
+  //8 rays at a time against every box
+  size_t packet_rounds = ( rounds + 7 ) / 8;
+  vector<unsigned char> masks;
+  hits = 0;
+  start = bench_clock::now();
+
+  for( size_t c = 0; c < packet_rounds; ++c )
+  {
+    ray_packet p;
+
+    for( int d = 0; d < 8; ++d )
+      p.push_back( rays[( c * 8 + d ) % set_size] );
+
+    intersect_ra_packet( p, soa, masks, dist );
+
+    for( size_t d = 0; d < set_size; ++d )
+      hits += count_bits( masks[d] );
+  }
+
+  report( "is_intersecting", "ray_packet-aabb_set", ray_batch_variant, packet_rounds * 8 * set_size, get_ns_per_query( start, packet_rounds * 8 * set_size ), hits );
+}
+
+void run_ray_obb( size_t num, unsigned seed )
+{
+  rng_type rng( seed );
+
+  vector<ray> rays;
+  vector<obb> boxes;
+  fill( rng, rays, set_size );
+  fill( rng, boxes, set_size );
+
+  obb_soa soa;
+  soa.resize( set_size );
+
+  for( size_t c = 0; c < set_size; ++c )
+    soa.set( c, boxes[c] );
+
+  size_t rounds = ( num + set_size - 1 ) / set_size;
+  size_t hits = 0;
+
+  auto start = bench_clock::now();
+
+  for( size_t c = 0; c < rounds; ++c )
+    for( size_t d = 0; d < set_size; ++d )
+      hits += is_intersecting( rays[c % set_size], boxes[d] );
+
+  report( "is_intersecting", "ray-obb_set", "static", rounds * set_size, get_ns_per_query( start, rounds * set_size ), hits );
+
+  vector<unsigned> hit_bits;
+  vector<float> dist;
+  hits = 0;
+  start = bench_clock::now();
+
+  for( size_t c = 0; c < rounds; ++c )
+    hits += intersect_rb_batch( rays[c % set_size], soa, hit_bits, dist );
+
+  report( "is_intersecting", "ray-obb_set", ray_batch_variant, rounds * set_size, get_ns_per_query( start, rounds * set_size ), hits );
+}
+
+//one frustum against a set of bounds, as in culling
+template<class t, class soa_type, class kernel>
+void run_cull( const string& name, size_t num, unsigned seed, const kernel& cull_batch )
+{
+  rng_type rng( seed );
+
+  vector<frustum> frustums;
+  vector<t> bounds;
+  fill( rng, frustums, set_size );
+  fill( rng, bounds, set_size );
+
+  soa_type soa;
+  soa.resize( set_size );
+
+  for( size_t c = 0; c < set_size; ++c )
+    soa.set( c, bounds[c] );
+
+  size_t rounds = ( num + set_size - 1 ) / set_size;
+  size_t hits = 0;
+
+  auto start = bench_clock::now();
+
+  for( size_t c = 0; c < rounds; ++c )
+    for( size_t d = 0; d < set_size; ++d )
+      hits += is_intersecting( frustums[c % set_size], bounds[d] );
+
+  report( "is_intersecting", name, "static", rounds * set_size, get_ns_per_query( start, rounds * set_size ), hits );
+
+  vector<batch_frustum> batch_frustums( frustums.begin(), frustums.end() );
+  vector<unsigned char> last_plane;
+  vector<unsigned> visible;
+  hits = 0;
+  start = bench_clock::now();
+
+  for( size_t c = 0; c < rounds; ++c )
+    hits += cull_batch( batch_frustums[c % set_size], soa, last_plane, visible );
+
+  report( "is_intersecting", name, cull_batch_variant, rounds * set_size, get_ns_per_query( start, rounds * set_size ), hits );
+}
+
+//screen space bounds of a set of boxes, as in lasso selection
+void run_project_aabb( size_t num, unsigned seed )
+{
+  rng_type rng( seed );
+
+  vector<aabb> boxes;
+  fill( rng, boxes, set_size );
+
+  vector<mm::mat4> matrices( 16 );
+
+  for( auto& m : matrices )
+  {
+    mm::camera<float> cam;
+    cam.pos = get_random_vec3( rng, -10, 10 );
+    cam.rotate( get_random( rng, 0, 2 * mm::pi ), mm::vec3( 0, 1, 0 ) );
+
+    mm::frame<float> fr;
+    fr.set_perspective( mm::radians( get_random( rng, 30, 90 ) ), 16 / 9.0f, 1, 50 );
+
+    m = fr.projection_matrix * cam.get_matrix();
+  }
+
+  aabb_soa soa, out;
+  soa.resize( set_size );
+
+  for( size_t c = 0; c < set_size; ++c )
+    soa.set( c, boxes[c] );
+
+  size_t rounds = ( num + set_size - 1 ) / set_size;
+  size_t hits = 0;
+
+  //the boxes one by one, counting the ones that aren't completely behind the near plane
+  auto start = bench_clock::now();
+
+  for( size_t c = 0; c < rounds; ++c )
+  {
+    const mm::mat4& m = matrices[c % matrices.size()];
+
+    for( size_t d = 0; d < set_size; ++d )
+    {
+      aabb res = project_aabb( m, boxes[d] );
+      hits += res.min.x <= res.max.x;
+    }
+  }
+
+  report( "project", "aabb_set", "static", rounds * set_size, get_ns_per_query( start, rounds * set_size ), hits );
+
+  hits = 0;
+  start = bench_clock::now();
+
+  for( size_t c = 0; c < rounds; ++c )
+  {
+    project_aabb_batch( matrices[c % matrices.size()], soa, out );
+
+    for( size_t d = 0; d < set_size; ++d )
+      hits += out.min_x[d] <= out.max_x[d];
+  }
+
+  report( "project", "aabb_set", cull_batch_variant, rounds * set_size, get_ns_per_query( start, rounds * set_size ), hits );
+}
+
+int main( int argc, char** argv )
+{
+  shape::set_up_intersection();
+
+  size_t num = 1 << 22;
+  unsigned seed = 1337;
+
+  if( argc > 1 )
+    num = stoul( argv[1] );
+
+  if( argc > 2 )
+    seed = stoul( argv[2] );
+
+  cout << "query,pair,variant,queries,ns_per_query,queries_per_sec,hits" << endl;
+
+#define BENCH_PAIR( query, ret, a, b ) \
+  run_pair<a, b, ret>( #query, #a "-" #b, num, seed, []( const a& x, const b& y ) { return query( x, y ); } );
+
+#define BENCH_IS_ON_RIGHT_SIDE( a, b, s ) BENCH_PAIR( is_on_right_side, bool, a, b )
+#define BENCH_IS_INTERSECTING( a, b, s ) BENCH_PAIR( is_intersecting, bool, a, b )
+#define BENCH_IS_INSIDE( a, b, s ) BENCH_PAIR( is_inside, bool, a, b )
+#define BENCH_INTERSECT( a, b, s ) BENCH_PAIR( intersect, mm::vec2, a, b )
+
+  SHAPE_IS_ON_RIGHT_SIDE_PAIRS( BENCH_IS_ON_RIGHT_SIDE )
+  SHAPE_IS_INTERSECTING_PAIRS( BENCH_IS_INTERSECTING )
+  SHAPE_IS_INSIDE_PAIRS( BENCH_IS_INSIDE )
+  SHAPE_INTERSECT_PAIRS( BENCH_INTERSECT )
+
+  run_ray_aabb( num, seed );
+  run_ray_obb( num, seed );
+  run_cull<aabb, aabb_soa>( "frustum-aabb_set", num, seed, cull_aabb_batch );
+  run_cull<sphere, sphere_soa>( "frustum-sphere_set", num, seed, cull_sphere_batch );
+  run_project_aabb( num, seed );
+
+  return 0;
+}
@@ -0,0 +1,187 @@
+#ifndef kd_tree_h
+#define kd_tree_h
+
+#include "intersection.h"
+#include <vector>
+#include <algorithm>
+#include <future>
+#include <thread>
+
+//static k-d tree over points (eg. the vertices of meshes), for nearest point queries
+//the tree is implicit: the points are reordered so that the node of a range is its middle element,
+//with the left subtree before it and the right one after it. big subtrees are built in parallel
+template< class t >
+class kd_tree
+{
+  std::vector<mm::vec3> points;
+  std::vector<t> data;
+  std::vector<unsigned char> axes; //split axis of the node at each index
+
+  static const unsigned parallel_threshold = 1 << 15; //points, below this a subtree is built on the current thread
+
+  //the ranges of the two subtrees are disjoint, so they can be built at the same time
+  void build_recursive( unsigned first, unsigned last, std::vector<unsigned>& order, int parallel_depth )
+  {
+    if( last - first < 2 )
+    {
+      if( last > first )
+        axes[first] = 0;
+
+      return;
+    }
+
+    //split along the largest extent
+    mm::vec3 min( FLT_MAX ), max( -FLT_MAX );
+
+    for( unsigned c = first; c < last; ++c )
+    {
+      min = mm::min( min, points[order[c]] );
+      max = mm::max( max, points[order[c]] );
+    }
+
+    mm::vec3 e = max - min;
+    int axis = e.x > e.y ? ( e.x > e.z ? 0 : 2 ) : ( e.y > e.z ? 1 : 2 );
+    unsigned mid = first + ( last - first ) / 2;
+
+    std::nth_element( order.begin() + first, order.begin() + mid, order.begin() + last, [&]( unsigned a, unsigned b )
+    {
+      return points[a][axis] < points[b][axis];
+    } );
+
+    axes[mid] = axis;
+
+    if( parallel_depth > 0 && last - first > parallel_threshold )
+    {
+      std::future<void> right = std::async( std::launch::async, [&]()
+      {
+        build_recursive( mid + 1, last, order, parallel_depth - 1 );
+      } );
+
+      build_recursive( first, mid, order, parallel_depth - 1 );
+      right.get();
+    }
+    else
+    {
+      build_recursive( first, mid, order, parallel_depth );
+      build_recursive( mid + 1, last, order, parallel_depth );
+    }
+  }
+
+  template< class filter >
+  void nearest_recursive( unsigned first, unsigned last, const mm::vec3& p, float& best_dist2, int& best, const filter& accept ) const
+  {
+    while( first < last )
+    {
+      unsigned mid = first + ( last - first ) / 2;
+      mm::vec3 d = points[mid] - p;
+      float dist2 = mm::dot( d, d );
+
+      if( dist2 < best_dist2 && accept( data[mid] ) )
+      {
+        best_dist2 = dist2;
+        best = mid;
+      }
+
+      //the side of the query point first, the other side only if the splitting plane is closer than the best
+      float diff = p[axes[mid]] - points[mid][axes[mid]];
+      unsigned closer_first = diff < 0 ? first : mid + 1, closer_last = diff < 0 ? mid : last;
+      unsigned farther_first = diff < 0 ? mid + 1 : first, farther_last = diff < 0 ? last : mid;
+
+      nearest_recursive( closer_first, closer_last, p, best_dist2, best, accept );
+
+      if( diff * diff >= best_dist2 )
+        return;
+
+      first = farther_first;
+      last = farther_last;
+    }
+  }
+
+public:
+  bool empty() const
+  {
+    return points.empty();
+  }
+
+  unsigned size() const
+  {
+    return points.size();
+  }
+
+  void clear()
+  {
+    points.clear();
+    data.clear();
+    axes.clear();
+  }
+
+  const mm::vec3& get_point( int i ) const
+  {
+    return points[i];
+  }
+
+  const t& get_data( int i ) const
+  {
+    return data[i];
+  }
+
+  //the data of each point (eg. the object it belongs to) is handed to the query filters
+  void build( const std::vector<mm::vec3>& new_points, const std::vector<t>& new_data )
+  {
+    assert( new_points.size() == new_data.size() );
+
+    points = new_points;
+    axes.resize( points.size() );
+
+    std::vector<unsigned> order( points.size() );
+
+    for( unsigned c = 0; c < order.size(); ++c )
+      order[c] = c;
+
+    //each level of parallel splits doubles the number of threads
+    int parallel_depth = 0;
+    for( unsigned n = std::thread::hardware_concurrency(); n > 1; n >>= 1 )
+      ++parallel_depth;
+
+    build_recursive( 0, points.size(), order, parallel_depth );
+
+    //copy into tree order
+    data.resize( points.size() );
+
+    for( unsigned c = 0; c < order.size(); ++c )
+    {
+      points[c] = new_points[order[c]];
+      data[c] = new_data[order[c]];
+    }
+  }
+
+  //3 floats per vertex (like mesh::vertices), every point gets the same data
+  void build( const float* verts, unsigned num_vertices, const t& d )
+  {
+    std::vector<mm::vec3> new_points( num_vertices );
+
+    for( unsigned c = 0; c < num_vertices; ++c )
+      new_points[c] = mm::vec3( verts[c * 3 + 0], verts[c * 3 + 1], verts[c * 3 + 2] );
+
+    build( new_points, std::vector<t>( num_vertices, d ) );
+  }
+
+  //index of the closest point within max_dist whose data passes accept( data ), -1 if there's none
+  template< class filter >
+  int nearest( const mm::vec3& p, float max_dist, const filter& accept ) const
+  {
+    int best = -1;
+    float best_dist2 = max_dist * max_dist;
+
+    nearest_recursive( 0, points.size(), p, best_dist2, best, accept );
+
+    return best;
+  }
+
+  int nearest( const mm::vec3& p, float max_dist = FLT_MAX ) const
+  {
+    return nearest( p, max_dist, []( const t& ) { return true; } );
+  }
+};
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef lasso_mask_h
+#define lasso_mask_h
+
+#include "intersection.h"
+#include <vector>
+#include <algorithm>
+
+//rasterized coverage of a closed polygon (eg. a freehand lasso) in [0...1] window coordinates
+//the polygon is filled with even-odd scanlines into a grid over its bounds, and the outline is added on top,
+//so thin parts of the lasso still count. rectangles are tested against it in constant time through a summed area table
+class lasso_mask
+{
+public:
+  static const int resolution = 256;
+
+private:
+  mm::vec2 min, max; //bounds of the polygon
+  mm::vec2 cell_size;
+  std::vector<unsigned char> cells;
+  std::vector<unsigned> sums; //(resolution + 1)^2, sums[y][x] is the number of covered cells below and left of (x, y)
+  std::vector<float> crossings; //scratch of the scanline fill
+  bool is_empty;
+
+  unsigned get_sum( int x, int y ) const
+  {
+    return sums[y * ( resolution + 1 ) + x];
+  }
+
+  int get_cell( float p, float min, float size ) const
+  {
+    //clamp as float first, the position may be infinite
+    return int( std::max( 0.0f, std::min( float( resolution - 1 ), ( p - min ) / size ) ) );
+  }
+
+public:
+  bool empty() const
+  {
+    return is_empty;
+  }
+
+  void build( const std::vector<mm::vec2>& polygon )
+  {
+    is_empty = true;
+
+    if( polygon.size() < 3 )
+      return;
+
+    min = mm::vec2( FLT_MAX );
+    max = mm::vec2( -FLT_MAX );
+
+    for( auto& p : polygon )
+    {
+      min = mm::min( min, p );
+      max = mm::max( max, p );
+    }
+
+    if( !( max.x > min.x && max.y > min.y ) )
+      return;
+
+    is_empty = false;
+    cell_size = ( max - min ) / float( resolution );
+    cells.assign( resolution * resolution, 0 );
+
+    //fill the cells whose centers are inside
+    for( int y = 0; y < resolution; ++y )
+    {
+      float sy = min.y + ( y + 0.5f ) * cell_size.y;
+      crossings.clear();
+
+      for( unsigned c = 0; c < polygon.size(); ++c )
+      {
+        const mm::vec2& a = polygon[c];
+        const mm::vec2& b = polygon[( c + 1 ) % polygon.size()];
+
+        //half open, so that vertices on the scanline are only counted once
+        if( ( a.y <= sy ) != ( b.y <= sy ) )
+          crossings.push_back( a.x + ( sy - a.y ) / ( b.y - a.y ) * ( b.x - a.x ) );
+      }
+
+      std::sort( crossings.begin(), crossings.end() );
+
+      for( unsigned c = 0; c + 1 < crossings.size(); c += 2 )
+      {
+        int first = int( std::ceil( ( crossings[c] - min.x ) / cell_size.x - 0.5f ) );
+        int last = int( std::floor( ( crossings[c + 1] - min.x ) / cell_size.x - 0.5f ) );
+
+        for( int x = std::max( first, 0 ); x <= std::min( last, resolution - 1 ); ++x )
+          cells[y * resolution + x] = 1;
+      }
+    }
+
+    //the outline, sampled at half a cell
+    for( unsigned c = 0; c < polygon.size(); ++c )
+    {
+      const mm::vec2& a = polygon[c];
+      const mm::vec2& b = polygon[( c + 1 ) % polygon.size()];
+      mm::vec2 steps = mm::abs( b - a ) / cell_size * 2.0f;
+      int num = int( std::max( steps.x, steps.y ) ) + 1;
+
+      for( int d = 0; d <= num; ++d )
+      {
+        mm::vec2 p = a + ( b - a ) * ( d / float( num ) );
+        cells[get_cell( p.y, min.y, cell_size.y ) * resolution + get_cell( p.x, min.x, cell_size.x )] = 1;
+      }
+    }
+
+    sums.assign( ( resolution + 1 ) * ( resolution + 1 ), 0 );
+
+    for( int y = 0; y < resolution; ++y )
+    {
+      unsigned row = 0;
+
+      for( int x = 0; x < resolution; ++x )
+      {
+        row += cells[y * resolution + x];
+        sums[( y + 1 ) * ( resolution + 1 ) + x + 1] = get_sum( x + 1, y ) + row;
+      }
+    }
+  }
+
+  //does the rectangle [rect_min...rect_max] cover any part of the lasso?
+  bool is_overlapping( const mm::vec2& rect_min, const mm::vec2& rect_max ) const
+  {
+    if( is_empty || rect_max.x < min.x || rect_max.y < min.y || rect_min.x > max.x || rect_min.y > max.y )
+      return false;
+
+    int x0 = get_cell( rect_min.x, min.x, cell_size.x ), x1 = get_cell( rect_max.x, min.x, cell_size.x ) + 1;
+    int y0 = get_cell( rect_min.y, min.y, cell_size.y ), y1 = get_cell( rect_max.y, min.y, cell_size.y ) + 1;
+
+    return get_sum( x1, y1 ) - get_sum( x0, y1 ) - get_sum( x1, y0 ) + get_sum( x0, y0 ) > 0;
+  }
+
+  lasso_mask() : is_empty( true )
+  {
+  }
+};
+
+#endif
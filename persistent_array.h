@@ -0,0 +1,120 @@
+#ifndef persistent_array_h
+#define persistent_array_h
+
+#include <vector>
+#include <memory>
+#include <cassert>
+#include <algorithm>
+
+//array with cheap copies that share their unchanged parts (eg. for keeping every version of a scene)
+//the elements are in fixed size chunks, and the array itself is a shared list of shared chunks
+//copying it copies one pointer. writing copies the list and the chunk it writes to if they are shared,
+//so a version only costs memory for the chunks that changed since the one it was copied from
+template< class t, unsigned chunk_size = 64 >
+class persistent_array
+{
+  typedef std::vector<t> chunk;
+  typedef std::vector< std::shared_ptr<chunk> > chunk_list;
+
+  std::shared_ptr<chunk_list> chunks;
+  unsigned count;
+
+  static unsigned& get_live_chunks()
+  {
+    static unsigned live_chunks = 0;
+    return live_chunks;
+  }
+
+  //counts the chunks alive across every copy
+  static std::shared_ptr<chunk> make_chunk( const chunk& c )
+  {
+    ++get_live_chunks();
+    return std::shared_ptr<chunk>( new chunk( c ), []( chunk * p )
+    {
+      --get_live_chunks();
+      delete p;
+    } );
+  }
+
+  chunk_list& get_chunks_for_write()
+  {
+    if( !chunks )
+      chunks = std::make_shared<chunk_list>();
+    else if( chunks.use_count() > 1 )
+      chunks = std::make_shared<chunk_list>( *chunks );
+
+    return *chunks;
+  }
+
+public:
+  unsigned size() const
+  {
+    return count;
+  }
+
+  //number of chunks in memory, shared ones are counted once
+  static unsigned get_chunk_count()
+  {
+    return get_live_chunks();
+  }
+
+  const t& operator[]( unsigned i ) const
+  {
+    assert( i < count );
+    return ( *( *chunks )[i / chunk_size] )[i % chunk_size];
+  }
+
+  //new elements are default constructed
+  void resize( unsigned n )
+  {
+    chunk_list& l = get_chunks_for_write();
+    unsigned num_chunks = ( n + chunk_size - 1 ) / chunk_size;
+
+    while( l.size() < num_chunks )
+      l.push_back( make_chunk( chunk( chunk_size ) ) );
+
+    l.resize( num_chunks );
+    count = n;
+  }
+
+  void set( unsigned i, const t& v )
+  {
+    assert( i < count );
+
+    chunk_list& l = get_chunks_for_write();
+    std::shared_ptr<chunk>& c = l[i / chunk_size];
+
+    if( c.use_count() > 1 )
+      c = make_chunk( *c );
+
+    ( *c )[i % chunk_size] = v;
+  }
+
+  //calls callback( index ) for every element that may differ between the two arrays
+  //chunks that are shared are skipped without looking at them, so this costs O(chunks + changed chunks * chunk_size)
+  template< class cbk >
+  static void diff( const persistent_array& a, const persistent_array& b, cbk callback )
+  {
+    if( a.chunks == b.chunks )
+      return;
+
+    unsigned num = std::max( a.count, b.count );
+
+    for( unsigned c = 0; c * chunk_size < num; ++c )
+    {
+      bool in_a = c * chunk_size < a.count, in_b = c * chunk_size < b.count;
+
+      if( in_a && in_b && ( *a.chunks )[c] == ( *b.chunks )[c] )
+        continue;
+
+      for( unsigned d = c * chunk_size; d < ( c + 1 ) * chunk_size && d < num; ++d )
+        callback( d );
+    }
+  }
+
+  persistent_array() : count( 0 )
+  {
+  }
+};
+
+#endif
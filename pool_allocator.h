@@ -0,0 +1,142 @@
+#ifndef pool_allocator_h
+#define pool_allocator_h
+
+#include <vector>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+//allocator for lots of small objects of a few different sizes (eg. undo commands)
+//sizes are rounded up to 16 bytes, and each size class is carved out of big blocks and reuses its own freed chunks,
+//so allocating and freeing is a pointer push or pop and the chunks of one class sit next to each other
+//bigger allocations go to the heap. the blocks are only given back when the allocator is destroyed
+class pool_allocator
+{
+  static const size_t granularity = 16; //keeps mm::mat4 and the sse types aligned
+  static const size_t max_pooled_size = 512;
+  static const size_t num_classes = max_pooled_size / granularity;
+  static const size_t block_size = 64 * 1024;
+
+  class free_chunk
+  {
+  public:
+    free_chunk* next;
+  };
+
+  std::vector<void*> blocks;
+  free_chunk* free_lists[num_classes];
+  char* block_top; //the unused rest of the last block
+  char* block_end;
+  size_t live_bytes;
+
+  static size_t get_class( size_t size )
+  {
+    return ( size + granularity - 1 ) / granularity - 1;
+  }
+
+  static void* allocate_aligned( size_t size )
+  {
+    //malloc is at least 16 byte aligned on 64 bit platforms, but not everywhere
+    void* raw = std::malloc( size + granularity );
+
+    if( !raw )
+      throw std::bad_alloc();
+
+    char* aligned = ( char* )( ( size_t( raw ) + granularity ) & ~( granularity - 1 ) );
+    ( ( void** )aligned )[-1] = raw;
+    return aligned;
+  }
+
+  static void free_aligned( void* p )
+  {
+    std::free( ( ( void** )p )[-1] );
+  }
+
+public:
+  void* allocate( size_t size )
+  {
+    if( size == 0 )
+      size = 1;
+
+    live_bytes += size;
+
+    if( size > max_pooled_size )
+      return allocate_aligned( size );
+
+    size_t c = get_class( size );
+
+    if( free_lists[c] )
+    {
+      free_chunk* chunk = free_lists[c];
+      free_lists[c] = chunk->next;
+      return chunk;
+    }
+
+    size_t chunk_size = ( c + 1 ) * granularity;
+
+    if( block_end - block_top < ptrdiff_t( chunk_size ) )
+    {
+      //the rest of the old block is lost, it is less than a chunk
+      blocks.push_back( allocate_aligned( block_size ) );
+      block_top = ( char* )blocks.back();
+      block_end = block_top + block_size;
+    }
+
+    void* res = block_top;
+    block_top += chunk_size;
+    return res;
+  }
+
+  //size has to be the same as when it was allocated
+  void deallocate( void* p, size_t size )
+  {
+    if( !p )
+      return;
+
+    if( size == 0 )
+      size = 1;
+
+    live_bytes -= size;
+
+    if( size > max_pooled_size )
+    {
+      free_aligned( p );
+      return;
+    }
+
+    size_t c = get_class( size );
+    free_chunk* chunk = ( free_chunk* )p;
+    chunk->next = free_lists[c];
+    free_lists[c] = chunk;
+  }
+
+  //bytes that are allocated right now
+  size_t get_live_bytes() const
+  {
+    return live_bytes;
+  }
+
+  //bytes held in blocks, used or not
+  size_t get_reserved_bytes() const
+  {
+    return blocks.size() * block_size;
+  }
+
+  pool_allocator() : block_top( 0 ), block_end( 0 ), live_bytes( 0 )
+  {
+    for( size_t c = 0; c < num_classes; ++c )
+      free_lists[c] = 0;
+  }
+
+  ~pool_allocator()
+  {
+    for( auto& b : blocks )
+      free_aligned( b );
+  }
+
+private:
+  pool_allocator( const pool_allocator& );
+  pool_allocator& operator=( const pool_allocator& );
+};
+
+#endif
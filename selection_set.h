@@ -0,0 +1,150 @@
+#ifndef selection_set_h
+#define selection_set_h
+
+#include <vector>
+#include <cassert>
+
+//the selected objects of a scene, addressed by the slot index of their handles (see slot_map.h)
+//a bitset answers "is this selected" and finds the unselected objects a word at a time,
+//and a list of the selected handles makes going through the selection cost O(selected), not O(scene)
+//the scene tells it which slots hold an object with add() and remove()
+template< class handle >
+class selection_set
+{
+  std::vector<unsigned> live_bits; //bit i is set if slot i holds an object
+  std::vector<unsigned> selected_bits;
+  std::vector<handle> slot_handles; //the handle of the object in each slot
+  std::vector<unsigned> list_pos; //where the handle of each selected slot is in selected
+  std::vector<handle> selected;
+
+  static bool get_bit( const std::vector<unsigned>& bits, unsigned i )
+  {
+    return bits[i >> 5] & ( 1u << ( i & 31 ) );
+  }
+
+  static void set_bit( std::vector<unsigned>& bits, unsigned i, bool value )
+  {
+    if( value )
+      bits[i >> 5] |= 1u << ( i & 31 );
+    else
+      bits[i >> 5] &= ~( 1u << ( i & 31 ) );
+  }
+
+public:
+  typedef typename std::vector<handle>::const_iterator const_iterator;
+
+  //number of selected objects
+  unsigned size() const
+  {
+    return selected.size();
+  }
+
+  bool empty() const
+  {
+    return selected.empty();
+  }
+
+  //the selected handles, in no particular order
+  const_iterator begin() const
+  {
+    return selected.begin();
+  }
+
+  const_iterator end() const
+  {
+    return selected.end();
+  }
+
+  const handle& operator[]( unsigned i ) const
+  {
+    return selected[i];
+  }
+
+  //an object entered the scene, unselected
+  void add( const handle& h )
+  {
+    if( h.index >= slot_handles.size() )
+    {
+      slot_handles.resize( h.index + 1 );
+      list_pos.resize( h.index + 1 );
+      live_bits.resize( ( h.index + 32 ) / 32, 0 );
+      selected_bits.resize( live_bits.size(), 0 );
+    }
+
+    assert( !get_bit( live_bits, h.index ) );
+
+    slot_handles[h.index] = h;
+    set_bit( live_bits, h.index, true );
+  }
+
+  //an object left the scene, it is deselected as well
+  void remove( const handle& h )
+  {
+    deselect( h );
+    set_bit( live_bits, h.index, false );
+    slot_handles[h.index] = handle();
+  }
+
+  bool is_selected( const handle& h ) const
+  {
+    return h.index < slot_handles.size() && get_bit( selected_bits, h.index ) && slot_handles[h.index] == h;
+  }
+
+  void select( const handle& h )
+  {
+    assert( h.index < slot_handles.size() && slot_handles[h.index] == h );
+
+    if( get_bit( selected_bits, h.index ) )
+      return;
+
+    set_bit( selected_bits, h.index, true );
+    list_pos[h.index] = selected.size();
+    selected.push_back( h );
+  }
+
+  void deselect( const handle& h )
+  {
+    if( !is_selected( h ) )
+      return;
+
+    //swap the last one into the hole
+    unsigned pos = list_pos[h.index];
+    selected[pos] = selected.back();
+    list_pos[selected[pos].index] = pos;
+    selected.pop_back();
+
+    set_bit( selected_bits, h.index, false );
+  }
+
+  //O(selected)
+  void clear()
+  {
+    for( auto& h : selected )
+      set_bit( selected_bits, h.index, false );
+
+    selected.clear();
+  }
+
+  //calls callback( handle ) for every object in the scene that isn't selected
+  //whole words of selected or empty slots are skipped at once
+  template< class cbk >
+  void for_each_unselected( cbk callback ) const
+  {
+    for( unsigned c = 0; c < live_bits.size(); ++c )
+    {
+      unsigned word = live_bits[c] & ~selected_bits[c];
+
+      while( word )
+      {
+        unsigned bit = 0;
+        while( !( word & ( 1u << bit ) ) )
+          ++bit;
+
+        callback( slot_handles[c * 32 + bit] );
+        word &= word - 1;
+      }
+    }
+  }
+};
+
+#endif
@@ -1,10 +1,17 @@
 #version 420 core
 
-uniform mat4 mvp;
+uniform mat4 vp;
 
 layout(location=0) in vec4 in_vertex;
 
+//per instance, see object_instance
+layout(location=3) in mat4 in_model; //locations 3 to 6
+layout(location=7) in vec4 in_col;
+
+out vec3 col;
+
 void main()
 {
-  gl_Position = mvp * in_vertex;
+  col = in_col.xyz;
+  gl_Position = vp * in_model * in_vertex;
 }
@@ -0,0 +1,252 @@
+#ifndef slot_map_h
+#define slot_map_h
+
+#include <vector>
+#include <cassert>
+
+//a handle of a slot_map, it doesn't depend on the type of the values, so they can hold handles of each other
+class slot_handle
+{
+public:
+  unsigned index;
+  unsigned generation; //0 is the null handle
+
+  bool is_null() const
+  {
+    return generation == 0;
+  }
+
+  bool operator==( const slot_handle& other ) const
+  {
+    return index == other.index && generation == other.generation;
+  }
+
+  bool operator!=( const slot_handle& other ) const
+  {
+    return !( *this == other );
+  }
+
+  slot_handle( unsigned i = 0, unsigned g = 0 ) : index( i ), generation( g )
+  {
+  }
+};
+
+//densely packed storage with stable handles
+//the values live in one vector (iteration is linear), and removing swaps the last value into the hole
+//a handle is a slot index and a generation: the slot knows where its value is in the dense vector,
+//and a handle to a removed value doesn't match the generation of its slot anymore
+//removed values can be put back under their old handle (eg. undoing a delete), so commands can keep handles
+template< class t >
+class slot_map
+{
+public:
+  typedef slot_handle handle;
+
+private:
+  class slot
+  {
+  public:
+    unsigned dense; //index of the value
+    unsigned generation; //of the value in the slot, or of the last one if it's free
+    unsigned next_generation; //never handed out for this slot yet
+    bool used;
+    bool listed; //in free_slots
+
+    slot() : dense( 0 ), generation( 0 ), next_generation( 1 ), used( false ), listed( false )
+    {
+    }
+  };
+
+  std::vector<t> values;
+  std::vector<unsigned> dense_to_slot;
+  std::vector<slot> slots;
+  std::vector<unsigned> free_slots; //may hold slots that were taken by insert_at since, those are skipped
+
+  void add_free( unsigned s )
+  {
+    if( !slots[s].listed )
+    {
+      slots[s].listed = true;
+      free_slots.push_back( s );
+    }
+  }
+
+  void place( unsigned s, unsigned generation, const t& v )
+  {
+    slot& sl = slots[s];
+    sl.used = true;
+    sl.generation = generation;
+    sl.dense = values.size();
+
+    if( generation >= sl.next_generation )
+      sl.next_generation = generation + 1;
+
+    values.push_back( v );
+    dense_to_slot.push_back( s );
+  }
+
+public:
+  typedef typename std::vector<t>::iterator iterator;
+  typedef typename std::vector<t>::const_iterator const_iterator;
+
+  unsigned size() const
+  {
+    return values.size();
+  }
+
+  bool empty() const
+  {
+    return values.empty();
+  }
+
+  void reserve( unsigned n )
+  {
+    values.reserve( n );
+    dense_to_slot.reserve( n );
+    slots.reserve( n );
+  }
+
+  void clear()
+  {
+    values.clear();
+    dense_to_slot.clear();
+    free_slots.clear();
+
+    //the generations stay, so old handles stay invalid
+    for( unsigned c = 0; c < slots.size(); ++c )
+    {
+      slots[c].used = false;
+      slots[c].listed = false;
+      add_free( c );
+    }
+  }
+
+  //the values in dense order, which changes when something is removed
+  iterator begin()
+  {
+    return values.begin();
+  }
+
+  iterator end()
+  {
+    return values.end();
+  }
+
+  const_iterator begin() const
+  {
+    return values.begin();
+  }
+
+  const_iterator end() const
+  {
+    return values.end();
+  }
+
+  t& operator[]( unsigned dense )
+  {
+    return values[dense];
+  }
+
+  const t& operator[]( unsigned dense ) const
+  {
+    return values[dense];
+  }
+
+  handle get_handle( unsigned dense ) const
+  {
+    unsigned s = dense_to_slot[dense];
+    return handle( s, slots[s].generation );
+  }
+
+  //where the value of a valid handle is in dense order
+  unsigned get_dense( const handle& h ) const
+  {
+    assert( is_valid( h ) );
+    return slots[h.index].dense;
+  }
+
+  //the handle of the value in a slot, null if the slot is free
+  handle get_slot_handle( unsigned index ) const
+  {
+    return index < slots.size() && slots[index].used ? handle( index, slots[index].generation ) : handle();
+  }
+
+  bool is_valid( const handle& h ) const
+  {
+    return h.index < slots.size() && slots[h.index].used && slots[h.index].generation == h.generation && !h.is_null();
+  }
+
+  //0 if the handle is invalid, the pointer is only valid until the next insert or erase
+  t* get( const handle& h )
+  {
+    return is_valid( h ) ? &values[slots[h.index].dense] : 0;
+  }
+
+  const t* get( const handle& h ) const
+  {
+    return is_valid( h ) ? &values[slots[h.index].dense] : 0;
+  }
+
+  handle insert( const t& v )
+  {
+    unsigned s = slots.size();
+
+    while( !free_slots.empty() )
+    {
+      unsigned f = free_slots.back();
+      free_slots.pop_back();
+      slots[f].listed = false;
+
+      if( !slots[f].used )
+      {
+        s = f;
+        break;
+      }
+    }
+
+    if( s == slots.size() )
+      slots.push_back( slot() );
+
+    place( s, slots[s].next_generation, v );
+    return handle( s, slots[s].generation );
+  }
+
+  //puts a value back under a handle it had before, the slot has to be free
+  void insert_at( const handle& h, const t& v )
+  {
+    assert( !h.is_null() );
+
+    while( h.index >= slots.size() )
+    {
+      slots.push_back( slot() );
+      add_free( slots.size() - 1 );
+    }
+
+    assert( !slots[h.index].used );
+    place( h.index, h.generation, v );
+  }
+
+  void erase( const handle& h )
+  {
+    assert( is_valid( h ) );
+
+    slot& sl = slots[h.index];
+    unsigned hole = sl.dense;
+    unsigned last = values.size() - 1;
+
+    if( hole != last )
+    {
+      values[hole] = values[last];
+      dense_to_slot[hole] = dense_to_slot[last];
+      slots[dense_to_slot[hole]].dense = hole;
+    }
+
+    values.pop_back();
+    dense_to_slot.pop_back();
+
+    sl.used = false;
+    add_free( h.index );
+  }
+};
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef spill_journal_h
+#define spill_journal_h
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cassert>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//flat binary encoding of plain data (eg. vectors, matrices, handles) for the journal
+class byte_writer
+{
+public:
+  std::vector<char> data;
+
+  template< class t >
+  void put( const t& v )
+  {
+    size_t pos = data.size();
+    data.resize( pos + sizeof( t ) );
+    std::memcpy( &data[pos], &v, sizeof( t ) );
+  }
+
+  template< class t >
+  void put_vector( const std::vector<t>& v )
+  {
+    put( unsigned( v.size() ) );
+
+    if( v.empty() )
+      return;
+
+    size_t pos = data.size();
+    data.resize( pos + v.size() * sizeof( t ) );
+    std::memcpy( &data[pos], &v[0], v.size() * sizeof( t ) );
+  }
+
+  void put_vector( const std::vector<bool>& v )
+  {
+    put( unsigned( v.size() ) );
+
+    for( unsigned c = 0; c < v.size(); ++c )
+      put( char( v[c] ) );
+  }
+};
+
+class byte_reader
+{
+  const char* ptr;
+  const char* end;
+
+public:
+  template< class t >
+  t get()
+  {
+    assert( ptr + sizeof( t ) <= end );
+
+    t v;
+    std::memcpy( &v, ptr, sizeof( t ) );
+    ptr += sizeof( t );
+    return v;
+  }
+
+  template< class t >
+  void get_vector( std::vector<t>& v )
+  {
+    v.resize( get<unsigned>() );
+
+    if( v.empty() )
+      return;
+
+    assert( ptr + v.size() * sizeof( t ) <= end );
+
+    std::memcpy( &v[0], ptr, v.size() * sizeof( t ) );
+    ptr += v.size() * sizeof( t );
+  }
+
+  void get_vector( std::vector<bool>& v )
+  {
+    v.resize( get<unsigned>() );
+
+    for( unsigned c = 0; c < v.size(); ++c )
+      v[c] = get<char>() != 0;
+  }
+
+  byte_reader( const char* p, size_t size ) : ptr( p ), end( p + size )
+  {
+  }
+};
+
+//append only file for data that doesn't have to stay in memory (eg. old undo steps)
+//records are written to the end of the file and read back through a memory mapping of it,
+//so reading one only touches its own pages. the file is deleted when the journal is closed
+class spill_journal
+{
+  std::string path;
+  unsigned long long file_size;
+  const char* mapped;
+  unsigned long long mapped_size;
+
+#ifdef _WIN32
+  HANDLE file;
+  HANDLE mapping;
+#else
+  int file;
+#endif
+
+  void unmap()
+  {
+    if( !mapped )
+      return;
+
+#ifdef _WIN32
+    UnmapViewOfFile( mapped );
+    CloseHandle( mapping );
+    mapping = 0;
+#else
+    munmap( ( void* )mapped, mapped_size );
+#endif
+
+    mapped = 0;
+    mapped_size = 0;
+  }
+
+  //maps the whole file, records appended since aren't visible in the old mapping
+  bool map()
+  {
+    unmap();
+
+#ifdef _WIN32
+    mapping = CreateFileMappingA( file, 0, PAGE_READONLY, 0, 0, 0 );
+
+    if( !mapping )
+      return false;
+
+    mapped = ( const char* )MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+
+    if( !mapped )
+    {
+      CloseHandle( mapping );
+      mapping = 0;
+      return false;
+    }
+#else
+    void* p = mmap( 0, file_size, PROT_READ, MAP_SHARED, file, 0 );
+
+    if( p == MAP_FAILED )
+      return false;
+
+    mapped = ( const char* )p;
+#endif
+
+    mapped_size = file_size;
+    return true;
+  }
+
+public:
+  bool is_open() const
+  {
+    return path.size() > 0;
+  }
+
+  //bytes written, including the records that were read back since
+  unsigned long long get_size() const
+  {
+    return file_size;
+  }
+
+  bool open( const std::string& filename )
+  {
+    close();
+
+#ifdef _WIN32
+    file = CreateFileA( filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY, 0 );
+
+    if( file == INVALID_HANDLE_VALUE )
+      return false;
+#else
+    file = ::open( filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600 );
+
+    if( file < 0 )
+      return false;
+#endif
+
+    path = filename;
+    file_size = 0;
+    return true;
+  }
+
+  void close()
+  {
+    if( !is_open() )
+      return;
+
+    unmap();
+
+#ifdef _WIN32
+    CloseHandle( file );
+    DeleteFileA( path.c_str() );
+#else
+    ::close( file );
+    unlink( path.c_str() );
+#endif
+
+    path.clear();
+    file_size = 0;
+  }
+
+  //throws away every record, the file starts over from the beginning
+  void clear()
+  {
+    if( !is_open() )
+      return;
+
+    unmap();
+
+#ifdef _WIN32
+    SetFilePointer( file, 0, 0, FILE_BEGIN );
+    SetEndOfFile( file );
+#else
+    if( ftruncate( file, 0 ) != 0 )
+      return;
+#endif
+
+    file_size = 0;
+  }
+
+  //returns the offset of the record, or -1 if it couldn't be written
+  long long append( const char* data, size_t size )
+  {
+    if( !is_open() )
+      return -1;
+
+    long long offset = file_size;
+
+#ifdef _WIN32
+    LARGE_INTEGER pos;
+    pos.QuadPart = offset;
+    SetFilePointerEx( file, pos, 0, FILE_BEGIN );
+
+    DWORD written = 0;
+    if( !WriteFile( file, data, DWORD( size ), &written, 0 ) || written != size )
+      return -1;
+#else
+    size_t written = 0;
+
+    while( written < size )
+    {
+      ssize_t res = pwrite( file, data + written, size - written, offset + written );
+
+      if( res <= 0 )
+        return -1;
+
+      written += res;
+    }
+#endif
+
+    file_size += size;
+    return offset;
+  }
+
+  //the record stays valid until the next read that needs a new mapping, or clear()
+  const char* read( unsigned long long offset, size_t size )
+  {
+    if( !is_open() || offset + size > file_size )
+      return 0;
+
+    if( offset + size > mapped_size && !map() )
+      return 0;
+
+    return mapped + offset;
+  }
+
+  spill_journal() : file_size( 0 ), mapped( 0 ), mapped_size( 0 )
+  {
+#ifdef _WIN32
+    file = INVALID_HANDLE_VALUE;
+    mapping = 0;
+#else
+    file = -1;
+#endif
+  }
+
+  ~spill_journal()
+  {
+    close();
+  }
+
+private:
+  spill_journal( const spill_journal& );
+  spill_journal& operator=( const spill_journal& );
+};
+
+#endif
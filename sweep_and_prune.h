@@ -0,0 +1,438 @@
+#ifndef sweep_and_prune_h
+#define sweep_and_prune_h
+
+#include "intersection.h"
+#include <vector>
+#include <algorithm>
+
+//incremental sweep and prune broad phase, keeps track of every pair of overlapping boxes
+//the endpoints of the boxes are kept sorted on all three axes, and moving a box insertion sorts its endpoints
+//to their new place. a pair starts or stops overlapping exactly when two endpoints swap,
+//so a frame costs O(moved boxes * endpoints passed) thanks to frame-to-frame coherence
+//usage: proxy = insert( box, data ), update( proxy, box ) whenever the object moves, remove( proxy )
+//then get_overlap_count( proxy ) or for_each_overlap( proxy, callback )
+template< class t >
+class sweep_and_prune
+{
+public:
+  static const int null_proxy = -1;
+
+private:
+  class endpoint
+  {
+  public:
+    float value;
+    unsigned id; //proxy << 1 | 1 for the max endpoints
+
+    int get_proxy() const
+    {
+      return id >> 1;
+    }
+
+    bool is_max() const
+    {
+      return id & 1;
+    }
+
+    //the order of the lists: by value, and on ties the mins go first, so touching boxes overlap
+    //every path that places endpoints has to use this, or whether touching boxes overlap would depend on the path
+    bool is_before( const endpoint& other ) const
+    {
+      return value < other.value || ( value == other.value && !is_max() && other.is_max() );
+    }
+  };
+
+  enum proxy_state
+  {
+    FREE = 0, PENDING, SORTED, REMOVED
+  };
+
+  class MM_16_BYTE_ALIGNED proxy_data
+  {
+  public:
+    aabb box;
+    t data;
+    unsigned ends[3][2]; //index of the min and max endpoint on each axis
+    std::vector<int> overlaps;
+    proxy_state state;
+    int next_free;
+  };
+
+  std::vector<proxy_data> proxies;
+  std::vector<endpoint> axes[3];
+  std::vector<int> pending; //inserted, but not in the endpoint lists yet
+  int free_list;
+  int removed_count; //removed, but their endpoints are still in the lists
+  int proxy_count;
+
+  //inserting one by one costs O(n) each, so big batches (eg. loading a scene) are sorted from scratch
+  //a rebuild costs about as much as a hundred inserts
+  static const int max_incremental_inserts = 64;
+
+  bool is_overlapping_on( int axis, const proxy_data& a, const proxy_data& b ) const
+  {
+    return a.ends[axis][0] < b.ends[axis][1] && b.ends[axis][0] < a.ends[axis][1];
+  }
+
+  void add_pair( int a, int b )
+  {
+    proxies[a].overlaps.push_back( b );
+    proxies[b].overlaps.push_back( a );
+  }
+
+  void remove_from( std::vector<int>& v, int p )
+  {
+    auto it = std::find( v.begin(), v.end(), p );
+    assert( it != v.end() );
+    *it = v.back();
+    v.pop_back();
+  }
+
+  void remove_pair( int a, int b )
+  {
+    remove_from( proxies[a].overlaps, b );
+    remove_from( proxies[b].overlaps, a );
+  }
+
+  //a swap of endpoints on this axis changed whether the two overlap on it
+  //they start or stop overlapping if they overlap on the other two axes
+  void on_swap( int axis, int a, int b, bool entering )
+  {
+    const proxy_data& pa = proxies[a];
+    const proxy_data& pb = proxies[b];
+
+    if( pb.state != SORTED || pa.state != SORTED )
+      return;
+
+    int j = ( axis + 1 ) % 3, k = ( axis + 2 ) % 3;
+
+    if( !is_overlapping_on( j, pa, pb ) || !is_overlapping_on( k, pa, pb ) )
+      return;
+
+    if( entering )
+      add_pair( a, b );
+    else
+      remove_pair( a, b );
+  }
+
+  //moves the endpoint at idx to its place by its value
+  void sift( int axis, unsigned idx )
+  {
+    std::vector<endpoint>& e = axes[axis];
+    endpoint moving = e[idx];
+    int p = moving.get_proxy();
+
+    //to the left: a min passing a max starts an overlap, a max passing a min ends one
+    while( idx > 0 && moving.is_before( e[idx - 1] ) )
+    {
+      const endpoint& other = e[idx - 1];
+
+      if( moving.is_max() != other.is_max() )
+        on_swap( axis, p, other.get_proxy(), !moving.is_max() );
+
+      e[idx] = other;
+      proxies[other.get_proxy()].ends[axis][other.is_max()] = idx;
+      --idx;
+    }
+
+    //to the right: a max passing a min starts an overlap, a min passing a max ends one
+    while( idx + 1 < e.size() && e[idx + 1].is_before( moving ) )
+    {
+      const endpoint& other = e[idx + 1];
+
+      if( moving.is_max() != other.is_max() )
+        on_swap( axis, p, other.get_proxy(), moving.is_max() );
+
+      e[idx] = other;
+      proxies[other.get_proxy()].ends[axis][other.is_max()] = idx;
+      ++idx;
+    }
+
+    e[idx] = moving;
+    proxies[p].ends[axis][moving.is_max()] = idx;
+  }
+
+  void move_endpoints( int p, const aabb& box )
+  {
+    proxy_data& pd = proxies[p];
+
+    for( int axis = 0; axis < 3; ++axis )
+    {
+      std::vector<endpoint>& e = axes[axis];
+      unsigned min_idx = pd.ends[axis][0], max_idx = pd.ends[axis][1];
+      bool max_first = box.max[axis] > e[max_idx].value;
+
+      e[min_idx].value = box.min[axis];
+      e[max_idx].value = box.max[axis];
+
+      //move the leading endpoint first, so that the two never pass each other
+      if( max_first )
+      {
+        sift( axis, pd.ends[axis][1] );
+        sift( axis, pd.ends[axis][0] );
+      }
+      else
+      {
+        sift( axis, pd.ends[axis][0] );
+        sift( axis, pd.ends[axis][1] );
+      }
+    }
+
+    pd.box = box;
+  }
+
+  //puts the endpoints straight to their place, and finds the pairs by testing against every box
+  //both are O(n), but much cheaper than sifting in from the end of the lists
+  void insert_sorted( int p )
+  {
+    proxy_data& pd = proxies[p];
+    pd.state = SORTED;
+
+    for( int axis = 0; axis < 3; ++axis )
+    {
+      std::vector<endpoint>& e = axes[axis];
+
+      for( int m = 0; m < 2; ++m )
+      {
+        endpoint n;
+        n.value = m ? pd.box.max[axis] : pd.box.min[axis];
+        n.id = unsigned( p ) << 1 | m;
+
+        unsigned idx = std::upper_bound( e.begin(), e.end(), n, []( const endpoint& a, const endpoint& b )
+        {
+          return a.is_before( b );
+        } ) - e.begin();
+
+        e.insert( e.begin() + idx, n );
+
+        for( unsigned c = idx; c < e.size(); ++c )
+          proxies[e[c].get_proxy()].ends[axis][e[c].is_max()] = c;
+      }
+    }
+
+    for( unsigned c = 0; c < proxies.size(); ++c )
+      if( c != unsigned( p ) && proxies[c].state == SORTED &&
+          is_overlapping_on( 0, pd, proxies[c] ) && is_overlapping_on( 1, pd, proxies[c] ) && is_overlapping_on( 2, pd, proxies[c] ) )
+        add_pair( p, c );
+  }
+
+  //sorts every endpoint from scratch, drops the removed ones, and finds all pairs with one sweep
+  void rebuild()
+  {
+    for( unsigned c = 0; c < proxies.size(); ++c )
+    {
+      if( proxies[c].state == REMOVED )
+      {
+        proxies[c].state = FREE;
+        proxies[c].next_free = free_list;
+        free_list = c;
+      }
+      else if( proxies[c].state != FREE )
+      {
+        proxies[c].state = SORTED;
+        proxies[c].overlaps.clear();
+      }
+    }
+
+    pending.clear();
+    removed_count = 0;
+
+    for( int axis = 0; axis < 3; ++axis )
+    {
+      std::vector<endpoint>& e = axes[axis];
+      e.clear();
+
+      for( unsigned c = 0; c < proxies.size(); ++c )
+      {
+        if( proxies[c].state != SORTED )
+          continue;
+
+        endpoint min_e, max_e;
+        min_e.value = proxies[c].box.min[axis];
+        min_e.id = unsigned( c ) << 1;
+        max_e.value = proxies[c].box.max[axis];
+        max_e.id = unsigned( c ) << 1 | 1;
+        e.push_back( min_e );
+        e.push_back( max_e );
+      }
+
+      std::sort( e.begin(), e.end(), []( const endpoint& a, const endpoint& b )
+      {
+        return a.is_before( b );
+      } );
+
+      for( unsigned c = 0; c < e.size(); ++c )
+        proxies[e[c].get_proxy()].ends[axis][e[c].is_max()] = c;
+    }
+
+    //sweep along x, the boxes that are open when a box starts overlap it on x
+    std::vector<int> active;
+
+    for( auto& e : axes[0] )
+    {
+      int p = e.get_proxy();
+
+      if( e.is_max() )
+      {
+        remove_from( active, p );
+        continue;
+      }
+
+      for( auto& a : active )
+        if( is_overlapping_on( 1, proxies[p], proxies[a] ) && is_overlapping_on( 2, proxies[p], proxies[a] ) )
+          add_pair( p, a );
+
+      active.push_back( p );
+    }
+  }
+
+  //sorts in the pending boxes
+  void flush()
+  {
+    if( pending.empty() && removed_count * 2 <= proxy_count )
+      return;
+
+    if( pending.size() > max_incremental_inserts || removed_count * 2 > proxy_count )
+    {
+      rebuild();
+      return;
+    }
+
+    for( auto& p : pending )
+      insert_sorted( p );
+
+    pending.clear();
+  }
+
+public:
+  sweep_and_prune() : free_list( null_proxy ), removed_count( 0 ), proxy_count( 0 )
+  {
+  }
+
+  int size() const
+  {
+    return proxy_count;
+  }
+
+  void clear()
+  {
+    proxies.clear();
+    pending.clear();
+
+    for( int axis = 0; axis < 3; ++axis )
+      axes[axis].clear();
+
+    free_list = null_proxy;
+    removed_count = 0;
+    proxy_count = 0;
+  }
+
+  //the box is only sorted in on the next update or query
+  int insert( const aabb& box, const t& data )
+  {
+    int p = free_list;
+
+    if( p == null_proxy )
+    {
+      p = proxies.size();
+      proxies.push_back( proxy_data() );
+    }
+    else
+    {
+      free_list = proxies[p].next_free;
+    }
+
+    proxies[p].box = box;
+    proxies[p].data = data;
+    proxies[p].overlaps.clear();
+    proxies[p].state = PENDING;
+    pending.push_back( p );
+    ++proxy_count;
+
+    return p;
+  }
+
+  //the endpoints stay in the lists until the next rebuild, they just don't report pairs anymore
+  //(the proxy isn't reused until then either)
+  void remove( int p )
+  {
+    assert( p >= 0 && p < int( proxies.size() ) && ( proxies[p].state == PENDING || proxies[p].state == SORTED ) );
+
+    proxy_data& pd = proxies[p];
+
+    if( pd.state == PENDING )
+    {
+      remove_from( pending, p );
+      pd.state = FREE;
+      pd.next_free = free_list;
+      free_list = p;
+    }
+    else
+    {
+      while( !pd.overlaps.empty() )
+        remove_pair( p, pd.overlaps.back() );
+
+      pd.state = REMOVED;
+      ++removed_count;
+    }
+
+    pd.data = t();
+    --proxy_count;
+  }
+
+  void update( int p, const aabb& box )
+  {
+    assert( p >= 0 && p < int( proxies.size() ) && ( proxies[p].state == PENDING || proxies[p].state == SORTED ) );
+
+    if( proxies[p].state == PENDING )
+    {
+      proxies[p].box = box;
+      return;
+    }
+
+    flush();
+    move_endpoints( p, box );
+  }
+
+  const aabb& get_aabb( int p ) const
+  {
+    return proxies[p].box;
+  }
+
+  const t& get_data( int p ) const
+  {
+    return proxies[p].data;
+  }
+
+  //number of boxes overlapping the box of the proxy
+  int get_overlap_count( int p )
+  {
+    flush();
+    return proxies[p].overlaps.size();
+  }
+
+  //calls callback( data ) for each box overlapping the box of the proxy
+  template< class cbk >
+  void for_each_overlap( int p, cbk callback )
+  {
+    flush();
+
+    for( auto& o : proxies[p].overlaps )
+      callback( proxies[o].data );
+  }
+
+  //calls callback( data, data ) once for every overlapping pair
+  template< class cbk >
+  void for_each_pair( cbk callback )
+  {
+    flush();
+
+    for( int c = 0; c < proxies.size(); ++c )
+      if( proxies[c].state == SORTED )
+        for( auto& o : proxies[c].overlaps )
+          if( c < o )
+            callback( proxies[c].data, proxies[o].data );
+  }
+};
+
+#endif
@@ -0,0 +1,311 @@
+#ifndef transform_cache_h
+#define transform_cache_h
+
+#include <mymath/mymath.h>
+#include <vector>
+#include <algorithm>
+
+//world matrices and their inverses of a hierarchy of translate * rotate * scale transformations, stored by slot (eg. of a slot_map)
+//a slot may have a parent slot, then its transformation is relative to the parent's
+//the slots are kept in a flattened depth first order, where every subtree is one contiguous range right after its root
+//changing a transformation only marks its slot dirty, and the dirty subtrees are recomputed together, top-down, when they are needed,
+//so objects that don't move cost nothing per frame, and moving a parent recomputes what is below it and nothing else
+class transform_cache
+{
+public:
+  enum { no_parent = ~0u };
+
+private:
+  std::vector<mm::mat4> models, inverses;
+  std::vector<unsigned> parents;
+  std::vector<unsigned> live_bits; //bit i is set if slot i is in the hierarchy
+  std::vector<unsigned> dirty_bits; //bit i is set if the transformation of slot i changed, its subtree has to be recomputed
+  std::vector<unsigned> dirty_slots; //may hold slots that were removed since, their bit is clear
+
+  //the live slots depth first, where each slot is in it and how big its subtree is
+  //only rebuilt when it is needed after slots were added, removed or moved to an other parent
+  std::vector<unsigned> order, order_pos, subtree_size;
+  bool order_valid;
+
+  //scratch space of build_order() and update()
+  std::vector<unsigned> child_start, child_fill, children, stack, dirty_pos;
+
+  static bool get_bit( const std::vector<unsigned>& bits, unsigned i )
+  {
+    return bits[i >> 5] & ( 1u << ( i & 31 ) );
+  }
+
+  static void set_bit( std::vector<unsigned>& bits, unsigned i, bool value )
+  {
+    if( value )
+      bits[i >> 5] |= 1u << ( i & 31 );
+    else
+      bits[i >> 5] &= ~( 1u << ( i & 31 ) );
+  }
+
+  bool is_live( unsigned slot ) const
+  {
+    return slot < parents.size() && get_bit( live_bits, slot );
+  }
+
+  //a parent that isn't in the hierarchy (yet) counts as none
+  unsigned get_parent( unsigned slot ) const
+  {
+    return is_live( parents[slot] ) ? parents[slot] : no_parent;
+  }
+
+  void grow( unsigned slot )
+  {
+    if( slot < parents.size() )
+      return;
+
+    models.resize( slot + 1, mm::mat4::identity );
+    inverses.resize( slot + 1, mm::mat4::identity );
+    parents.resize( slot + 1, no_parent );
+    order_pos.resize( slot + 1, 0 );
+    subtree_size.resize( slot + 1, 0 );
+    live_bits.resize( ( slot + 32 ) / 32, 0 );
+    dirty_bits.resize( live_bits.size(), 0 );
+  }
+
+  void build_order()
+  {
+    unsigned num = parents.size();
+
+    //the children of each slot next to each other, by counting them first
+    child_start.assign( num + 1, 0 );
+
+    for( unsigned s = 0; s < num; ++s )
+      if( is_live( s ) && get_parent( s ) != no_parent )
+        ++child_start[get_parent( s ) + 1];
+
+    for( unsigned s = 0; s < num; ++s )
+      child_start[s + 1] += child_start[s];
+
+    child_fill.assign( child_start.begin(), child_start.end() - 1 );
+    children.resize( child_start[num] );
+
+    for( unsigned s = 0; s < num; ++s )
+      if( is_live( s ) && get_parent( s ) != no_parent )
+        children[child_fill[get_parent( s )]++] = s;
+
+    order.clear();
+
+    for( unsigned r = 0; r < num; ++r )
+    {
+      if( !is_live( r ) || get_parent( r ) != no_parent )
+        continue;
+
+      stack.push_back( r );
+
+      while( !stack.empty() )
+      {
+        unsigned s = stack.back();
+        stack.pop_back();
+
+        order_pos[s] = order.size();
+        order.push_back( s );
+        subtree_size[s] = 1;
+
+        for( unsigned c = child_start[s + 1]; c > child_start[s]; --c )
+          stack.push_back( children[c - 1] );
+      }
+    }
+
+    //children come after their parents, so going backwards sums the subtrees up
+    for( unsigned i = order.size(); i > 0; --i )
+    {
+      unsigned s = order[i - 1];
+
+      if( get_parent( s ) != no_parent )
+        subtree_size[get_parent( s )] += subtree_size[s];
+    }
+
+    order_valid = true;
+  }
+
+public:
+  //without general matrix products or a general inverse: the rotation is orthonormal,
+  //so the columns of the model are the scaled columns of the rotation, and the inverse is S^-1 * R^T * T^-1
+  static void get_matrices( const mm::vec3& t, const mm::mat4& r, const mm::vec3& s, mm::mat4& model, mm::mat4& inverse )
+  {
+    model[0] = r[0] * s.x;
+    model[1] = r[1] * s.y;
+    model[2] = r[2] * s.z;
+    model[3] = mm::vec4( t, 1 );
+
+    mm::vec3 inv_s = 1.0f / s;
+    mm::mat4 rt = mm::transpose( r );
+
+    inverse[0] = mm::vec4( rt[0].xyz * inv_s, 0 );
+    inverse[1] = mm::vec4( rt[1].xyz * inv_s, 0 );
+    inverse[2] = mm::vec4( rt[2].xyz * inv_s, 0 );
+    inverse[3] = mm::vec4( -( inverse[0].xyz * t.x + inverse[1].xyz * t.y + inverse[2].xyz * t.z ), 1 );
+  }
+
+  //true if the slot or one of its parents changed since the last update
+  bool is_dirty( unsigned slot ) const
+  {
+    if( !is_live( slot ) )
+      return false;
+
+    for( unsigned s = slot; s != no_parent; s = get_parent( s ) )
+      if( get_bit( dirty_bits, s ) )
+        return true;
+
+    return false;
+  }
+
+  bool has_dirty() const
+  {
+    return !dirty_slots.empty();
+  }
+
+  void mark_dirty( unsigned slot )
+  {
+    grow( slot );
+
+    if( get_bit( dirty_bits, slot ) )
+      return;
+
+    set_bit( dirty_bits, slot, true );
+    dirty_slots.push_back( slot );
+  }
+
+  //the parent doesn't have to be added yet, the slot is a root until it is
+  void add( unsigned slot, unsigned parent = no_parent )
+  {
+    grow( slot );
+    set_bit( live_bits, slot, true );
+    parents[slot] = parent;
+    order_valid = false;
+    mark_dirty( slot );
+  }
+
+  //the children of the slot become roots, unless they get removed too
+  void remove( unsigned slot )
+  {
+    if( !is_live( slot ) )
+      return;
+
+    set_bit( live_bits, slot, false );
+    set_bit( dirty_bits, slot, false );
+    parents[slot] = no_parent;
+    order_valid = false;
+  }
+
+  void set_parent( unsigned slot, unsigned parent )
+  {
+    parents[slot] = parent;
+    order_valid = false;
+    mark_dirty( slot );
+  }
+
+  //recomputes the dirty subtrees, parents before their children
+  //get_local( slot, t, r, s ) has to give the transformation of a slot relative to its parent,
+  //and moved( slot ) is called for every slot whose matrices changed
+  template< class local_cbk, class moved_cbk >
+  void update( local_cbk get_local, moved_cbk moved )
+  {
+    if( dirty_slots.empty() )
+      return;
+
+    if( !order_valid )
+      build_order();
+
+    dirty_pos.clear();
+
+    for( auto& s : dirty_slots )
+    {
+      if( !get_bit( dirty_bits, s ) )
+        continue;
+
+      set_bit( dirty_bits, s, false );
+      dirty_pos.push_back( order_pos[s] );
+    }
+
+    dirty_slots.clear();
+    std::sort( dirty_pos.begin(), dirty_pos.end() );
+
+    //a dirty subtree inside an other one is recomputed with that
+    unsigned done = 0;
+
+    for( auto& p : dirty_pos )
+    {
+      if( p < done )
+        continue;
+
+      unsigned end = p + subtree_size[order[p]];
+
+      for( unsigned i = p; i < end; ++i )
+      {
+        unsigned s = order[i];
+        unsigned parent = get_parent( s );
+        mm::vec3 t, sc;
+        mm::mat4 r;
+
+        get_local( s, t, r, sc );
+        get_matrices( t, r, sc, models[s], inverses[s] );
+
+        if( parent != no_parent )
+        {
+          models[s] = models[parent] * models[s];
+          inverses[s] = inverses[s] * inverses[parent];
+        }
+
+        moved( s );
+      }
+
+      done = end;
+    }
+  }
+
+  //calls callback( slot ) for the slot and everything below it, parents before their children
+  //the callback must not add, remove or move slots
+  template< class cbk >
+  void for_each_in_subtree( unsigned slot, cbk callback )
+  {
+    if( !is_live( slot ) )
+      return;
+
+    if( !order_valid )
+      build_order();
+
+    unsigned p = order_pos[slot];
+
+    for( unsigned i = p; i < p + subtree_size[slot]; ++i )
+      callback( order[i] );
+  }
+
+  //calls callback( slot ) for the direct children of the slot
+  template< class cbk >
+  void for_each_child( unsigned slot, cbk callback )
+  {
+    if( !is_live( slot ) )
+      return;
+
+    if( !order_valid )
+      build_order();
+
+    unsigned p = order_pos[slot];
+
+    for( unsigned i = p + 1; i < p + subtree_size[slot]; i += subtree_size[order[i]] )
+      callback( order[i] );
+  }
+
+  const mm::mat4& get_model( unsigned slot ) const
+  {
+    return models[slot];
+  }
+
+  const mm::mat4& get_inverse( unsigned slot ) const
+  {
+    return inverses[slot];
+  }
+
+  transform_cache() : order_valid( true )
+  {
+  }
+};
+
+#endif
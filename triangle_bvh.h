@@ -0,0 +1,399 @@
+#ifndef triangle_bvh_h
+#define triangle_bvh_h
+
+#include "intersection.h"
+#include <vector>
+#include <algorithm>
+#include <future>
+#include <thread>
+
+//bounding volume hierarchy over the triangles of a mesh, for exact closest hit ray queries
+//built top-down with a binned surface area heuristic, big subtrees are built in parallel
+class triangle_bvh
+{
+public:
+  class MM_16_BYTE_ALIGNED node
+  {
+  public:
+    mm::vec3 min, max;
+    unsigned first; //inner node: index of the right child (the left child is the next node), leaf: first triangle
+    unsigned count; //0 for inner nodes, number of triangles in leaves
+
+    bool is_leaf() const
+    {
+      return count > 0;
+    }
+  };
+
+  std::vector<node> nodes;
+  std::vector<mm::vec3> vertices; //3 per triangle, in leaf order
+  std::vector<unsigned> triangle_ids; //original index of each triangle, in leaf order
+
+private:
+  static const int num_bins = 16;
+  static const unsigned max_leaf_size = 4;
+  static const unsigned parallel_threshold = 1 << 16; //triangles, below this a subtree is built on the current thread
+  static const unsigned max_depth = 128; //of the tree, the traversal stack is this big
+  //below this depth only median splits are made, they halve the triangles, so a mesh of less than 2^32 of them
+  //can't get deeper than max_depth however lopsided the heuristic splits above were
+  static const unsigned max_sah_depth = max_depth - 32;
+
+  //build time data
+  struct build_data
+  {
+    std::vector<mm::vec3> centroids;
+    std::vector<mm::vec3> mins, maxs;
+    std::vector<unsigned> ids;
+  };
+
+  static mm::vec3 get_vertex( const float* verts, unsigned i )
+  {
+    return mm::vec3( verts[i * 3 + 0], verts[i * 3 + 1], verts[i * 3 + 2] );
+  }
+
+  static float get_area( const mm::vec3& min, const mm::vec3& max )
+  {
+    mm::vec3 e = max - min;
+    return e.x * e.y + e.y * e.z + e.z * e.x;
+  }
+
+  //builds the subtree of ids[first...first+count) into out, node indices are relative to out
+  static void build_recursive( build_data& d, unsigned first, unsigned count, std::vector<node>& out, int parallel_depth, unsigned depth )
+  {
+    unsigned idx = out.size();
+    out.push_back( node() );
+
+    mm::vec3 min( FLT_MAX ), max( -FLT_MAX ), cmin( FLT_MAX ), cmax( -FLT_MAX );
+
+    for( unsigned c = first; c < first + count; ++c )
+    {
+      unsigned id = d.ids[c];
+      min = mm::min( min, d.mins[id] );
+      max = mm::max( max, d.maxs[id] );
+      cmin = mm::min( cmin, d.centroids[id] );
+      cmax = mm::max( cmax, d.centroids[id] );
+    }
+
+    out[idx].min = min;
+    out[idx].max = max;
+    out[idx].first = first;
+    out[idx].count = count;
+
+    if( count <= max_leaf_size )
+      return;
+
+    //find the cheapest binned split over all three axes
+    float best_cost = FLT_MAX;
+    int best_axis = -1, best_split = 0;
+
+    for( int axis = 0; axis < 3 && depth < max_sah_depth; ++axis )
+    {
+      float extent = cmax[axis] - cmin[axis];
+
+      if( extent <= 0 )
+        continue;
+
+      unsigned bin_count[num_bins] = { 0 };
+      mm::vec3 bin_min[num_bins], bin_max[num_bins];
+
+      for( int b = 0; b < num_bins; ++b )
+      {
+        bin_min[b] = mm::vec3( FLT_MAX );
+        bin_max[b] = mm::vec3( -FLT_MAX );
+      }
+
+      float scale = num_bins / extent;
+
+      for( unsigned c = first; c < first + count; ++c )
+      {
+        unsigned id = d.ids[c];
+        int b = std::min( num_bins - 1, int( ( d.centroids[id][axis] - cmin[axis] ) * scale ) );
+        ++bin_count[b];
+        bin_min[b] = mm::min( bin_min[b], d.mins[id] );
+        bin_max[b] = mm::max( bin_max[b], d.maxs[id] );
+      }
+
+      //sweep from the right to get the cost of every right side
+      float right_area[num_bins];
+      unsigned right_count[num_bins];
+      mm::vec3 rmin( FLT_MAX ), rmax( -FLT_MAX );
+      unsigned rcount = 0;
+
+      for( int b = num_bins - 1; b > 0; --b )
+      {
+        rmin = mm::min( rmin, bin_min[b] );
+        rmax = mm::max( rmax, bin_max[b] );
+        rcount += bin_count[b];
+        right_area[b] = rcount ? get_area( rmin, rmax ) : 0;
+        right_count[b] = rcount;
+      }
+
+      mm::vec3 lmin( FLT_MAX ), lmax( -FLT_MAX );
+      unsigned lcount = 0;
+
+      for( int b = 0; b < num_bins - 1; ++b )
+      {
+        lmin = mm::min( lmin, bin_min[b] );
+        lmax = mm::max( lmax, bin_max[b] );
+        lcount += bin_count[b];
+
+        if( lcount == 0 || right_count[b + 1] == 0 )
+          continue;
+
+        float cost = lcount * get_area( lmin, lmax ) + right_count[b + 1] * right_area[b + 1];
+
+        if( cost < best_cost )
+        {
+          best_cost = cost;
+          best_axis = axis;
+          best_split = b;
+        }
+      }
+    }
+
+    unsigned mid = first;
+
+    if( best_axis >= 0 && best_cost < count * get_area( min, max ) )
+    {
+      float scale = num_bins / ( cmax[best_axis] - cmin[best_axis] );
+      float split_min = cmin[best_axis];
+      int axis = best_axis, split = best_split;
+
+      mid = std::partition( d.ids.begin() + first, d.ids.begin() + first + count, [&]( unsigned id )
+      {
+        return std::min( num_bins - 1, int( ( d.centroids[id][axis] - split_min ) * scale ) ) <= split;
+      } ) - d.ids.begin();
+    }
+    else if( count > max_leaf_size * 4 || depth >= max_sah_depth )
+    {
+      //splitting doesn't pay off by the heuristic (or all centroids coincide, or the tree is too deep for it), but the leaf would be too big
+      //fall back to a median split on the largest axis
+      mm::vec3 e = cmax - cmin;
+      int axis = e.x > e.y ? ( e.x > e.z ? 0 : 2 ) : ( e.y > e.z ? 1 : 2 );
+      mid = first + count / 2;
+
+      std::nth_element( d.ids.begin() + first, d.ids.begin() + mid, d.ids.begin() + first + count, [&]( unsigned a, unsigned b )
+      {
+        return d.centroids[a][axis] < d.centroids[b][axis];
+      } );
+    }
+    else
+    {
+      return; //stays a leaf
+    }
+
+    out[idx].count = 0;
+
+    unsigned left_count = mid - first;
+    unsigned right_count = count - left_count;
+
+    if( parallel_depth > 0 && right_count > parallel_threshold )
+    {
+      //the two halves touch disjoint ranges of ids, so the right one can go to another thread
+      std::vector<node> right_nodes;
+
+      std::future<void> right = std::async( std::launch::async, [&]()
+      {
+        build_recursive( d, mid, right_count, right_nodes, parallel_depth - 1, depth + 1 );
+      } );
+
+      build_recursive( d, first, left_count, out, parallel_depth - 1, depth + 1 );
+      right.get();
+
+      unsigned offset = out.size();
+      out[idx].first = offset;
+
+      for( auto& n : right_nodes )
+      {
+        if( !n.is_leaf() )
+          n.first += offset;
+
+        out.push_back( n );
+      }
+    }
+    else
+    {
+      build_recursive( d, first, left_count, out, parallel_depth, depth + 1 );
+      out[idx].first = out.size();
+      build_recursive( d, mid, right_count, out, parallel_depth, depth + 1 );
+    }
+  }
+
+  static bool intersect_node( const node& n, const mm::vec3& origin, const mm::vec3& inv_dir, float max_dist, float& entry )
+  {
+    mm::vec3 t1 = ( n.min - origin ) * inv_dir;
+    mm::vec3 t2 = ( n.max - origin ) * inv_dir;
+    mm::vec3 tmin = mm::min( t1, t2 );
+    mm::vec3 tmax = mm::max( t1, t2 );
+
+    entry = std::max( std::max( tmin.x, tmin.y ), std::max( tmin.z, 0.0f ) );
+    float exit = std::min( std::min( tmax.x, tmax.y ), std::min( tmax.z, max_dist ) );
+
+    return entry <= exit;
+  }
+
+public:
+  bool empty() const
+  {
+    return nodes.empty();
+  }
+
+  //indexed triangles, 3 floats per vertex (like mesh::vertices and mesh::indices)
+  void build( const float* verts, const unsigned* indices, unsigned num_triangles )
+  {
+    nodes.clear();
+    vertices.clear();
+    triangle_ids.clear();
+
+    if( num_triangles == 0 )
+      return;
+
+    build_data d;
+    d.centroids.resize( num_triangles );
+    d.mins.resize( num_triangles );
+    d.maxs.resize( num_triangles );
+    d.ids.resize( num_triangles );
+
+    for( unsigned c = 0; c < num_triangles; ++c )
+    {
+      mm::vec3 k = get_vertex( verts, indices[c * 3 + 0] );
+      mm::vec3 l = get_vertex( verts, indices[c * 3 + 1] );
+      mm::vec3 m = get_vertex( verts, indices[c * 3 + 2] );
+
+      d.mins[c] = mm::min( mm::min( k, l ), m );
+      d.maxs[c] = mm::max( mm::max( k, l ), m );
+      d.centroids[c] = ( d.mins[c] + d.maxs[c] ) * 0.5f;
+      d.ids[c] = c;
+    }
+
+    //each level of parallel splits doubles the number of threads
+    int parallel_depth = 0;
+    for( unsigned t = std::thread::hardware_concurrency(); t > 1; t >>= 1 )
+      ++parallel_depth;
+
+    nodes.reserve( num_triangles / max_leaf_size * 2 + 1 );
+    build_recursive( d, 0, num_triangles, nodes, parallel_depth, 0 );
+
+    //copy the triangles into leaf order so that the traversal reads them linearly
+    vertices.resize( num_triangles * 3 );
+    triangle_ids = d.ids;
+
+    for( unsigned c = 0; c < num_triangles; ++c )
+    {
+      unsigned id = d.ids[c];
+      vertices[c * 3 + 0] = get_vertex( verts, indices[id * 3 + 0] );
+      vertices[c * 3 + 1] = get_vertex( verts, indices[id * 3 + 1] );
+      vertices[c * 3 + 2] = get_vertex( verts, indices[id * 3 + 2] );
+    }
+  }
+
+  //triangle soup, 3 vertices per triangle
+  void build( const std::vector<mm::vec3>& soup )
+  {
+    std::vector<float> verts( soup.size() * 3 );
+    std::vector<unsigned> indices( soup.size() );
+
+    for( unsigned c = 0; c < soup.size(); ++c )
+    {
+      verts[c * 3 + 0] = soup[c].x;
+      verts[c * 3 + 1] = soup[c].y;
+      verts[c * 3 + 2] = soup[c].z;
+      indices[c] = c;
+    }
+
+    if( !soup.empty() )
+      build( &verts[0], &indices[0], soup.size() / 3 );
+  }
+
+  //closest hit along the ray, the ray is in the space the bvh was built in
+  //the normal of the hit is normalized and faces against the ray
+  bool intersect( const ray& r, triangle_hit& hit, float max_dist = FLT_MAX ) const
+  {
+    if( nodes.empty() )
+      return false;
+
+    watertight_ray wr( r );
+    mm::vec3 inv_dir = get_safe_inv_dir( r.direction );
+
+    unsigned stack[max_depth];
+    int stack_size = 0;
+    unsigned current = 0;
+    bool found = false;
+    unsigned closest = 0; //leaf order index of the hit triangle
+    float entry;
+
+    if( !intersect_node( nodes[0], r.origin, inv_dir, max_dist, entry ) )
+      return false;
+
+    for( ;; )
+    {
+      const node& n = nodes[current];
+
+      if( n.is_leaf() )
+      {
+        for( unsigned c = n.first; c < n.first + n.count; ++c )
+        {
+          triangle_hit h;
+
+          if( intersect_watertight( wr, vertices[c * 3 + 0], vertices[c * 3 + 1], vertices[c * 3 + 2], h, max_dist ) )
+          {
+            max_dist = h.t;
+            hit = h;
+            hit.triangle = triangle_ids[c];
+            closest = c;
+            found = true;
+          }
+        }
+      }
+      else
+      {
+        //visit the nearer child first, the other one goes on the stack
+        unsigned left = current + 1, right = n.first;
+        float left_entry, right_entry;
+        bool left_hit = intersect_node( nodes[left], r.origin, inv_dir, max_dist, left_entry );
+        bool right_hit = intersect_node( nodes[right], r.origin, inv_dir, max_dist, right_entry );
+
+        if( left_hit && right_hit )
+        {
+          if( right_entry < left_entry )
+            std::swap( left, right );
+
+          assert( stack_size < int( max_depth ) );
+          stack[stack_size++] = right;
+          current = left;
+          continue;
+        }
+        else if( left_hit || right_hit )
+        {
+          current = left_hit ? left : right;
+          continue;
+        }
+      }
+
+      //pop the next node that can still contain a closer hit
+      bool next = false;
+
+      while( stack_size > 0 && !next )
+      {
+        current = stack[--stack_size];
+        next = intersect_node( nodes[current], r.origin, inv_dir, max_dist, entry );
+      }
+
+      if( !next )
+        break;
+    }
+
+    if( found )
+    {
+      const mm::vec3* k = &vertices[closest * 3];
+      hit.normal = mm::normalize( mm::cross( k[1] - k[0], k[2] - k[0] ) );
+
+      if( mm::dot( hit.normal, r.direction ) > 0 )
+        hit.normal = -hit.normal;
+    }
+
+    return found;
+  }
+};
+
+#endif